@@ -29,9 +29,11 @@
 #include <map>
 #include <algorithm>
 #include <list>
+#include <vector>
 
 #include "cache.h"
 #include "s3fs_util.h"
+#include "string_util.h"
 
 using namespace std;
 
@@ -39,7 +41,369 @@ using namespace std;
 // Static
 //-------------------------------------------------------------------
 StatCache StatCache::singleton;
-pthread_mutex_t StatCache::stat_cache_lock;
+pthread_mutex_t StatCache::revalidate_lock;
+pthread_cond_t  StatCache::revalidate_cond;
+
+//-------------------------------------------------------------------
+// Interned strings
+//-------------------------------------------------------------------
+// The key of extmeta and Content-Type are shared by all entries.
+//
+// The table is read-mostly, then it is looked up without locking. A slot
+// is only set once under intern_lock after the string is stored, and it
+// is never cleared. If the table is full, the caller keeps the string
+// in the entry instead of the interned one.
+//
+#define	MAX_INTERN_COUNT    1024
+#define	INTERN_TABLE_SIZE   (MAX_INTERN_COUNT * 2)
+
+struct intern_table {
+  const std::string* volatile strs[MAX_INTERN_COUNT];    // string for id(index + 1)
+  volatile unsigned short     slots[INTERN_TABLE_SIZE];  // id by hash of string(0 is empty)
+  unsigned short              count;
+};
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static intern_table    intern_keys;     // key of extmeta
+static intern_table    intern_ctypes;   // Content-Type
+
+static unsigned int intern_hash(const string& str)
+{
+  unsigned int hash = 2166136261U;
+  for(string::const_iterator iter = str.begin(); iter != str.end(); ++iter){
+    hash ^= static_cast<unsigned char>(*iter);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+// Returns the id of str, or 0 if str is not found(pslot is set the empty slot).
+static unsigned short intern_find(const intern_table& table, const string& str, unsigned int* pslot)
+{
+  for(unsigned int slot = intern_hash(str) % INTERN_TABLE_SIZE; ; slot = (slot + 1) % INTERN_TABLE_SIZE){
+    unsigned short id = table.slots[slot];
+    if(0 == id){
+      if(pslot){
+        *pslot = slot;
+      }
+      return 0;
+    }
+    __sync_synchronize();   // pairs with the barrier in intern_add
+    if(*(table.strs[id - 1]) == str){
+      return id;
+    }
+  }
+}
+
+static unsigned short intern_add(intern_table& table, const string& str)
+{
+  unsigned short id;
+  unsigned int   slot;
+
+  if(0 != (id = intern_find(table, str, NULL))){
+    return id;
+  }
+  pthread_mutex_lock(&intern_lock);
+  if(0 == (id = intern_find(table, str, &slot)) && table.count < MAX_INTERN_COUNT){
+    table.strs[table.count] = new string(str);
+    id = ++table.count;
+    __sync_synchronize();   // the string is stored before publishing the slot
+    table.slots[slot] = id;
+  }
+  pthread_mutex_unlock(&intern_lock);
+  return id;    // 0 means the table is full.
+}
+
+static const string* intern_key(const string& key)
+{
+  unsigned short id = intern_add(intern_keys, key);
+  return (0 == id ? NULL : intern_keys.strs[id - 1]);
+}
+
+static unsigned short intern_ctype(const string& ctype)
+{
+  return intern_add(intern_ctypes, ctype);
+}
+
+static string get_ctype(unsigned short id)
+{
+  // id is got from the entry, then the string is already stored.
+  if(0 < id && id <= MAX_INTERN_COUNT && intern_ctypes.strs[id - 1]){
+    return *(intern_ctypes.strs[id - 1]);
+  }
+  return string("");
+}
+
+//-------------------------------------------------------------------
+// Utility for stat_cache_entry
+//-------------------------------------------------------------------
+#define	LASTMODIFIED_FORMAT  "%a, %d %b %Y %H:%M:%S GMT"
+
+static bool parse_lastmodified(const string& value, time_t& time)
+{
+  struct tm tm;
+  memset(&tm, 0, sizeof(struct tm));
+  if(NULL == strptime(value.c_str(), LASTMODIFIED_FORMAT, &tm)){
+    return false;
+  }
+  time = timegm(&tm);
+  return true;
+}
+
+static string format_lastmodified(time_t time)
+{
+  struct tm tm;
+  char      buff[64];
+  gmtime_r(&time, &tm);
+  strftime(buff, sizeof(buff), LASTMODIFIED_FORMAT, &tm);
+  return string(buff);
+}
+
+// ETag is kept as 16 bytes when it is '"' + MD5 hex + '"'.
+static bool parse_etag(const string& value, unsigned char* etag)
+{
+  if(34 != value.length() || '"' != value[0] || '"' != value[33]){
+    return false;
+  }
+  for(int cnt = 0; cnt < 16; cnt++){
+    unsigned char byte = 0;
+    for(int pos = 1 + cnt * 2; pos < 3 + cnt * 2; pos++){
+      char ch = value[pos];
+      byte <<= 4;
+      if('0' <= ch && ch <= '9'){
+        byte |= ch - '0';
+      }else if('a' <= ch && ch <= 'f'){
+        byte |= ch - 'a' + 10;
+      }else{
+        return false;
+      }
+    }
+    etag[cnt] = byte;
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------
+// Class stat_cache_entry
+//-------------------------------------------------------------------
+void stat_cache_entry::Clear(void)
+{
+  size             = 0;
+  mtime            = 0;
+  mode             = 0;
+  uid              = 0;
+  gid              = 0;
+  lastmodified     = 0;
+  meta_mtime       = 0;
+  meta_mode        = 0;
+  meta_uid         = 0;
+  meta_gid         = 0;
+  memset(etag, 0, sizeof(etag));
+  ctype            = 0;
+  isforce          = false;
+  noobjcache       = false;
+  islisted         = false;
+  has_length       = false;
+  has_etag         = false;
+  has_lastmodified = false;
+  has_meta_mtime   = false;
+  has_meta_mode    = false;
+  has_meta_uid     = false;
+  has_meta_gid     = false;
+  hit_count        = 0;
+  cache_date       = 0;
+  if(extmeta){
+    delete extmeta;
+    extmeta = NULL;
+  }
+}
+
+// copy all without pkey and LRU list
+void stat_cache_entry::Copy(const stat_cache_entry& other)
+{
+  size             = other.size;
+  mtime            = other.mtime;
+  mode             = other.mode;
+  uid              = other.uid;
+  gid              = other.gid;
+  lastmodified     = other.lastmodified;
+  meta_mtime       = other.meta_mtime;
+  meta_mode        = other.meta_mode;
+  meta_uid         = other.meta_uid;
+  meta_gid         = other.meta_gid;
+  memcpy(etag, other.etag, sizeof(etag));
+  ctype            = other.ctype;
+  isforce          = other.isforce;
+  noobjcache       = other.noobjcache;
+  islisted         = other.islisted;
+  has_length       = other.has_length;
+  has_etag         = other.has_etag;
+  has_lastmodified = other.has_lastmodified;
+  has_meta_mtime   = other.has_meta_mtime;
+  has_meta_mode    = other.has_meta_mode;
+  has_meta_uid     = other.has_meta_uid;
+  has_meta_gid     = other.has_meta_gid;
+  hit_count        = other.hit_count;
+  cache_date       = other.cache_date;
+  if(other.extmeta){
+    extmeta = new stat_cache_meta_t(*(other.extmeta));
+  }
+}
+
+void stat_cache_entry::SetStat(const struct stat& st)
+{
+  size  = st.st_size;
+  mtime = st.st_mtime;
+  mode  = st.st_mode;
+  uid   = st.st_uid;
+  gid   = st.st_gid;
+}
+
+void stat_cache_entry::GetStat(struct stat* pst) const
+{
+  memset(pst, 0, sizeof(struct stat));
+  pst->st_nlink = 1; // see fuse FAQ
+  pst->st_mode  = mode;
+  pst->st_size  = size;
+  pst->st_mtime = mtime;
+  pst->st_uid   = uid;
+  pst->st_gid   = gid;
+  if(S_ISREG(mode)){
+    pst->st_blocks = get_blocks(size);
+  }
+}
+
+//
+// Set headers into fields. A header which is not restored as same
+// string from the field is kept in extmeta.
+//
+void stat_cache_entry::SetMeta(headers_t& meta)
+{
+  for(headers_t::iterator iter = meta.begin(); iter != meta.end(); ++iter){
+    string tag   = (*iter).first;
+    string value = (*iter).second;
+
+    //copy only some keys
+    if(tag == "Content-Type"){
+      if(0 != (ctype = intern_ctype(value))){
+        continue;
+      }
+    }else if(tag == "Content-Length"){
+      if(value == str(size)){
+        has_length = true;
+        continue;
+      }
+    }else if(tag == "ETag"){
+      if(parse_etag(value, etag)){
+        has_etag = true;
+        continue;
+      }
+    }else if(tag == "Last-Modified"){
+      if(parse_lastmodified(value, lastmodified) && value == format_lastmodified(lastmodified)){
+        has_lastmodified = true;
+        continue;
+      }
+    }else if(tag.substr(0, 5) == "x-amz"){
+      if(tag == "x-amz-meta-mtime"){
+        meta_mtime = get_mtime(value.c_str());
+        if(value == str(meta_mtime)){
+          has_meta_mtime = true;
+          continue;
+        }
+      }else if(tag == "x-amz-meta-mode"){
+        meta_mode = get_mode(value.c_str());
+        if(value == str(meta_mode)){
+          has_meta_mode = true;
+          continue;
+        }
+      }else if(tag == "x-amz-meta-uid"){
+        meta_uid = get_uid(value.c_str());
+        if(value == str(meta_uid)){
+          has_meta_uid = true;
+          continue;
+        }
+      }else if(tag == "x-amz-meta-gid"){
+        meta_gid = get_gid(value.c_str());
+        if(value == str(meta_gid)){
+          has_meta_gid = true;
+          continue;
+        }
+      }
+    }else{
+      // Check for upper case
+      transform(tag.begin(), tag.end(), tag.begin(), static_cast<int (*)(int)>(std::tolower));
+      if(tag.substr(0, 5) != "x-amz"){
+        continue;
+      }
+    }
+    if(!extmeta){
+      extmeta = new stat_cache_meta_t;
+    }
+    stat_cache_meta_item item;
+    if(NULL == (item.pkey = intern_key(tag))){
+      item.rawkey = tag;
+    }
+    item.value = value;
+    extmeta->push_back(item);
+  }
+}
+
+void stat_cache_entry::GetMeta(headers_t& meta) const
+{
+  meta.clear();
+  if(0 != ctype){
+    meta["Content-Type"] = get_ctype(ctype);
+  }
+  if(has_length){
+    meta["Content-Length"] = str(size);
+  }
+  if(has_etag){
+    meta["ETag"] = GetETag();
+  }
+  if(has_lastmodified){
+    meta["Last-Modified"] = format_lastmodified(lastmodified);
+  }
+  if(has_meta_mtime){
+    meta["x-amz-meta-mtime"] = str(meta_mtime);
+  }
+  if(has_meta_mode){
+    meta["x-amz-meta-mode"] = str(meta_mode);
+  }
+  if(has_meta_uid){
+    meta["x-amz-meta-uid"] = str(meta_uid);
+  }
+  if(has_meta_gid){
+    meta["x-amz-meta-gid"] = str(meta_gid);
+  }
+  if(extmeta){
+    for(stat_cache_meta_t::const_iterator iter = extmeta->begin(); iter != extmeta->end(); ++iter){
+      meta[(*iter).GetKey()] = (*iter).value;
+    }
+  }
+}
+
+string stat_cache_entry::GetETag(void) const
+{
+  static const char hexAlphabet[] = "0123456789abcdef";
+
+  if(has_etag){
+    string strETag = "\"";
+    for(int cnt = 0; cnt < 16; cnt++){
+      strETag += hexAlphabet[etag[cnt] >> 4];
+      strETag += hexAlphabet[etag[cnt] & 0xf];
+    }
+    strETag += "\"";
+    return strETag;
+  }
+  if(extmeta){
+    for(stat_cache_meta_t::const_iterator iter = extmeta->begin(); iter != extmeta->end(); ++iter){
+      if((*iter).GetKey() == "ETag"){
+        return (*iter).value;
+      }
+    }
+  }
+  return string("");
+}
 
 //-------------------------------------------------------------------
 // Constructor/Destructor
@@ -47,20 +411,33 @@ pthread_mutex_t StatCache::stat_cache_lock;
 StatCache::StatCache()
 {
   if(this == StatCache::getStatCacheData()){
-    pthread_mutex_init(&(StatCache::stat_cache_lock), NULL);
+    for(int cnt = 0; cnt < STAT_CACHE_SHARD_COUNT; cnt++){
+      pthread_mutex_init(&(shards[cnt].lock), NULL);
+    }
+    pthread_mutex_init(&(StatCache::revalidate_lock), NULL);
+    pthread_cond_init(&(StatCache::revalidate_cond), NULL);
   }else{
     assert(false);
   }
   CacheSize       = 1000;
+  ShardCacheSize  = (CacheSize + STAT_CACHE_SHARD_COUNT - 1) / STAT_CACHE_SHARD_COUNT;
   ExpireTime      = 0;
   IsExpireTime    = false;
+  StaleTime       = 0;
   IsCacheNoObject = false;
+  is_revalidating    = false;
+  is_stop_revalidate = false;
+  revalidate_func    = NULL;
 }
 
 StatCache::~StatCache()
 {
   if(this == StatCache::getStatCacheData()){
-    pthread_mutex_destroy(&(StatCache::stat_cache_lock));
+    for(int cnt = 0; cnt < STAT_CACHE_SHARD_COUNT; cnt++){
+      pthread_mutex_destroy(&(shards[cnt].lock));
+    }
+    pthread_mutex_destroy(&(StatCache::revalidate_lock));
+    pthread_cond_destroy(&(StatCache::revalidate_cond));
   }else{
     assert(false);
   }
@@ -78,6 +455,8 @@ unsigned long StatCache::SetCacheSize(unsigned long size)
 {
   unsigned long old = CacheSize;
   CacheSize = size;
+  // each shard has same number of entries at most.
+  ShardCacheSize = (size + STAT_CACHE_SHARD_COUNT - 1) / STAT_CACHE_SHARD_COUNT;
   return old;
 }
 
@@ -102,6 +481,13 @@ time_t StatCache::UnsetExpireTime(void)
   return old;
 }
 
+time_t StatCache::SetStaleTime(time_t stale)
+{
+  time_t old = StaleTime;
+  StaleTime  = stale;
+  return old;
+}
+
 bool StatCache::SetCacheNoObject(bool flag)
 {
   bool old = IsCacheNoObject;
@@ -109,27 +495,84 @@ bool StatCache::SetCacheNoObject(bool flag)
   return old;
 }
 
+// FNV-1a hash of path
+unsigned int StatCache::GetShardIndex(const string& key)
+{
+  unsigned int hash = 2166136261U;
+  for(string::const_iterator iter = key.begin(); iter != key.end(); ++iter){
+    hash ^= static_cast<unsigned char>(*iter);
+    hash *= 16777619U;
+  }
+  return hash % STAT_CACHE_SHARD_COUNT;
+}
+
+void StatCache::LinkEntry(stat_cache_shard& shard, stat_cache_entry* ent)
+{
+  ent->lru_prev = NULL;
+  ent->lru_next = shard.lru_head;
+  if(shard.lru_head){
+    shard.lru_head->lru_prev = ent;
+  }
+  shard.lru_head = ent;
+  if(!shard.lru_tail){
+    shard.lru_tail = ent;
+  }
+}
+
+void StatCache::UnlinkEntry(stat_cache_shard& shard, stat_cache_entry* ent)
+{
+  if(ent->lru_prev){
+    ent->lru_prev->lru_next = ent->lru_next;
+  }else{
+    shard.lru_head = ent->lru_next;
+  }
+  if(ent->lru_next){
+    ent->lru_next->lru_prev = ent->lru_prev;
+  }else{
+    shard.lru_tail = ent->lru_prev;
+  }
+  ent->lru_prev = NULL;
+  ent->lru_next = NULL;
+}
+
 bool StatCache::GetStat(string& key, struct stat* pst, headers_t* meta, bool overcheck, const char* petag, bool* pisforce)
 {
   bool is_delete_cache = false;
   string strpath = key;
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-
-  stat_cache_t::iterator iter = stat_cache.end();
+  stat_cache_t::iterator iter;
+  stat_cache_shard* pshard = NULL;
   if(overcheck && '/' != strpath[strpath.length() - 1]){
     strpath += "/";
-    iter = stat_cache.find(strpath.c_str());
+    pshard = &GetShard(strpath);
+    pthread_mutex_lock(&(pshard->lock));
+    if(pshard->cache.end() == (iter = pshard->cache.find(strpath))){
+      pthread_mutex_unlock(&(pshard->lock));
+      pshard = NULL;
+    }
   }
-  if(iter == stat_cache.end()){
+  if(!pshard){
     strpath = key;
-    iter = stat_cache.find(strpath.c_str());
+    pshard  = &GetShard(strpath);
+    pthread_mutex_lock(&(pshard->lock));
+    iter = pshard->cache.find(strpath);
   }
 
-  if(iter != stat_cache.end()) {
-    if(!IsExpireTime|| ((*iter).second.cache_date + ExpireTime) >= time(NULL)){
+  bool is_revalidate = false;
+  if(iter != pshard->cache.end()) {
+    time_t now = time(NULL);
+    if(!IsExpireTime || ((*iter).second.cache_date + ExpireTime) >= now){
+      is_revalidate = IsRefreshAhead((*iter).second, now);
+    }else if(IsServeStale((*iter).second, now)){
+      FGPRINT("    stat cache is stale [path=%s]\n", strpath.c_str());
+      is_revalidate = true;
+    }else{
+      // timeout
+      is_delete_cache = true;
+    }
+    if(!is_delete_cache){
       if((*iter).second.noobjcache){
-        pthread_mutex_unlock(&StatCache::stat_cache_lock);
+        pthread_mutex_unlock(&(pshard->lock));
         if(!IsCacheNoObject){
           // need to delete this cache.
           DelStat(strpath);
@@ -138,9 +581,17 @@ bool StatCache::GetStat(string& key, struct stat* pst, headers_t* meta, bool ove
         }
         return false;
       }
+      if(meta != NULL && (*iter).second.islisted){
+        // the cache made from listing does not have x-amz-meta-*,
+        // then caller needs to get headers.
+        FGPRINT("    stat cache not hit by listed entry[path=%s]\n", strpath.c_str());
+        pthread_mutex_unlock(&(pshard->lock));
+        return false;
+      }
       // hit without checking etag
+      string stretag;
       if(petag){
-        string stretag = (*iter).second.meta["ETag"];
+        stretag = (*iter).second.GetETag();
         if('\0' != petag[0] && 0 != strcmp(petag, stretag.c_str())){
           is_delete_cache = true;
         }
@@ -149,33 +600,36 @@ bool StatCache::GetStat(string& key, struct stat* pst, headers_t* meta, bool ove
         // not hit by different ETag
         FGPRINT("    stat cache not hit by ETag[path=%s][time=%ld][hit count=%lu][ETag(%s)!=(%s)]\n",
           strpath.c_str(), (*iter).second.cache_date, (*iter).second.hit_count,
-          petag ? petag : "null", (*iter).second.meta["ETag"].c_str());
+          petag ? petag : "null", stretag.c_str());
       }else{
         // hit 
         FGPRINT("    stat cache hit [path=%s] [time=%ld] [hit count=%lu]\n",
           strpath.c_str(), (*iter).second.cache_date, (*iter).second.hit_count);
 
         if(pst!= NULL){
-          *pst= (*iter).second.stbuf;
+          (*iter).second.GetStat(pst);
         }
         if(meta != NULL){
-          meta->clear();
-          (*meta) = (*iter).second.meta;
+          (*iter).second.GetMeta(*meta);
         }
         if(pisforce != NULL){
           (*pisforce) = (*iter).second.isforce;
         }
         (*iter).second.hit_count++;
-        pthread_mutex_unlock(&StatCache::stat_cache_lock);
+
+        // move to head of LRU
+        UnlinkEntry(*pshard, &((*iter).second));
+        LinkEntry(*pshard, &((*iter).second));
+        pthread_mutex_unlock(&(pshard->lock));
+
+        if(is_revalidate){
+          QueueRevalidate(strpath);
+        }
         return true;
       }
-
-    }else{
-      // timeout
-      is_delete_cache = true;
     }
   }
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  pthread_mutex_unlock(&(pshard->lock));
 
   if(is_delete_cache){
     DelStat(strpath);
@@ -192,23 +646,29 @@ bool StatCache::IsNoObjectCache(string& key, bool overcheck)
     return false;
   }
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-
-  stat_cache_t::iterator iter = stat_cache.end();
+  stat_cache_t::iterator iter;
+  stat_cache_shard* pshard = NULL;
   if(overcheck && '/' != strpath[strpath.length() - 1]){
     strpath += "/";
-    iter = stat_cache.find(strpath.c_str());
+    pshard = &GetShard(strpath);
+    pthread_mutex_lock(&(pshard->lock));
+    if(pshard->cache.end() == (iter = pshard->cache.find(strpath))){
+      pthread_mutex_unlock(&(pshard->lock));
+      pshard = NULL;
+    }
   }
-  if(iter == stat_cache.end()){
+  if(!pshard){
     strpath = key;
-    iter = stat_cache.find(strpath.c_str());
+    pshard  = &GetShard(strpath);
+    pthread_mutex_lock(&(pshard->lock));
+    iter = pshard->cache.find(strpath);
   }
 
-  if(iter != stat_cache.end()) {
+  if(iter != pshard->cache.end()) {
     if(!IsExpireTime|| ((*iter).second.cache_date + ExpireTime) >= time(NULL)){
       if((*iter).second.noobjcache){
         // noobjcache = true means no object.
-        pthread_mutex_unlock(&StatCache::stat_cache_lock);
+        pthread_mutex_unlock(&(pshard->lock));
         return true;
       }
     }else{
@@ -216,7 +676,7 @@ bool StatCache::IsNoObjectCache(string& key, bool overcheck)
       is_delete_cache = true;
     }
   }
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  pthread_mutex_unlock(&(pshard->lock));
 
   if(is_delete_cache){
     DelStat(strpath);
@@ -224,6 +684,26 @@ bool StatCache::IsNoObjectCache(string& key, bool overcheck)
   return false;
 }
 
+//
+// Returns the entry for key which is linked to head of LRU.
+// If the shard is full, the least recently used entry is removed.
+//
+stat_cache_entry* StatCache::MakeEntry(stat_cache_shard& shard, string& key)
+{
+  stat_cache_t::iterator iter = shard.cache.find(key);
+  if(iter != shard.cache.end()){
+    UnlinkEntry(shard, &((*iter).second));
+  }else{
+    if(shard.cache.size() >= ShardCacheSize){
+      TruncateCache(shard);
+    }
+    iter = shard.cache.insert(stat_cache_t::value_type(key, stat_cache_entry())).first;
+    (*iter).second.pkey = &((*iter).first);
+  }
+  LinkEntry(shard, &((*iter).second));
+  return &((*iter).second);
+}
+
 bool StatCache::AddStat(std::string& key, headers_t& meta, bool forcedir)
 {
   if(CacheSize< 1){
@@ -231,47 +711,20 @@ bool StatCache::AddStat(std::string& key, headers_t& meta, bool forcedir)
   }
   FGPRINT("    add_stat_cache_entry[path=%s]\n", key.c_str());
 
-  if(stat_cache.size() > CacheSize){
-    if(!TruncateCache()){
-      return false;
-    }
-  }
-
   struct stat st;
   if(!convert_header_to_stat(key.c_str(), meta, &st, forcedir)){
     return false;
   }
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-  stat_cache[key].stbuf      = st;
-  stat_cache[key].hit_count  = 0;
-  stat_cache[key].cache_date = time(NULL); // Set time.
-  stat_cache[key].isforce    = forcedir;
-  stat_cache[key].noobjcache = false;
-
-  //copy only some keys
-  for (headers_t::iterator iter = meta.begin(); iter != meta.end(); ++iter) {
-    string tag   = (*iter).first;
-    string value = (*iter).second;
-    if(tag == "Content-Type"){
-      stat_cache[key].meta[tag] = value;
-    }else if(tag == "Content-Length"){
-      stat_cache[key].meta[tag] = value;
-    }else if(tag == "ETag"){
-      stat_cache[key].meta[tag] = value;
-    }else if(tag == "Last-Modified"){
-      stat_cache[key].meta[tag] = value;
-    }else if(tag.substr(0, 5) == "x-amz"){
-      stat_cache[key].meta[tag] = value;
-    }else{
-      // Check for upper case
-      transform(tag.begin(), tag.end(), tag.begin(), static_cast<int (*)(int)>(std::tolower));
-      if(tag.substr(0, 5) == "x-amz"){
-        stat_cache[key].meta[tag] = value;
-      }
-    }
-  }
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  stat_cache_shard& shard = GetShard(key);
+  pthread_mutex_lock(&(shard.lock));
+  stat_cache_entry* ent = MakeEntry(shard, key);
+  ent->Clear();
+  ent->SetStat(st);
+  ent->SetMeta(meta);
+  ent->cache_date = time(NULL); // Set time.
+  ent->isforce    = forcedir;
+  pthread_mutex_unlock(&(shard.lock));
 
   return true;
 }
@@ -286,51 +739,117 @@ bool StatCache::AddNoObjectCache(string& key)
   }
   FGPRINT("    add_stat_cache_entry - noobjcache[path=%s]\n", key.c_str());
 
-  if(stat_cache.size() > CacheSize){
-    if(!TruncateCache()){
-      return false;
-    }
+  stat_cache_shard& shard = GetShard(key);
+  pthread_mutex_lock(&(shard.lock));
+  stat_cache_entry* ent = MakeEntry(shard, key);
+  ent->Clear();
+  ent->cache_date = time(NULL); // Set time.
+  ent->noobjcache = true;
+  pthread_mutex_unlock(&(shard.lock));
+
+  return true;
+}
+
+//
+// Add the stat which is made from listing(size, mtime and etag).
+// The stat is same as the object which does not have x-amz-meta-*.
+// GetStat() with meta does not hit this entry, then the caller gets
+// headers and replaces it by AddStat().
+//
+bool StatCache::AddListStat(string& key, off_t size, time_t mtime, const char* etag)
+{
+  if(CacheSize< 1){
+    return true;
   }
+  FGPRINT("    add_stat_cache_entry - listed[path=%s]\n", key.c_str());
 
+  headers_t meta;
+  meta["Content-Length"] = str(size);
+  if(etag){
+    meta["ETag"] = etag;
+  }
   struct stat st;
-  memset(&st, 0, sizeof(struct stat));
+  if(!convert_header_to_stat(key.c_str(), meta, &st, false)){
+    return false;
+  }
+  st.st_mtime  = mtime;
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-  stat_cache[key].stbuf      = st;
-  stat_cache[key].hit_count  = 0;
-  stat_cache[key].cache_date = time(NULL); // Set time.
-  stat_cache[key].isforce    = false;
-  stat_cache[key].noobjcache = true;
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  stat_cache_shard& shard = GetShard(key);
+  pthread_mutex_lock(&(shard.lock));
+  stat_cache_entry* ent = MakeEntry(shard, key);
+  ent->Clear();
+  ent->SetStat(st);
+  ent->SetMeta(meta);
+  ent->cache_date = time(NULL); // Set time.
+  ent->islisted   = true;
+  pthread_mutex_unlock(&(shard.lock));
 
   return true;
 }
 
-bool StatCache::TruncateCache(void)
+bool StatCache::TruncateCache(stat_cache_shard& shard)
 {
-  string path_to_delete;
-  unsigned int lowest_hit_count = 0;
-
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-  stat_cache_t::iterator iter;
-  for(iter = stat_cache.begin(); iter != stat_cache.end(); iter++) {
-    if(!lowest_hit_count) {
-      lowest_hit_count = (*iter).second.hit_count;
-      path_to_delete   = (*iter).first;
-    }
-    if(lowest_hit_count > (*iter).second.hit_count){
-      lowest_hit_count = (*iter).second.hit_count;
-      path_to_delete   = (*iter).first;
-    }
+  if(!shard.lru_tail){
+    return true;
   }
-  stat_cache.erase(path_to_delete);
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  // remove least recently used entry
+  stat_cache_entry* ent = shard.lru_tail;
+  string path_to_delete = *(ent->pkey);
+  UnlinkEntry(shard, ent);
+  shard.cache.erase(path_to_delete);
 
   FGPRINT("    truncate_stat_cache_entry[path=%s]\n", path_to_delete.c_str());
 
   return true;
 }
 
+bool StatCache::TouchStat(string& key)
+{
+  stat_cache_shard& shard = GetShard(key);
+  pthread_mutex_lock(&(shard.lock));
+  stat_cache_t::iterator iter = shard.cache.find(key);
+  if(iter == shard.cache.end()){
+    pthread_mutex_unlock(&(shard.lock));
+    return false;
+  }
+  (*iter).second.cache_date = time(NULL);
+  pthread_mutex_unlock(&(shard.lock));
+
+  FGPRINT("    touch_stat_cache_entry[path=%s]\n", key.c_str());
+
+  return true;
+}
+
+//
+// Returns headers of the entry which is expired, and which is not served
+// as stale. The entry is left in cache, then the caller can revalidate it
+// by ETag and update it by TouchStat() or AddStat().
+//
+bool StatCache::GetExpiredStat(string& key, headers_t& meta)
+{
+  if(!IsExpireTime){
+    return false;
+  }
+  stat_cache_shard& shard = GetShard(key);
+  pthread_mutex_lock(&(shard.lock));
+  stat_cache_t::iterator iter = shard.cache.find(key);
+  if(iter == shard.cache.end()){
+    pthread_mutex_unlock(&(shard.lock));
+    return false;
+  }
+  time_t now = time(NULL);
+  const stat_cache_entry& ent = (*iter).second;
+  if((ent.cache_date + ExpireTime) >= now || IsServeStale(ent, now) ||
+     ent.noobjcache || ent.islisted || ent.isforce || !S_ISREG(ent.mode)){
+    pthread_mutex_unlock(&(shard.lock));
+    return false;
+  }
+  ent.GetMeta(meta);
+  pthread_mutex_unlock(&(shard.lock));
+
+  return true;
+}
+
 bool StatCache::DelStat(const char* key)
 {
   if(!key){
@@ -338,13 +857,17 @@ bool StatCache::DelStat(const char* key)
   }
   FGPRINT("    delete_stat_cache_entry[path=%s]\n", key);
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-  stat_cache_t::iterator iter = stat_cache.find(key);
-  if(iter != stat_cache.end()){
-    stat_cache.erase(iter);
+  string strpath = key;
+  stat_cache_shard* pshard = &GetShard(strpath);
+  pthread_mutex_lock(&(pshard->lock));
+  stat_cache_t::iterator iter = pshard->cache.find(strpath);
+  if(iter != pshard->cache.end()){
+    UnlinkEntry(*pshard, &((*iter).second));
+    pshard->cache.erase(iter);
   }
+  pthread_mutex_unlock(&(pshard->lock));
+
   if(0 < strlen(key) && 0 != strcmp(key, "/")){
-    string strpath = key;
     if('/' == strpath[strpath.length() - 1]){
       // If there is "path" cache, delete it.
       strpath = strpath.substr(0, strpath.length() - 1);
@@ -352,13 +875,144 @@ bool StatCache::DelStat(const char* key)
       // If there is "path/" cache, delete it.
       strpath += "/";
     }
-    iter = stat_cache.find(strpath.c_str());
-    if(iter != stat_cache.end()){
-      stat_cache.erase(iter);
+    pshard = &GetShard(strpath);
+    pthread_mutex_lock(&(pshard->lock));
+    iter = pshard->cache.find(strpath);
+    if(iter != pshard->cache.end()){
+      UnlinkEntry(*pshard, &((*iter).second));
+      pshard->cache.erase(iter);
+    }
+    pthread_mutex_unlock(&(pshard->lock));
+  }
+
+  return true;
+}
+
+//
+// The expired entry can be returned until StaleTime passes, but the entry
+// which means no object or no directory object is not revalidated.
+//
+bool StatCache::IsServeStale(const stat_cache_entry& ent, time_t now) const
+{
+  if(0 == StaleTime || !is_revalidating || ent.noobjcache || ent.isforce){
+    return false;
+  }
+  return ((ent.cache_date + ExpireTime + StaleTime) >= now);
+}
+
+bool StatCache::IsRefreshAhead(const stat_cache_entry& ent, time_t now) const
+{
+  if(0 == StaleTime || !is_revalidating || !IsExpireTime || ent.noobjcache || ent.isforce){
+    return false;
+  }
+  if(ent.hit_count < STAT_CACHE_REFRESH_HITS){
+    return false;
+  }
+  time_t window = ExpireTime / STAT_CACHE_REFRESH_RATE;
+  if(window < 1){
+    window = 1;
+  }
+  return ((ent.cache_date + ExpireTime - now) < window);
+}
+
+bool StatCache::QueueRevalidate(const string& key)
+{
+  pthread_mutex_lock(&StatCache::revalidate_lock);
+  if(!is_revalidating || revalidate_map.end() != revalidate_map.find(key) || STAT_CACHE_MAX_REVALIDATE <= revalidate_map.size()){
+    pthread_mutex_unlock(&StatCache::revalidate_lock);
+    return false;
+  }
+  revalidate_map[key] = true;
+  revalidate_keys.push_back(key);
+  pthread_cond_signal(&StatCache::revalidate_cond);
+  pthread_mutex_unlock(&StatCache::revalidate_lock);
+
+  FGPRINT("    queue revalidating stat cache[path=%s]\n", key.c_str());
+
+  return true;
+}
+
+void* StatCache::RevalidateWorker(void* arg)
+{
+  StatCache* pcache = reinterpret_cast<StatCache*>(arg);
+
+  while(true){
+    pthread_mutex_lock(&StatCache::revalidate_lock);
+    while(!pcache->is_stop_revalidate && pcache->revalidate_keys.empty()){
+      pthread_cond_wait(&StatCache::revalidate_cond, &StatCache::revalidate_lock);
+    }
+    if(pcache->is_stop_revalidate){
+      pthread_mutex_unlock(&StatCache::revalidate_lock);
+      break;
+    }
+    string key = pcache->revalidate_keys.front();
+    pcache->revalidate_keys.pop_front();
+    pthread_mutex_unlock(&StatCache::revalidate_lock);
+
+    // ETag of current entry
+    bool   is_found = false;
+    string etag;
+    stat_cache_shard& shard = pcache->GetShard(key);
+    pthread_mutex_lock(&(shard.lock));
+    stat_cache_t::iterator iter = shard.cache.find(key);
+    if(iter != shard.cache.end()){
+      is_found = true;
+      etag     = (*iter).second.GetETag();
+    }
+    pthread_mutex_unlock(&(shard.lock));
+
+    if(is_found){
+      (*(pcache->revalidate_func))(key, etag);
+    }
+
+    pthread_mutex_lock(&StatCache::revalidate_lock);
+    pcache->revalidate_map.erase(key);
+    pthread_mutex_unlock(&StatCache::revalidate_lock);
+  }
+  return NULL;
+}
+
+bool StatCache::StartRevalidator(stat_cache_revalidate_t func)
+{
+  if(is_revalidating || !func){
+    return false;
+  }
+  revalidate_func    = func;
+  is_stop_revalidate = false;
+  for(int cnt = 0; cnt < STAT_CACHE_REVALIDATORS; cnt++){
+    if(0 != pthread_create(&revalidate_threads[cnt], NULL, StatCache::RevalidateWorker, this)){
+      SYSLOGERR("could not create revalidation thread for stat cache.");
+      // stop threads which are already created.
+      pthread_mutex_lock(&StatCache::revalidate_lock);
+      is_stop_revalidate = true;
+      pthread_cond_broadcast(&StatCache::revalidate_cond);
+      pthread_mutex_unlock(&StatCache::revalidate_lock);
+      for(int cnt2 = 0; cnt2 < cnt; cnt2++){
+        pthread_join(revalidate_threads[cnt2], NULL);
+      }
+      return false;
     }
   }
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  is_revalidating = true;
+  return true;
+}
 
+bool StatCache::StopRevalidator(void)
+{
+  if(!is_revalidating){
+    return true;
+  }
+  pthread_mutex_lock(&StatCache::revalidate_lock);
+  is_revalidating    = false;
+  is_stop_revalidate = true;
+  revalidate_keys.clear();
+  revalidate_map.clear();
+  pthread_cond_broadcast(&StatCache::revalidate_cond);
+  pthread_mutex_unlock(&StatCache::revalidate_lock);
+
+  for(int cnt = 0; cnt < STAT_CACHE_REVALIDATORS; cnt++){
+    pthread_join(revalidate_threads[cnt], NULL);
+  }
   return true;
 }
 
@@ -377,17 +1031,17 @@ bool convert_header_to_stat(const char* path, headers_t& meta, struct stat* pst,
   // mode
   pst->st_mode = get_mode(meta, path, true, forcedir);
 
-  // blocks
-  if(S_ISREG(pst->st_mode)){
-    pst->st_blocks = get_blocks(pst->st_size);
-  }
-
   // mtime
   pst->st_mtime = get_mtime(meta);
 
   // size
   pst->st_size = get_size(meta);
 
+  // blocks
+  if(S_ISREG(pst->st_mode)){
+    pst->st_blocks = get_blocks(pst->st_size);
+  }
+
   // uid/gid
   pst->st_uid = get_uid(meta);
   pst->st_gid = get_gid(meta);
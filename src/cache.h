@@ -6,22 +6,118 @@
 //
 // Struct
 //
+// The headers are kept as parsed fields, and only the headers which are
+// not able to be restored from the fields(ex. x-amz-meta-* except mode,
+// uid, gid and mtime) are kept in extmeta with interned key. The key is
+// kept in rawkey only when the interned table is full.
+//
+struct stat_cache_meta_item {
+  const std::string* pkey;     // interned key(NULL means rawkey is used)
+  std::string        rawkey;
+  std::string        value;
+
+  stat_cache_meta_item() : pkey(NULL) {}
+
+  const std::string& GetKey(void) const {
+    return (pkey ? *pkey : rawkey);
+  }
+};
+typedef std::vector<stat_cache_meta_item> stat_cache_meta_t;
+
 struct stat_cache_entry {
-  struct stat   stbuf;
+  off_t         size;
+  time_t        mtime;
+  mode_t        mode;
+  uid_t         uid;
+  gid_t         gid;
+  time_t        lastmodified;  // Last-Modified
+  time_t        meta_mtime;    // x-amz-meta-mtime
+  mode_t        meta_mode;     // x-amz-meta-mode
+  uid_t         meta_uid;      // x-amz-meta-uid
+  gid_t         meta_gid;      // x-amz-meta-gid
+  unsigned char etag[16];      // ETag of MD5(without '"')
+  unsigned short ctype;        // id of Content-Type(0 is not set)
+  bool          isforce    : 1;
+  bool          noobjcache : 1;  // Flag: cache is no object for no listing.
+  bool          islisted   : 1;  // Flag: cache is made from listing, it does not have x-amz-meta-*.
+  bool          has_length : 1;  // Flags: the header is set into the field.
+  bool          has_etag   : 1;
+  bool          has_lastmodified : 1;
+  bool          has_meta_mtime   : 1;
+  bool          has_meta_mode    : 1;
+  bool          has_meta_uid     : 1;
+  bool          has_meta_gid     : 1;
   unsigned long hit_count;
   time_t        cache_date;
-  headers_t     meta;
-  bool          isforce;
-  bool          noobjcache;  // Flag: cache is no object for no listing.
+  stat_cache_meta_t* extmeta;  // other headers
+  const std::string* pkey;     // key in stat_cache_t(for removing by LRU)
+  stat_cache_entry*  lru_prev;
+  stat_cache_entry*  lru_next;
 
-  stat_cache_entry() : hit_count(0), cache_date(0), isforce(false), noobjcache(false) {
-    memset(&stbuf, 0, sizeof(struct stat));
-    meta.clear();
+  stat_cache_entry() : extmeta(NULL), pkey(NULL), lru_prev(NULL), lru_next(NULL) {
+    Clear();
+  }
+  stat_cache_entry(const stat_cache_entry& other) : extmeta(NULL), pkey(NULL), lru_prev(NULL), lru_next(NULL) {
+    Clear();
+    Copy(other);
   }
+  ~stat_cache_entry() {
+    Clear();
+  }
+  stat_cache_entry& operator=(const stat_cache_entry& other) {
+    if(this != &other){
+      Clear();
+      Copy(other);
+    }
+    return *this;
+  }
+
+  void Clear(void);
+  void Copy(const stat_cache_entry& other);
+  void SetStat(const struct stat& st);
+  void GetStat(struct stat* pst) const;
+  void SetMeta(headers_t& meta);
+  void GetMeta(headers_t& meta) const;
+  std::string GetETag(void) const;
 };
 
 typedef std::map<std::string, struct stat_cache_entry> stat_cache_t; // key=path
 
+//
+// The stat cache is divided into shards by the hash of path, and each
+// shard has own lock and LRU list. Then threads which access different
+// paths are not blocked by each other, and the least recently used
+// entry in the shard is removed without scanning all entries.
+//
+#define STAT_CACHE_SHARD_COUNT  64
+
+struct stat_cache_shard {
+  pthread_mutex_t   lock;
+  stat_cache_t      cache;
+  stat_cache_entry* lru_head;   // most recently used
+  stat_cache_entry* lru_tail;   // least recently used
+
+  stat_cache_shard() : lru_head(NULL), lru_tail(NULL) {}
+};
+
+//
+// Stale-while-revalidate and refresh-ahead
+//
+// If StaleTime is set, the expired entry is returned until StaleTime
+// passes after expiring, and the entry is revalidated in background.
+// The entry which is hit STAT_CACHE_REFRESH_HITS times or more is
+// revalidated before expiring.
+//
+#define STAT_CACHE_REFRESH_HITS   10
+#define STAT_CACHE_REFRESH_RATE   10    // refresh in last 1/10 of expire time
+#define STAT_CACHE_REVALIDATORS   4     // count of revalidation threads
+#define STAT_CACHE_MAX_REVALIDATE 10000 // max count of queued keys
+
+// revalidate the entry(key) which has etag, called in revalidation thread.
+typedef void (*stat_cache_revalidate_t)(std::string& key, std::string& etag);
+
+typedef std::list<std::string> stat_cache_keys_t;
+
 //
 // Class
 //
@@ -29,17 +125,42 @@ class StatCache
 {
   private:
     static StatCache singleton;
-    static pthread_mutex_t stat_cache_lock;
-    stat_cache_t stat_cache;
+    stat_cache_shard shards[STAT_CACHE_SHARD_COUNT];
     bool IsExpireTime;
     time_t ExpireTime;
+    time_t StaleTime;
     unsigned long CacheSize;
+    unsigned long ShardCacheSize;   // max entries in one shard
     bool IsCacheNoObject;
 
+    // revalidation thread
+    static pthread_mutex_t revalidate_lock;
+    static pthread_cond_t  revalidate_cond;
+    pthread_t              revalidate_threads[STAT_CACHE_REVALIDATORS];
+    bool                   is_revalidating;
+    bool                   is_stop_revalidate;
+    stat_cache_revalidate_t revalidate_func;
+    stat_cache_keys_t      revalidate_keys;     // queued keys
+    std::map<std::string, bool> revalidate_map; // queued keys for checking
+
   private:
     bool GetStat(std::string& key, struct stat* pst, headers_t* meta, bool overcheck, const char* petag, bool* pisforce);
-    // Truncate stat cache
-    bool TruncateCache(void);
+    static unsigned int GetShardIndex(const std::string& key);
+    stat_cache_shard& GetShard(const std::string& key) {
+      return shards[GetShardIndex(key)];
+    }
+    // LRU list in shard(need to lock shard)
+    static void LinkEntry(stat_cache_shard& shard, stat_cache_entry* ent);
+    static void UnlinkEntry(stat_cache_shard& shard, stat_cache_entry* ent);
+    // Get entry for adding, and truncate shard(need to lock shard)
+    stat_cache_entry* MakeEntry(stat_cache_shard& shard, std::string& key);
+    // Truncate stat cache(need to lock shard)
+    bool TruncateCache(stat_cache_shard& shard);
+    // Revalidation
+    static void* RevalidateWorker(void* arg);
+    bool QueueRevalidate(const std::string& key);
+    bool IsServeStale(const stat_cache_entry& ent, time_t now) const;
+    bool IsRefreshAhead(const stat_cache_entry& ent, time_t now) const;
 
   public:
     StatCache();
@@ -56,6 +177,10 @@ class StatCache
     time_t GetExpireTime(void) const;
     time_t SetExpireTime(time_t expire);
     time_t UnsetExpireTime(void);
+    time_t GetStaleTime(void) const {
+      return StaleTime;
+    }
+    time_t SetStaleTime(time_t stale);
     bool SetCacheNoObject(bool flag);
     bool EnableCacheNoObject(void) {
       return SetCacheNoObject(true);
@@ -90,12 +215,22 @@ class StatCache
 
     // Add stat cache
     bool AddStat(std::string& key, headers_t& meta, bool forcedir = false);
+    bool AddListStat(std::string& key, off_t size, time_t mtime, const char* etag);
+
+    // Update cache date of the entry which is not modified
+    bool TouchStat(std::string& key);
+    // Get headers of the expired entry of file for revalidating it
+    bool GetExpiredStat(std::string& key, headers_t& meta);
 
     // Delete stat cache
     bool DelStat(const char* key);
     bool DelStat(std::string& key) {
       return DelStat(key.c_str());
     }
+
+    // Revalidation thread
+    bool StartRevalidator(stat_cache_revalidate_t func);
+    bool StopRevalidator(void);
 };
 
 //
@@ -43,12 +43,24 @@
 
 #include "common.h"
 #include "curl.h"
+#include "curl_engine.h"
 #include "string_util.h"
 #include "s3fs.h"
 #include "s3fs_util.h"
 
 using namespace std;
 
+//-------------------------------------------------------------------
+// Define
+//-------------------------------------------------------------------
+#define MAX_CURL_HANDLE_POOL   32   // max count of idle handles in pool
+
+#define SHARE_MUTEX_DNS        0
+#define SHARE_MUTEX_SSL_SESSION 1
+#define SHARE_MUTEX_CONNECT    2
+#define SHARE_MUTEX_SHARE      3
+#define SHARE_MUTEX_MAX        4
+
 //-------------------------------------------------------------------
 // Typedef
 //-------------------------------------------------------------------
@@ -64,14 +76,20 @@ typedef pair<double, double> progress_t;
 // Static valiables
 //-------------------------------------------------------------------
 static pthread_mutex_t curl_handles_lock;
-static pthread_mutex_t curl_share_lock;
+static pthread_mutex_t curl_share_lock[SHARE_MUTEX_MAX];
 static CURLSH* hCurlShare = NULL;
+static list<CURL*> curl_handle_pool;      // idle handles for reusing
 static const EVP_MD* evp_md = EVP_sha1();
 static map<CURL*, time_t> curl_times;
 static map<CURL*, progress_t> curl_progress;
 static string curl_ca_bundle;
 static mimes_t mimeTypes;
 
+//-------------------------------------------------------------------
+// Static functions : prototype
+//-------------------------------------------------------------------
+static int send_head_request(const char *path, headers_t &meta, const char* etag, bool* pnotmodified);
+
 //-------------------------------------------------------------------
 // Class BodyData
 //-------------------------------------------------------------------
@@ -152,6 +170,13 @@ int init_curl_handles_mutex(void)
 
 int destroy_curl_handles_mutex(void)
 {
+  // cleanup idle handles in pool
+  pthread_mutex_lock(&curl_handles_lock);
+  for(list<CURL*>::iterator iter = curl_handle_pool.begin(); iter != curl_handle_pool.end(); iter = curl_handle_pool.erase(iter)){
+    curl_easy_cleanup(*iter);
+  }
+  pthread_mutex_unlock(&curl_handles_lock);
+
   return pthread_mutex_destroy(&curl_handles_lock);
 }
 
@@ -170,26 +195,64 @@ void cleanup_curl_global_all(void)
   curl_global_cleanup();
 }
 
+static pthread_mutex_t* get_curl_share_mutex(curl_lock_data nLockData)
+{
+  switch(nLockData){
+    case CURL_LOCK_DATA_DNS:
+      return &curl_share_lock[SHARE_MUTEX_DNS];
+    case CURL_LOCK_DATA_SSL_SESSION:
+      return &curl_share_lock[SHARE_MUTEX_SSL_SESSION];
+#ifdef CURL_LOCK_DATA_CONNECT
+    case CURL_LOCK_DATA_CONNECT:
+      return &curl_share_lock[SHARE_MUTEX_CONNECT];
+#endif
+    case CURL_LOCK_DATA_SHARE:
+      return &curl_share_lock[SHARE_MUTEX_SHARE];
+    default:
+      break;
+  }
+  return NULL;
+}
+
 static void lock_curl_share(CURL* handle, curl_lock_data nLockData, curl_lock_access laccess, void* useptr)
 {
-  if(hCurlShare && CURL_LOCK_DATA_DNS == nLockData){
-    pthread_mutex_lock(&curl_share_lock);
+  pthread_mutex_t* pmutex;
+  if(hCurlShare && NULL != (pmutex = get_curl_share_mutex(nLockData))){
+    pthread_mutex_lock(pmutex);
   }
 }
 
-static void unlock_curl_share(CURL* handle, curl_lock_data nLockData, curl_lock_access laccess, void* useptr)
+static void unlock_curl_share(CURL* handle, curl_lock_data nLockData, void* useptr)
 {
-  if(hCurlShare && CURL_LOCK_DATA_DNS == nLockData){
-    pthread_mutex_unlock(&curl_share_lock);
+  pthread_mutex_t* pmutex;
+  if(hCurlShare && NULL != (pmutex = get_curl_share_mutex(nLockData))){
+    pthread_mutex_unlock(pmutex);
   }
 }
 
-int init_curl_share(bool isCache)
+static bool set_curl_share_data(curl_lock_data nLockData)
 {
   CURLSHcode nSHCode;
 
-  if(!isCache){
-    return 0;
+  if(CURLSHE_OK != (nSHCode = curl_share_setopt(hCurlShare, CURLSHOPT_SHARE, nLockData))){
+    FGPRINT(" init_curl_share: curl_share_setopt(%d) returns %d(%s)\n", nLockData, nSHCode, curl_share_strerror(nSHCode));
+    SYSLOGERR("init_curl_share: curl_share_setopt(%d) returns %d(%s)\n", nLockData, nSHCode, curl_share_strerror(nSHCode));
+    return false;
+  }
+  return true;
+}
+
+//
+// Initialize the share handle which is set to all curl handles.
+// The dns cache and ssl session ids are shared when those flags are
+// true, and the connection cache is shared if libcurl supports it.
+//
+int init_curl_share(bool isDnsCache, bool isSslSessionCache)
+{
+  CURLSHcode nSHCode;
+
+  for(int cnt = 0; cnt < SHARE_MUTEX_MAX; cnt++){
+    pthread_mutex_init(&curl_share_lock[cnt], NULL);
   }
   if(NULL == (hCurlShare = curl_share_init())){
     FGPRINT(" init_curl_share: curl_share_init failed\n");
@@ -206,25 +269,31 @@ int init_curl_share(bool isCache)
     SYSLOGERR("init_curl_share: %d(%s)\n", nSHCode, curl_share_strerror(nSHCode));
     return nSHCode;
   }
-  if(CURLSHE_OK != (nSHCode = curl_share_setopt(hCurlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS))){
-    FGPRINT(" init_curl_share: curl_share_setopt returns %d(%s)\n", nSHCode, curl_share_strerror(nSHCode));
-    SYSLOGERR("init_curl_share: %d(%s)\n", nSHCode, curl_share_strerror(nSHCode));
-    return nSHCode;
+  if(isDnsCache && !set_curl_share_data(CURL_LOCK_DATA_DNS)){
+    return -1;
+  }
+  if(isSslSessionCache && !set_curl_share_data(CURL_LOCK_DATA_SSL_SESSION)){
+    return -1;
   }
-  return pthread_mutex_init(&curl_share_lock, NULL);
+#ifdef CURL_LOCK_DATA_CONNECT
+  // sharing connection cache is supported from libcurl 7.57.0,
+  // it may fail with old library, but it is not error.
+  set_curl_share_data(CURL_LOCK_DATA_CONNECT);
+#endif
+  return 0;
 }
 
-int destroy_curl_share(bool isCache)
+int destroy_curl_share(void)
 {
   int result = 0;
 
-  if(!isCache){
-    return result;
-  }
-  result = pthread_mutex_destroy(&curl_share_lock);
-  if(hCurlShare && CURLSHE_OK != curl_share_cleanup(hCurlShare) && 0 == result){
+  if(hCurlShare && CURLSHE_OK != curl_share_cleanup(hCurlShare)){
     result = -1;
   }
+  hCurlShare = NULL;
+  for(int cnt = 0; cnt < SHARE_MUTEX_MAX; cnt++){
+    pthread_mutex_destroy(&curl_share_lock[cnt]);
+  }
   return result;
 }
 
@@ -262,8 +331,15 @@ CURL *create_curl_handle(void)
   CURL *curl_handle;
 
   pthread_mutex_lock(&curl_handles_lock);
-  curl_handle = curl_easy_init();
+  // reuse idle handle in pool, it keeps alive connections.
+  if(0 < curl_handle_pool.size()){
+    curl_handle = curl_handle_pool.front();
+    curl_handle_pool.pop_front();
+  }else{
+    curl_handle = curl_easy_init();
+  }
   curl_easy_reset(curl_handle);
+  my_set_curl_share(curl_handle);
   curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
   curl_easy_setopt(curl_handle, CURLOPT_FOLLOWLOCATION, true);
   curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, connect_timeout);
@@ -286,13 +362,21 @@ CURL *create_curl_handle(void)
   return curl_handle;
 }
 
+//
+// Release the handle which is made by create_curl_handle().
+// The handle is returned to pool for reusing, if pool is not full.
+//
 void destroy_curl_handle(CURL *curl_handle)
 {
   if(curl_handle != NULL) {
     pthread_mutex_lock(&curl_handles_lock);
     curl_times.erase(curl_handle);
     curl_progress.erase(curl_handle);
-    curl_easy_cleanup(curl_handle);
+    if(curl_handle_pool.size() < MAX_CURL_HANDLE_POOL){
+      curl_handle_pool.push_back(curl_handle);
+    }else{
+      curl_easy_cleanup(curl_handle);
+    }
     pthread_mutex_unlock(&curl_handles_lock);
   }
 
@@ -330,11 +414,46 @@ int curl_delete(const char *path)
   return result;
 }
 
-int curl_get_headers(const char *path, headers_t &meta)
+//
+// If etag is specified, the request is conditional(If-None-Match).
+// Then *pnotmodified is set true when the object is not modified, and
+// meta is not changed.
+// The HEAD requests for same path at the same time are sent only once,
+// and the result is shared.
+//
+int curl_get_headers(const char *path, headers_t &meta, const char* etag, bool* pnotmodified)
+{
+  if(etag && '\0' != etag[0]){
+    return send_head_request(path, meta, etag, pnotmodified);
+  }
+  if(pnotmodified){
+    *pnotmodified = false;
+  }
+
+  int result;
+  inflight_entry* pentry;
+  string key = string("HEAD:") + path;
+  if(InflightRequests::getInflightRequests()->Join(key, &pentry)){
+    result = send_head_request(path, meta, NULL, NULL);
+    InflightRequests::getInflightRequests()->Done(pentry, result, &meta);
+  }else{
+    if(0 == (result = InflightRequests::getInflightRequests()->Wait(pentry))){
+      meta = *(static_cast<headers_t*>(pentry->data));
+    }
+    InflightRequests::getInflightRequests()->Leave(pentry);
+  }
+  return result;
+}
+
+static int send_head_request(const char *path, headers_t &meta, const char* etag, bool* pnotmodified)
 {
   int result;
   CURL *curl;
 
+  if(pnotmodified){
+    *pnotmodified = false;
+  }
+
   FGPRINT("  curl_headers[path=%s]\n", path);
 
   string resource(urlEncode(service_path + bucket + path));
@@ -351,6 +470,9 @@ int curl_get_headers(const char *path, headers_t &meta)
   string date = get_date();
   headers.append("Date: " + date);
   headers.append("Content-Type: ");
+  if(etag && '\0' != etag[0]){
+    headers.append(string("If-None-Match: ") + etag);
+  }
   if(public_bucket.substr(0,1) != "1") {
     headers.append("Authorization: AWS " + AWSAccessKeyId + ":" +
       calc_signature("HEAD", "", "", date, headers.get(), resource));
@@ -359,13 +481,34 @@ int curl_get_headers(const char *path, headers_t &meta)
   string my_url = prepare_url(url.c_str());
   curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
   result = my_curl_easy_perform(curl);
+
+  long responseCode = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
   destroy_curl_handle(curl);
 
   if(result != 0){
      return result;
   }
+  if(304 == responseCode){
+    FGPRINT("  curl_headers: not modified[path=%s]\n", path);
+    if(pnotmodified){
+      *pnotmodified = true;
+    }
+    return 0;
+  }
 
   // file exists in s3
+  filter_object_headers(responseHeaders, meta);
+
+  return 0;
+}
+
+//
+// Copy the headers of object(Content-*, ETag, Last-Modified and x-amz-*)
+// from the response headers of HEAD or GET.
+//
+void filter_object_headers(headers_t& responseHeaders, headers_t& meta)
+{
   // fixme: clean this up.
   meta.clear();
   for (headers_t::iterator iter = responseHeaders.begin(); iter != responseHeaders.end(); ++iter) {
@@ -389,8 +532,6 @@ int curl_get_headers(const char *path, headers_t &meta)
       }
     }
   }
-
-  return 0;
 }
 
 CURL *create_head_handle(head_data *request_data)
@@ -431,205 +572,190 @@ CURL *create_head_handle(head_data *request_data)
 }
 
 /**
- * @return fuse return code
+ * Check the result of the request, this is the retry policy of
+ * all requests.
+ *
+ * @return fuse return code, or CURL_RESULT_RETRY(the request should be
+ *         retried after *pwait seconds) or CURL_RESULT_RETRY_NOCOUNT
+ *         (retried immediately, and it is not counted as retrying).
  */
-int my_curl_easy_perform(CURL* curl, BodyData* body, BodyData* head, FILE* f)
+int check_curl_result(CURL* curl, CURLcode curlCode, BodyData* body, int* pwait)
 {
-  char url[256];
   time_t now;
-  char* ptr_url = url;
-  curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL , &ptr_url);
+  long responseCode;
 
-  SYSLOGDBG("connecting to URL %s", ptr_url);
+  *pwait = 0;
 
-  // curl_easy_setopt(curl, CURLOPT_VERBOSE, true);
-  if(ssl_verify_hostname.substr(0,1) == "0"){
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
-  }
-  if(curl_ca_bundle.size() != 0){
-    curl_easy_setopt(curl, CURLOPT_CAINFO, curl_ca_bundle.c_str());
-  }
-  // set dns cache
-  my_set_curl_share(curl);
+  switch (curlCode) {
+    case CURLE_OK:
+      // Need to look at the HTTP response code
 
-  long responseCode;
+      if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode) != 0) {
+        SYSLOGERR("curl_easy_getinfo failed while trying to retrieve HTTP response code");
+        return -EIO;
+      }
+      SYSLOGDBG("HTTP response code %ld", responseCode);
 
-  // 1 attempt + retries...
-  int t = retries + 1;
-  while (t-- > 0) {
-    if (f) {
-      rewind(f);
-    }
-    CURLcode curlCode = curl_easy_perform(curl);
+      if (responseCode < 400) {
+        return 0;
+      }
+      if (responseCode >= 500) {
+        SYSLOGERR("###HTTP response=%ld", responseCode);
+        *pwait = 4;
+        return CURL_RESULT_RETRY;
+      }
 
-    switch (curlCode) {
-      case CURLE_OK:
-        // Need to look at the HTTP response code
+      // Service response codes which are >= 400 && < 500
+      switch(responseCode) {
+        case 400:
+          SYSLOGDBGERR("HTTP response code 400 was returned");
+          SYSLOGDBGERR("Body Text: %s", (body ? body->str() : ""));
+          SYSLOGDBG("Now returning EIO");
+          return -EIO;
+
+        case 403:
+          SYSLOGDBGERR("HTTP response code 403 was returned");
+          SYSLOGDBGERR("Body Text: %s", (body ? body->str() : ""));
+          return -EPERM;
 
-        if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode) != 0) {
-          SYSLOGERR("curl_easy_getinfo failed while trying to retrieve HTTP response code");
+        case 404:
+          SYSLOGDBG("HTTP response code 404 was returned");
+          SYSLOGDBG("Body Text: %s", (body ? body->str() : ""));
+          SYSLOGDBG("Now returning ENOENT");
+          return -ENOENT;
+
+        default:
+          SYSLOGERR("###response=%ld", responseCode);
+          SYSLOGDBG("Body Text: %s", (body ? body->str() : ""));
+          FGPRINT("responseCode %ld\n", responseCode);
+          FGPRINT("Body Text: %s", (body ? body->str() : ""));
           return -EIO;
-        }
-        SYSLOGDBG("HTTP response code %ld", responseCode);
+      }
+      break;
 
-        if (responseCode < 400) {
-          return 0;
-        }
-        if (responseCode >= 500) {
-          SYSLOGERR("###HTTP response=%ld", responseCode);
-          sleep(4);
-          break; 
-        }
+    case CURLE_WRITE_ERROR:
+      SYSLOGERR("### CURLE_WRITE_ERROR");
+      *pwait = 2;
+      break; 
+
+    case CURLE_OPERATION_TIMEDOUT:
+      SYSLOGERR("### CURLE_OPERATION_TIMEDOUT");
+      *pwait = 2;
+      break; 
+
+    case CURLE_COULDNT_RESOLVE_HOST:
+      SYSLOGERR("### CURLE_COULDNT_RESOLVE_HOST");
+      *pwait = 2;
+      break; 
+
+    case CURLE_COULDNT_CONNECT:
+      SYSLOGERR("### CURLE_COULDNT_CONNECT");
+      *pwait = 4;
+      break; 
+
+    case CURLE_GOT_NOTHING:
+      SYSLOGERR("### CURLE_GOT_NOTHING");
+      *pwait = 4;
+      break; 
+
+    case CURLE_ABORTED_BY_CALLBACK:
+      SYSLOGERR("### CURLE_ABORTED_BY_CALLBACK");
+      *pwait = 4;
+      now = time(0);
+      pthread_mutex_lock(&curl_handles_lock);
+      curl_times[curl] = now;
+      pthread_mutex_unlock(&curl_handles_lock);
+      break; 
+
+    case CURLE_PARTIAL_FILE:
+      SYSLOGERR("### CURLE_PARTIAL_FILE");
+      *pwait = 4;
+      break; 
+
+    case CURLE_SEND_ERROR:
+      SYSLOGERR("### CURLE_SEND_ERROR");
+      *pwait = 2;
+      break;
 
-        // Service response codes which are >= 400 && < 500
-        switch(responseCode) {
-          case 400:
-            SYSLOGDBGERR("HTTP response code 400 was returned");
-            SYSLOGDBGERR("Body Text: %s", (body ? body->str() : ""));
-            SYSLOGDBG("Now returning EIO");
-            return -EIO;
-
-          case 403:
-            SYSLOGDBGERR("HTTP response code 403 was returned");
-            SYSLOGDBGERR("Body Text: %s", (body ? body->str() : ""));
-            return -EPERM;
-
-          case 404:
-            SYSLOGDBG("HTTP response code 404 was returned");
-            SYSLOGDBG("Body Text: %s", (body ? body->str() : ""));
-            SYSLOGDBG("Now returning ENOENT");
-            return -ENOENT;
-
-          default:
-            SYSLOGERR("###response=%ld", responseCode);
-            SYSLOGDBG("Body Text: %s", (body ? body->str() : ""));
-            FGPRINT("responseCode %ld\n", responseCode);
-            FGPRINT("Body Text: %s", (body ? body->str() : ""));
-            return -EIO;
-        }
-        break;
-
-      case CURLE_WRITE_ERROR:
-        SYSLOGERR("### CURLE_WRITE_ERROR");
-        sleep(2);
-        break; 
-
-      case CURLE_OPERATION_TIMEDOUT:
-        SYSLOGERR("### CURLE_OPERATION_TIMEDOUT");
-        sleep(2);
-        break; 
-
-      case CURLE_COULDNT_RESOLVE_HOST:
-        SYSLOGERR("### CURLE_COULDNT_RESOLVE_HOST");
-        sleep(2);
-        break; 
-
-      case CURLE_COULDNT_CONNECT:
-        SYSLOGERR("### CURLE_COULDNT_CONNECT");
-        sleep(4);
-        break; 
-
-      case CURLE_GOT_NOTHING:
-        SYSLOGERR("### CURLE_GOT_NOTHING");
-        sleep(4);
-        break; 
-
-      case CURLE_ABORTED_BY_CALLBACK:
-        SYSLOGERR("### CURLE_ABORTED_BY_CALLBACK");
-        sleep(4);
-        now = time(0);
-        curl_times[curl] = now;
-        break; 
-
-      case CURLE_PARTIAL_FILE:
-        SYSLOGERR("### CURLE_PARTIAL_FILE");
-        sleep(4);
-        break; 
-
-      case CURLE_SEND_ERROR:
-        SYSLOGERR("### CURLE_SEND_ERROR");
-        sleep(2);
-        break;
-
-      case CURLE_RECV_ERROR:
-        SYSLOGERR("### CURLE_RECV_ERROR");
-        sleep(2);
-        break;
-
-      case CURLE_SSL_CACERT:
-        // try to locate cert, if successful, then set the
-        // option and continue
-        if (curl_ca_bundle.size() == 0) {
-           locate_bundle();
-           if (curl_ca_bundle.size() != 0) {
-              t++;
-              curl_easy_setopt(curl, CURLOPT_CAINFO, curl_ca_bundle.c_str());
-              // break for switch-case, and continue loop.
-              break;
-           }
-        }
-        SYSLOGERR("curlCode: %i  msg: %s", curlCode, curl_easy_strerror(curlCode));
-        fprintf (stderr, "%s: curlCode: %i -- %s\n", 
+    case CURLE_RECV_ERROR:
+      SYSLOGERR("### CURLE_RECV_ERROR");
+      *pwait = 2;
+      break;
+
+    case CURLE_SSL_CACERT:
+      // try to locate cert, if successful, then set the
+      // option and continue
+      if (curl_ca_bundle.size() == 0) {
+         locate_bundle();
+         if (curl_ca_bundle.size() != 0) {
+            curl_easy_setopt(curl, CURLOPT_CAINFO, curl_ca_bundle.c_str());
+            return CURL_RESULT_RETRY_NOCOUNT;
+         }
+      }
+      SYSLOGERR("curlCode: %i  msg: %s", curlCode, curl_easy_strerror(curlCode));
+      fprintf (stderr, "%s: curlCode: %i -- %s\n", 
+         program_name.c_str(),
+         curlCode,
+         curl_easy_strerror(curlCode));
+      exit(EXIT_FAILURE);
+      break;
+
+#ifdef CURLE_PEER_FAILED_VERIFICATION
+    case CURLE_PEER_FAILED_VERIFICATION:
+      first_pos = bucket.find_first_of(".");
+      if (first_pos != string::npos) {
+        fprintf (stderr, "%s: curl returned a CURL_PEER_FAILED_VERIFICATION error\n", program_name.c_str());
+        fprintf (stderr, "%s: security issue found: buckets with periods in their name are incompatible with https\n", program_name.c_str());
+        fprintf (stderr, "%s: This check can be over-ridden by using the -o ssl_verify_hostname=0\n", program_name.c_str());
+        fprintf (stderr, "%s: The certificate will still be checked but the hostname will not be verified.\n", program_name.c_str());
+        fprintf (stderr, "%s: A more secure method would be to use a bucket name without periods.\n", program_name.c_str());
+      } else {
+        fprintf (stderr, "%s: my_curl_easy_perform: curlCode: %i -- %s\n", 
            program_name.c_str(),
            curlCode,
            curl_easy_strerror(curlCode));
-        exit(EXIT_FAILURE);
-        break;
-
-#ifdef CURLE_PEER_FAILED_VERIFICATION
-      case CURLE_PEER_FAILED_VERIFICATION:
-        first_pos = bucket.find_first_of(".");
-        if (first_pos != string::npos) {
-          fprintf (stderr, "%s: curl returned a CURL_PEER_FAILED_VERIFICATION error\n", program_name.c_str());
-          fprintf (stderr, "%s: security issue found: buckets with periods in their name are incompatible with https\n", program_name.c_str());
-          fprintf (stderr, "%s: This check can be over-ridden by using the -o ssl_verify_hostname=0\n", program_name.c_str());
-          fprintf (stderr, "%s: The certificate will still be checked but the hostname will not be verified.\n", program_name.c_str());
-          fprintf (stderr, "%s: A more secure method would be to use a bucket name without periods.\n", program_name.c_str());
-        } else {
-          fprintf (stderr, "%s: my_curl_easy_perform: curlCode: %i -- %s\n", 
-             program_name.c_str(),
-             curlCode,
-             curl_easy_strerror(curlCode));
-        }
-        exit(EXIT_FAILURE);
-        break;
+      }
+      exit(EXIT_FAILURE);
+      break;
 #endif
 
-      // This should be invalid since curl option HTTP FAILONERROR is now off
-      case CURLE_HTTP_RETURNED_ERROR:
-        SYSLOGERR("### CURLE_HTTP_RETURNED_ERROR");
+    // This should be invalid since curl option HTTP FAILONERROR is now off
+    case CURLE_HTTP_RETURNED_ERROR:
+      SYSLOGERR("### CURLE_HTTP_RETURNED_ERROR");
 
-        if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode) != 0) {
-          return -EIO;
-        }
-        SYSLOGERR("###response=%ld", responseCode);
+      if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode) != 0) {
+        return -EIO;
+      }
+      SYSLOGERR("###response=%ld", responseCode);
 
-        // Let's try to retrieve the 
+      // Let's try to retrieve the 
 
-        if (responseCode == 404) {
-          return -ENOENT;
-        }
-        if (responseCode < 500) {
-          return -EIO;
-        }
-        break;
+      if (responseCode == 404) {
+        return -ENOENT;
+      }
+      if (responseCode < 500) {
+        return -EIO;
+      }
+      break;
 
-      // Unknown CURL return code
-      default:
-        SYSLOGERR("###curlCode: %i  msg: %s", curlCode, curl_easy_strerror(curlCode));
-        exit(EXIT_FAILURE);
-        break;
-    }
-    if(body){
-      body->Clear();
-    }
-    if(head){
-      head->Clear();
-    }
-    SYSLOGERR("###retrying...");
+    // Unknown CURL return code
+    default:
+      SYSLOGERR("###curlCode: %i  msg: %s", curlCode, curl_easy_strerror(curlCode));
+      exit(EXIT_FAILURE);
+      break;
   }
-  SYSLOGERR("###giving up");
-  return -EIO;
+  return CURL_RESULT_RETRY;
+}
+
+/**
+ * Send the request by CurlEngine, and wait for it.
+ * @return fuse return code
+ */
+int my_curl_easy_perform(CURL* curl, BodyData* body, BodyData* head, FILE* f)
+{
+  CurlRequest request(curl, body, head, f);
+
+  return CurlEngine::getCurlEngine()->Perform(&request);
 }
 
 // libcurl callback
@@ -645,6 +771,135 @@ size_t WriteMemoryCallback(void *ptr, size_t blockSize, size_t numBlocks, void *
   return (blockSize * numBlocks);
 }
 
+// libcurl callback for ranged GET
+//
+// The data of partial content(206) is written into fd at the position of
+// the range. If the server does not support Range header(the response is
+// 200), the body is whole object, then it is written only when the range
+// covers whole object. Other bodies(ex. error response) are dropped, and
+// is_dropped is set.
+size_t WriteFdRangeCallback(void *ptr, size_t blockSize, size_t numBlocks, void *data)
+{
+  fd_range_data* range = (fd_range_data*)data;
+  size_t         total = blockSize * numBlocks;
+  size_t         written;
+  ssize_t        bytes;
+
+  if(!range || -1 == range->fd){
+    return 0;
+  }
+  if(-1 == range->offset && !range->is_dropped){
+    long   responseCode = 0;
+    double length       = -1;
+    if(range->curl){
+      curl_easy_getinfo(range->curl, CURLINFO_RESPONSE_CODE, &responseCode);
+      curl_easy_getinfo(range->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+    }
+    if(206 == responseCode){
+      range->offset = range->start;
+    }else if(200 == responseCode && 0 == range->start && static_cast<off_t>(length) == range->size){
+      range->offset = 0;
+    }else{
+      range->is_dropped = true;
+    }
+  }
+  if(range->is_dropped){
+    return total;
+  }
+  for(written = 0; written < total; written += bytes){
+    if(-1 == (bytes = pwrite(range->fd, &((char*)ptr)[written], (total - written), range->offset + written))){
+      SYSLOGERR("WriteFdRangeCallback: pwrite error(%d)", errno);
+      FGPRINT("WriteFdRangeCallback(): pwrite returned error(%d).\n", errno);
+      return 0;
+    }
+  }
+  range->offset += total;
+  return total;
+}
+
+// libcurl header callback for ranged GET
+//
+// The status line is received at the top of each response, then the write
+// offset is reset for retrying.
+size_t HeaderFdRangeCallback(void *data, size_t blockSize, size_t numBlocks, void *userPtr)
+{
+  fd_range_data* range = (fd_range_data*)userPtr;
+
+  if(range && 5 <= (blockSize * numBlocks) && 0 == strncmp((const char*)data, "HTTP/", 5)){
+    range->offset     = -1;
+    range->is_dropped = false;
+  }
+  return blockSize * numBlocks;
+}
+
+// libcurl read callback for uploading the part of fd
+//
+// The data is read by pread at the position in the part, so that some
+// parts of same fd can be uploaded at the same time. The md5 of the part
+// is calculated with reading.
+size_t ReadFdPartCallback(void *ptr, size_t size, size_t nmemb, void *userp)
+{
+  fd_part_data* part = (fd_part_data*)userp;
+  size_t        total = size * nmemb;
+  ssize_t       bytes;
+
+  if(!part || -1 == part->fd){
+    return CURL_READFUNC_ABORT;
+  }
+  if(part->size <= part->pos || 0 == total){
+    return 0;
+  }
+  if(static_cast<off_t>(total) > (part->size - part->pos)){
+    total = static_cast<size_t>(part->size - part->pos);
+  }
+  if(0 >= (bytes = pread(part->fd, ptr, total, part->start + part->pos))){
+    SYSLOGERR("ReadFdPartCallback: pread error(%d)", errno);
+    FGPRINT("ReadFdPartCallback(): pread returned error(%d).\n", errno);
+    return CURL_READFUNC_ABORT;
+  }
+  MD5_Update(&(part->md5ctx), ptr, bytes);
+  part->pos += bytes;
+
+  return bytes;
+}
+
+// libcurl seek callback for uploading the part of fd
+//
+// Only rewinding to top of the part is allowed, because md5 can not be
+// calculated from the middle of the part.
+int SeekFdPartCallback(void *userp, curl_off_t offset, int origin)
+{
+  fd_part_data* part = (fd_part_data*)userp;
+
+  if(!part || SEEK_SET != origin || 0 != offset){
+    return CURL_SEEKFUNC_CANTSEEK;
+  }
+  part->Reset();
+  return CURL_SEEKFUNC_OK;
+}
+
+// Returns md5 hex string of the part which is read by ReadFdPartCallback.
+// If all of the part is not read yet, returns empty string.
+string GetFdPartMD5(fd_part_data* part)
+{
+  unsigned char md5hex[MD5_DIGEST_LENGTH];
+  char md5[2 * MD5_DIGEST_LENGTH + 1];
+  char hexbuf[3];
+
+  if(!part || part->pos != part->size){
+    return string("");
+  }
+  MD5_Final(md5hex, &(part->md5ctx));
+  MD5_Init(&(part->md5ctx));
+
+  memset(md5, 0, 2 * MD5_DIGEST_LENGTH + 1);
+  for(int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+    snprintf(hexbuf, 3, "%02x", md5hex[i]);
+    strncat(md5, hexbuf, 2);
+  }
+  return string(md5);
+}
+
 // read_callback
 // http://curl.haxx.se/libcurl/c/post-callback.html
 size_t read_callback(void *ptr, size_t size, size_t nmemb, void *userp)
@@ -853,24 +1108,19 @@ void locate_bundle(void)
   return;
 }
 
-string GetContentMD5(int fd)
+// base64 string of md5 binary for Content-MD5 header
+static string base64_md5(const unsigned char* md5hex)
 {
   BIO*     b64;
   BIO*     bmem;
   BUF_MEM* bptr;
   string   Signature;
-  unsigned char* md5hex;
-
-  if(NULL == (md5hex = md5hexsum(fd))){
-    return string("");
-  }
 
   b64  = BIO_new(BIO_f_base64());
   bmem = BIO_new(BIO_s_mem());
   b64  = BIO_push(b64, bmem);
 
   BIO_write(b64, md5hex, MD5_DIGEST_LENGTH);
-  free(md5hex);
   if(1 != BIO_flush(b64)){
     BIO_free_all(b64);
     return string("");
@@ -885,6 +1135,28 @@ string GetContentMD5(int fd)
   return Signature;
 }
 
+string GetContentMD5(int fd)
+{
+  string         Signature;
+  unsigned char* md5hex;
+
+  if(NULL == (md5hex = md5hexsum(fd))){
+    return string("");
+  }
+  Signature = base64_md5(md5hex);
+  free(md5hex);
+
+  return Signature;
+}
+
+string GetContentMD5(const string& data)
+{
+  unsigned char md5hex[MD5_DIGEST_LENGTH];
+
+  MD5(reinterpret_cast<const unsigned char*>(data.data()), data.size(), md5hex);
+  return base64_md5(md5hex);
+}
+
 unsigned char* md5hexsum(int fd)
 {
   MD5_CTX c;
@@ -1,6 +1,9 @@
 #ifndef S3FS_CURL_H_
 #define S3FS_CURL_H_
 
+#define CURL_RESULT_RETRY          1   // the request should be retried
+#define CURL_RESULT_RETRY_NOCOUNT  2   // the request should be retried(not counted)
+
 // memory class for curl write memory callback 
 class BodyData
 {
@@ -38,6 +41,39 @@ struct WriteThis {
   int sizeleft;
 };
 
+// data for curl write callback which writes into fd at the offset
+// (for ranged GET)
+struct fd_range_data {
+  int   fd;
+  off_t start;     // requested range start
+  off_t size;      // requested range size
+  off_t offset;    // write offset of the next data
+  bool  is_dropped;// the response body is not written into fd
+  CURL* curl;
+
+  fd_range_data(int nfd = -1, off_t nstart = 0, CURL* ncurl = NULL)
+    : fd(nfd), start(nstart), size(0), offset(-1), is_dropped(false), curl(ncurl) {}
+};
+
+// data for curl read callback which reads the part of fd, and
+// calculates md5 of the data at the same time
+// (for multipart upload without temporary file)
+struct fd_part_data {
+  int     fd;
+  off_t   start;     // part start in fd
+  off_t   size;      // part size
+  off_t   pos;       // read bytes in the part
+  MD5_CTX md5ctx;
+
+  fd_part_data(int nfd = -1, off_t nstart = 0, off_t nsize = 0) : fd(nfd), start(nstart), size(nsize), pos(0) {
+    MD5_Init(&md5ctx);
+  }
+  void Reset(void) {
+    pos = 0;
+    MD5_Init(&md5ctx);
+  }
+};
+
 class auto_curl_slist {
  public:
   auto_curl_slist() : slist(0) { }
@@ -117,23 +153,31 @@ int init_curl_handles_mutex(void);
 int destroy_curl_handles_mutex(void);
 bool init_curl_global_all(void);
 void cleanup_curl_global_all(void);
-int init_curl_share(bool isCache);
-int destroy_curl_share(bool isCache);
+int init_curl_share(bool isDnsCache, bool isSslSessionCache);
+int destroy_curl_share(void);
 void my_set_curl_share(CURL* curl);
 size_t header_callback(void *data, size_t blockSize, size_t numBlocks, void *userPtr);
 CURL *create_curl_handle(void);
 int curl_delete(const char *path);
-int curl_get_headers(const char *path, headers_t &meta);
+int curl_get_headers(const char *path, headers_t &meta, const char* etag = NULL, bool* pnotmodified = NULL);
+void filter_object_headers(headers_t& responseHeaders, headers_t& meta);
 CURL *create_head_handle(struct head_data *request);
+int check_curl_result(CURL* curl, CURLcode curlCode, BodyData* body, int* pwait);
 int my_curl_easy_perform(CURL* curl, BodyData* body = NULL, BodyData* head = NULL, FILE* f = 0);
 size_t WriteMemoryCallback(void *ptr, size_t blockSize, size_t numBlocks, void *data);
 size_t read_callback(void *ptr, size_t size, size_t nmemb, void *userp);
+size_t WriteFdRangeCallback(void *ptr, size_t blockSize, size_t numBlocks, void *data);
+size_t HeaderFdRangeCallback(void *data, size_t blockSize, size_t numBlocks, void *userPtr);
+size_t ReadFdPartCallback(void *ptr, size_t size, size_t nmemb, void *userp);
+int SeekFdPartCallback(void *userp, curl_off_t offset, int origin);
+std::string GetFdPartMD5(fd_part_data* part);
 int my_curl_progress(
     void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
 std::string calc_signature(std::string method, std::string strMD5, std::string content_type, 
     std::string date, curl_slist* headers, std::string resource);
 void locate_bundle(void);
 std::string GetContentMD5(int fd);
+std::string GetContentMD5(const std::string& data);
 unsigned char* md5hexsum(int fd);
 std::string md5sum(int fd);
 bool InitMimeType(const char* file);
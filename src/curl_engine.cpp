@@ -0,0 +1,612 @@
+/*
+ * s3fs - FUSE-based file system backed by Amazon S3
+ *
+ * Copyright 2007-2008 Randy Rizun <rrizun@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <curl/curl.h>
+#include <openssl/md5.h>
+#include <string>
+#include <map>
+#include <list>
+#include <algorithm>
+
+#include "common.h"
+#include "s3fs.h"
+#include "curl.h"
+#include "curl_engine.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------
+// Define
+//-------------------------------------------------------------------
+#define ENGINE_MAX_EVENTS     64
+#define ENGINE_MAX_WAIT_MS    1000
+
+//-------------------------------------------------------------------
+// Class CurlRequest
+//-------------------------------------------------------------------
+// Reset the request data for retrying
+void CurlRequest::Reset(void)
+{
+  if(body){
+    body->Clear();
+  }
+  if(head){
+    head->Clear();
+  }
+  if(file){
+    rewind(file);
+  }
+  if(reset_func){
+    (*reset_func)(reset_data);
+  }
+}
+
+//-------------------------------------------------------------------
+// Static
+//-------------------------------------------------------------------
+CurlEngine CurlEngine::singleton;
+pthread_mutex_t CurlEngine::engine_lock;
+pthread_cond_t CurlEngine::engine_cond;
+
+//-------------------------------------------------------------------
+// Constructor/Destructor
+//-------------------------------------------------------------------
+CurlEngine::CurlEngine() : is_running(false), is_stop(false), multi(NULL), epoll_fd(-1),
+                           timer_time(-1), max_parallel(MAX_REQUESTS)
+{
+  if(this == CurlEngine::getCurlEngine()){
+    pthread_mutex_init(&(CurlEngine::engine_lock), NULL);
+    pthread_cond_init(&(CurlEngine::engine_cond), NULL);
+  }else{
+    assert(false);
+  }
+  wake_fd[0] = -1;
+  wake_fd[1] = -1;
+}
+
+CurlEngine::~CurlEngine()
+{
+  if(this == CurlEngine::getCurlEngine()){
+    Stop();
+    pthread_cond_destroy(&(CurlEngine::engine_cond));
+    pthread_mutex_destroy(&(CurlEngine::engine_lock));
+  }else{
+    assert(false);
+  }
+}
+
+//-------------------------------------------------------------------
+// Methods
+//-------------------------------------------------------------------
+long long CurlEngine::GetNowMs(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<long long>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+int CurlEngine::SetMaxParallel(int count)
+{
+  pthread_mutex_lock(&CurlEngine::engine_lock);
+  int old = max_parallel;
+  max_parallel = (0 < count ? count : 1);
+  pthread_mutex_unlock(&CurlEngine::engine_lock);
+  return old;
+}
+
+bool CurlEngine::Start(void)
+{
+  if(is_running){
+    return true;
+  }
+  if(NULL == (multi = curl_multi_init())){
+    SYSLOGERR("CurlEngine::Start: curl_multi_init failed.");
+    return false;
+  }
+  curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, CurlEngine::SocketCallback);
+  curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, CurlEngine::TimerCallback);
+  curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+
+  if(-1 == (epoll_fd = epoll_create(ENGINE_MAX_EVENTS))){
+    SYSLOGERR("CurlEngine::Start: epoll_create failed(%d).", errno);
+    curl_multi_cleanup(multi);
+    multi = NULL;
+    return false;
+  }
+
+  // pipe for waking up the thread
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(struct epoll_event));
+  if(-1 == pipe(wake_fd) ||
+     -1 == fcntl(wake_fd[0], F_SETFL, O_NONBLOCK) || -1 == fcntl(wake_fd[1], F_SETFL, O_NONBLOCK))
+  {
+    SYSLOGERR("CurlEngine::Start: could not make pipe(%d).", errno);
+    Stop();
+    return false;
+  }
+  ev.events  = EPOLLIN;
+  ev.data.fd = wake_fd[0];
+  if(-1 == epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd[0], &ev)){
+    SYSLOGERR("CurlEngine::Start: epoll_ctl failed(%d).", errno);
+    Stop();
+    return false;
+  }
+
+  is_stop    = false;
+  timer_time = -1;
+  if(0 != pthread_create(&thread, NULL, CurlEngine::Worker, this)){
+    SYSLOGERR("CurlEngine::Start: could not create thread.");
+    Stop();
+    return false;
+  }
+  is_running = true;
+
+  return true;
+}
+
+bool CurlEngine::Stop(void)
+{
+  if(is_running){
+    pthread_mutex_lock(&CurlEngine::engine_lock);
+    is_stop = true;
+    pthread_mutex_unlock(&CurlEngine::engine_lock);
+    Wake();
+    pthread_join(thread, NULL);
+    is_running = false;
+  }
+
+  // requests which are not done are failed.
+  curl_request_list_t requests;
+  pthread_mutex_lock(&CurlEngine::engine_lock);
+  requests.splice(requests.end(), pending);
+  requests.splice(requests.end(), retrying);
+  for(curl_request_map_t::iterator iter = active.begin(); iter != active.end(); iter++){
+    curl_multi_remove_handle(multi, iter->first);
+    requests.push_back(iter->second);
+  }
+  active.clear();
+  pthread_mutex_unlock(&CurlEngine::engine_lock);
+  for(curl_request_list_t::iterator iter = requests.begin(); iter != requests.end(); iter++){
+    DoneRequest(*iter, -EIO);
+  }
+
+  if(multi){
+    curl_multi_cleanup(multi);
+    multi = NULL;
+  }
+  if(-1 != epoll_fd){
+    close(epoll_fd);
+    epoll_fd = -1;
+  }
+  for(int cnt = 0; cnt < 2; cnt++){
+    if(-1 != wake_fd[cnt]){
+      close(wake_fd[cnt]);
+      wake_fd[cnt] = -1;
+    }
+  }
+  return true;
+}
+
+void CurlEngine::Wake(void)
+{
+  char ch = 0;
+  if(-1 != wake_fd[1] && -1 == write(wake_fd[1], &ch, 1) && EAGAIN != errno){
+    SYSLOGERR("CurlEngine::Wake: could not write pipe(%d).", errno);
+  }
+}
+
+bool CurlEngine::Submit(CurlRequest* request)
+{
+  if(!request || !request->curl){
+    return false;
+  }
+  request->is_done     = false;
+  request->result      = 0;
+  request->retry_count = 0;
+
+  if(!is_running){
+    // thread is not started yet, so send it here.
+    int result = PerformInline(request);
+    DoneRequest(request, result);
+    return true;
+  }
+
+  pthread_mutex_lock(&CurlEngine::engine_lock);
+  pending.push_back(request);
+  pthread_mutex_unlock(&CurlEngine::engine_lock);
+  Wake();
+
+  return true;
+}
+
+int CurlEngine::Wait(CurlRequest* request)
+{
+  int result;
+
+  pthread_mutex_lock(&CurlEngine::engine_lock);
+  while(!request->is_done){
+    pthread_cond_wait(&CurlEngine::engine_cond, &CurlEngine::engine_lock);
+  }
+  result = request->result;
+  pthread_mutex_unlock(&CurlEngine::engine_lock);
+
+  return result;
+}
+
+CurlRequest* CurlEngine::WaitAny(curl_request_list_t& requests)
+{
+  CurlRequest* request = NULL;
+
+  if(0 == requests.size()){
+    return NULL;
+  }
+  pthread_mutex_lock(&CurlEngine::engine_lock);
+  while(!request){
+    for(curl_request_list_t::iterator iter = requests.begin(); iter != requests.end(); iter++){
+      if((*iter)->is_done){
+        request = *iter;
+        requests.erase(iter);
+        break;
+      }
+    }
+    if(!request){
+      pthread_cond_wait(&CurlEngine::engine_cond, &CurlEngine::engine_lock);
+    }
+  }
+  pthread_mutex_unlock(&CurlEngine::engine_lock);
+
+  return request;
+}
+
+int CurlEngine::Perform(CurlRequest* request)
+{
+  if(!Submit(request)){
+    return -EIO;
+  }
+  return Wait(request);
+}
+
+void CurlEngine::DoneRequest(CurlRequest* request, int result)
+{
+  pthread_mutex_lock(&CurlEngine::engine_lock);
+  request->result  = result;
+  request->is_done = true;
+  pthread_cond_broadcast(&CurlEngine::engine_cond);
+  pthread_mutex_unlock(&CurlEngine::engine_lock);
+}
+
+//
+// Send the request in the caller thread.
+//
+int CurlEngine::PerformInline(CurlRequest* request)
+{
+  char* ptr_url = NULL;
+  curl_easy_getinfo(request->curl, CURLINFO_EFFECTIVE_URL , &ptr_url);
+  SYSLOGDBG("connecting to URL %s", ptr_url ? ptr_url : "");
+
+  // 1 attempt + retries...
+  int t = retries + 1;
+  while (t-- > 0) {
+    int wait   = 0;
+    int result = check_curl_result(request->curl, curl_easy_perform(request->curl), request->body, &wait);
+    if(CURL_RESULT_RETRY != result && CURL_RESULT_RETRY_NOCOUNT != result){
+      return result;
+    }
+    if(CURL_RESULT_RETRY_NOCOUNT == result){
+      t++;
+    }else if(0 < wait){
+      sleep(wait);
+    }
+    request->Reset();
+    SYSLOGERR("###retrying...");
+  }
+  SYSLOGERR("###giving up");
+  return -EIO;
+}
+
+//
+// Event loop thread
+//
+void* CurlEngine::Worker(void* arg)
+{
+  CurlEngine* pEngine = static_cast<CurlEngine*>(arg);
+  pEngine->Loop();
+  return NULL;
+}
+
+void CurlEngine::Loop(void)
+{
+  struct epoll_event events[ENGINE_MAX_EVENTS];
+  int still_running = 0;
+
+  while(true){
+    long long now;
+    long long wait_ms = ENGINE_MAX_WAIT_MS;
+
+    if(!AddPendingRequests()){
+      break;  // stop
+    }
+
+    // wait time is decided by curl timer and retrying requests
+    now = GetNowMs();
+    if(-1 != timer_time){
+      wait_ms = min(wait_ms, max(timer_time - now, 0LL));
+    }
+    pthread_mutex_lock(&CurlEngine::engine_lock);
+    for(curl_request_list_t::iterator iter = retrying.begin(); iter != retrying.end(); iter++){
+      wait_ms = min(wait_ms, max((*iter)->retry_time - now, 0LL));
+    }
+    pthread_mutex_unlock(&CurlEngine::engine_lock);
+
+    int count = epoll_wait(epoll_fd, events, ENGINE_MAX_EVENTS, static_cast<int>(wait_ms));
+    if(-1 == count && EINTR != errno){
+      SYSLOGERR("CurlEngine::Loop: epoll_wait failed(%d).", errno);
+      FGPRINT("  CurlEngine::Loop: epoll_wait failed(%d).\n", errno);
+    }
+    for(int cnt = 0; cnt < count; cnt++){
+      if(events[cnt].data.fd == wake_fd[0]){
+        char buf[64];
+        while(0 < read(wake_fd[0], buf, sizeof(buf)));
+        continue;
+      }
+      int action = 0;
+      if(events[cnt].events & EPOLLIN){
+        action |= CURL_CSELECT_IN;
+      }
+      if(events[cnt].events & EPOLLOUT){
+        action |= CURL_CSELECT_OUT;
+      }
+      if(events[cnt].events & (EPOLLERR | EPOLLHUP)){
+        action |= CURL_CSELECT_ERR;
+      }
+      curl_multi_socket_action(multi, events[cnt].data.fd, action, &still_running);
+    }
+    if(-1 != timer_time && timer_time <= GetNowMs()){
+      timer_time = -1;
+      curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &still_running);
+    }
+
+    ReadDoneRequests();
+  }
+}
+
+//
+// Add pending requests into curl_multi, and move retrying requests which
+// wait time is over into pending.
+// Returns false when the thread should stop.
+//
+bool CurlEngine::AddPendingRequests(void)
+{
+  curl_request_list_t failed;
+  long long now = GetNowMs();
+
+  pthread_mutex_lock(&CurlEngine::engine_lock);
+  if(is_stop){
+    pthread_mutex_unlock(&CurlEngine::engine_lock);
+    return false;
+  }
+  for(curl_request_list_t::iterator iter = retrying.begin(); iter != retrying.end(); ){
+    if((*iter)->retry_time <= now){
+      pending.push_back(*iter);
+      iter = retrying.erase(iter);
+    }else{
+      iter++;
+    }
+  }
+  while(0 < pending.size() && active.size() < static_cast<size_t>(max_parallel)){
+    CurlRequest* request = pending.front();
+    CURLMcode    code;
+    pending.pop_front();
+
+    if(CURLM_OK != (code = curl_multi_add_handle(multi, request->curl))){
+      SYSLOGERR("CurlEngine: curl_multi_add_handle code: %d msg: %s", code, curl_multi_strerror(code));
+      FGPRINT("  CurlEngine: curl_multi_add_handle code: %d msg: %s\n", code, curl_multi_strerror(code));
+      failed.push_back(request);
+      continue;
+    }
+    active[request->curl] = request;
+  }
+  pthread_mutex_unlock(&CurlEngine::engine_lock);
+
+  for(curl_request_list_t::iterator iter = failed.begin(); iter != failed.end(); iter++){
+    DoneRequest(*iter, -EIO);
+  }
+  return true;
+}
+
+//
+// Check finished requests, and retry it by the retry policy.
+//
+void CurlEngine::ReadDoneRequests(void)
+{
+  CURLMsg* msg;
+  int      remaining_messages;
+
+  while(NULL != (msg = curl_multi_info_read(multi, &remaining_messages))){
+    if(CURLMSG_DONE != msg->msg){
+      continue;
+    }
+    CURL*    curl     = msg->easy_handle;
+    CURLcode curlCode = msg->data.result;
+    CurlRequest* request;
+
+    pthread_mutex_lock(&CurlEngine::engine_lock);
+    curl_request_map_t::iterator iter = active.find(curl);
+    if(active.end() == iter){
+      pthread_mutex_unlock(&CurlEngine::engine_lock);
+      curl_multi_remove_handle(multi, curl);
+      continue;
+    }
+    request = iter->second;
+    active.erase(iter);
+    pthread_mutex_unlock(&CurlEngine::engine_lock);
+    curl_multi_remove_handle(multi, curl);
+
+    int wait   = 0;
+    int result = check_curl_result(curl, curlCode, request->body, &wait);
+    if(CURL_RESULT_RETRY != result && CURL_RESULT_RETRY_NOCOUNT != result){
+      DoneRequest(request, result);
+      continue;
+    }
+    if(CURL_RESULT_RETRY == result && retries < ++request->retry_count){
+      SYSLOGERR("###giving up");
+      DoneRequest(request, -EIO);
+      continue;
+    }
+    SYSLOGERR("###retrying...");
+    request->Reset();
+    request->retry_time = GetNowMs() + (CURL_RESULT_RETRY == result ? wait * 1000 : 0);
+
+    pthread_mutex_lock(&CurlEngine::engine_lock);
+    retrying.push_back(request);
+    pthread_mutex_unlock(&CurlEngine::engine_lock);
+  }
+}
+
+//
+// curl_multi callbacks
+//
+int CurlEngine::SocketCallback(CURL* curl, curl_socket_t sock, int what, void* userp, void* socketp)
+{
+  CurlEngine* pEngine = static_cast<CurlEngine*>(userp);
+
+  if(CURL_POLL_REMOVE == what){
+    epoll_ctl(pEngine->epoll_fd, EPOLL_CTL_DEL, sock, NULL);
+    return 0;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.data.fd = sock;
+  if(CURL_POLL_IN == what || CURL_POLL_INOUT == what){
+    ev.events |= EPOLLIN;
+  }
+  if(CURL_POLL_OUT == what || CURL_POLL_INOUT == what){
+    ev.events |= EPOLLOUT;
+  }
+  if(-1 == epoll_ctl(pEngine->epoll_fd, EPOLL_CTL_MOD, sock, &ev)){
+    if(ENOENT != errno || -1 == epoll_ctl(pEngine->epoll_fd, EPOLL_CTL_ADD, sock, &ev)){
+      SYSLOGERR("CurlEngine::SocketCallback: epoll_ctl failed(%d).", errno);
+    }
+  }
+  return 0;
+}
+
+int CurlEngine::TimerCallback(CURLM* mh, long timeout, void* userp)
+{
+  CurlEngine* pEngine = static_cast<CurlEngine*>(userp);
+
+  pEngine->timer_time = (timeout < 0 ? -1 : GetNowMs() + timeout);
+  return 0;
+}
+
+//-------------------------------------------------------------------
+// Class InflightRequests
+//-------------------------------------------------------------------
+InflightRequests InflightRequests::singleton;
+pthread_mutex_t InflightRequests::inflight_lock;
+pthread_cond_t InflightRequests::inflight_cond;
+
+InflightRequests::InflightRequests()
+{
+  if(this == InflightRequests::getInflightRequests()){
+    pthread_mutex_init(&(InflightRequests::inflight_lock), NULL);
+    pthread_cond_init(&(InflightRequests::inflight_cond), NULL);
+  }else{
+    assert(false);
+  }
+}
+
+InflightRequests::~InflightRequests()
+{
+  if(this == InflightRequests::getInflightRequests()){
+    pthread_cond_destroy(&(InflightRequests::inflight_cond));
+    pthread_mutex_destroy(&(InflightRequests::inflight_lock));
+  }else{
+    assert(false);
+  }
+}
+
+bool InflightRequests::Join(const string& key, inflight_entry** ppentry)
+{
+  pthread_mutex_lock(&InflightRequests::inflight_lock);
+  inflight_map_t::iterator iter = requests.find(key);
+  if(iter != requests.end()){
+    (*ppentry) = (*iter).second;
+    (*ppentry)->refcnt++;
+    pthread_mutex_unlock(&InflightRequests::inflight_lock);
+    FGPRINT("  InflightRequests: wait for the request in flight[key=%s]\n", key.c_str());
+    return false;
+  }
+  (*ppentry) = new inflight_entry(key);
+  requests[key] = (*ppentry);
+  pthread_mutex_unlock(&InflightRequests::inflight_lock);
+  return true;
+}
+
+void InflightRequests::Done(inflight_entry* pentry, int result, void* data)
+{
+  pthread_mutex_lock(&InflightRequests::inflight_lock);
+  // new caller after here sends new request
+  requests.erase(pentry->key);
+  pentry->is_done = true;
+  pentry->result  = result;
+  pentry->data    = data;
+  pthread_cond_broadcast(&InflightRequests::inflight_cond);
+
+  // data is leader's, so wait for followers copying it
+  while(1 < pentry->refcnt){
+    pthread_cond_wait(&InflightRequests::inflight_cond, &InflightRequests::inflight_lock);
+  }
+  pthread_mutex_unlock(&InflightRequests::inflight_lock);
+
+  delete pentry;
+}
+
+int InflightRequests::Wait(inflight_entry* pentry)
+{
+  pthread_mutex_lock(&InflightRequests::inflight_lock);
+  while(!pentry->is_done){
+    pthread_cond_wait(&InflightRequests::inflight_cond, &InflightRequests::inflight_lock);
+  }
+  int result = pentry->result;
+  pthread_mutex_unlock(&InflightRequests::inflight_lock);
+  return result;
+}
+
+void InflightRequests::Leave(inflight_entry* pentry)
+{
+  pthread_mutex_lock(&InflightRequests::inflight_lock);
+  pentry->refcnt--;
+  pthread_cond_broadcast(&InflightRequests::inflight_cond);
+  pthread_mutex_unlock(&InflightRequests::inflight_lock);
+}
@@ -0,0 +1,180 @@
+#ifndef S3FS_CURL_ENGINE_H_
+#define S3FS_CURL_ENGINE_H_
+
+//
+// Typedef
+//
+typedef void (*curl_request_reset_t)(void* data);
+
+//
+// Class CurlRequest
+//
+// The request which is sent by CurlEngine. The caller makes the curl
+// handle and keeps this object until the request is done.
+//
+class CurlRequest
+{
+  friend class CurlEngine;
+
+  private:
+    CURL*     curl;
+    BodyData* body;
+    BodyData* head;
+    FILE*     file;
+    curl_request_reset_t reset_func;  // called before retrying
+    void*     reset_data;
+    int       retry_count;
+    long long retry_time;             // time(ms) for retrying
+    bool      is_done;
+    int       result;
+
+  public:
+    CurlRequest(CURL* ncurl = NULL, BodyData* nbody = NULL, BodyData* nhead = NULL, FILE* nfile = NULL)
+      : curl(ncurl), body(nbody), head(nhead), file(nfile), reset_func(NULL), reset_data(NULL),
+        retry_count(0), retry_time(0), is_done(false), result(0) {}
+
+    void SetResetCallback(curl_request_reset_t func, void* data) {
+      reset_func = func;
+      reset_data = data;
+    }
+    CURL* GetHandle(void) const {
+      return curl;
+    }
+    // Result is valid after CurlEngine::Wait() or WaitAny() returns it.
+    int GetResult(void) const {
+      return result;
+    }
+
+    void Reset(void);
+};
+
+typedef std::list<CurlRequest*> curl_request_list_t;
+typedef std::map<CURL*, CurlRequest*> curl_request_map_t;
+
+//
+// Class CurlEngine
+//
+// All requests are sent by one event loop thread with curl_multi and
+// epoll. The requests are queued and at most max_parallel requests are
+// sent at the same time, and the failed requests are retried by the
+// retry policy of check_curl_result().
+// Before the thread starts(ex. checking bucket in main()), the request
+// is sent in the caller thread with same retry policy.
+//
+class CurlEngine
+{
+  private:
+    static CurlEngine singleton;
+    static pthread_mutex_t engine_lock;
+    static pthread_cond_t  engine_cond;   // broadcast when any request is done
+    pthread_t thread;
+    bool      is_running;
+    bool      is_stop;
+    CURLM*    multi;
+    int       epoll_fd;
+    int       wake_fd[2];
+    long long timer_time;                 // time(ms) of curl_multi timeout, -1 is not set
+    int       max_parallel;
+    curl_request_list_t pending;          // waiting for sending
+    curl_request_list_t retrying;         // waiting for retry time
+    curl_request_map_t  active;           // sending
+
+  private:
+    static void* Worker(void* arg);
+    static int SocketCallback(CURL* curl, curl_socket_t sock, int what, void* userp, void* socketp);
+    static int TimerCallback(CURLM* mh, long timeout, void* userp);
+    static long long GetNowMs(void);
+
+    void Loop(void);
+    void Wake(void);
+    bool AddPendingRequests(void);
+    void ReadDoneRequests(void);
+    void DoneRequest(CurlRequest* request, int result);
+    int PerformInline(CurlRequest* request);
+
+  public:
+    CurlEngine();
+    ~CurlEngine();
+
+    // Reference singleton
+    static CurlEngine* getCurlEngine(void) {
+      return &singleton;
+    }
+
+    bool Start(void);
+    bool Stop(void);
+    int SetMaxParallel(int count);
+    int GetMaxParallel(void) const {
+      return max_parallel;
+    }
+
+    // Send request asynchronously
+    bool Submit(CurlRequest* request);
+    // Wait for the request, and returns fuse return code
+    int Wait(CurlRequest* request);
+    // Wait for any request in list, and returns it(removed from list)
+    CurlRequest* WaitAny(curl_request_list_t& requests);
+    // Send request and wait for it
+    int Perform(CurlRequest* request);
+};
+
+//
+// Struct for the request in flight
+//
+struct inflight_entry {
+  std::string key;
+  int   refcnt;     // leader and followers
+  bool  is_done;
+  int   result;     // fuse return code of leader
+  void* data;       // result data of leader, valid until followers leave
+
+  inflight_entry(const std::string& nkey) : key(nkey), refcnt(1), is_done(false), result(0), data(NULL) {}
+};
+
+typedef std::map<std::string, inflight_entry*> inflight_map_t;  // key="verb:path..."
+
+//
+// Class InflightRequests
+//
+// Coalesces the same requests(ex. HEAD for one path) which are sent at
+// the same time. The first caller becomes the leader and sends the
+// request, and the later callers wait for it and copy the result.
+//
+//   inflight_entry* pentry;
+//   if(InflightRequests::getInflightRequests()->Join(key, &pentry)){
+//     result = (send request);
+//     InflightRequests::getInflightRequests()->Done(pentry, result, &data);
+//   }else{
+//     if(0 == (result = InflightRequests::getInflightRequests()->Wait(pentry))){
+//       (copy from pentry->data);
+//     }
+//     InflightRequests::getInflightRequests()->Leave(pentry);
+//   }
+//
+class InflightRequests
+{
+  private:
+    static InflightRequests singleton;
+    static pthread_mutex_t inflight_lock;
+    static pthread_cond_t  inflight_cond;
+    inflight_map_t requests;
+
+  public:
+    InflightRequests();
+    ~InflightRequests();
+
+    // Reference singleton
+    static InflightRequests* getInflightRequests(void) {
+      return &singleton;
+    }
+
+    // Returns true if the caller is leader
+    bool Join(const std::string& key, inflight_entry** ppentry);
+    // Leader sets result, and waits for all followers leaving
+    void Done(inflight_entry* pentry, int result, void* data = NULL);
+    // Follower waits for leader, and returns its result
+    int Wait(inflight_entry* pentry);
+    void Leave(inflight_entry* pentry);
+};
+
+#endif // S3FS_CURL_ENGINE_H_
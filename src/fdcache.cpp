@@ -24,22 +24,232 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <syslog.h>
 #include <assert.h>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <map>
+#include <list>
+#include <vector>
+#include <algorithm>
 
 #include "fdcache.h"
 #include "s3fs.h"
+#include "string_util.h"
 
 using namespace std;
 
+//-------------------------------------------------------------------
+// Class PageList
+//-------------------------------------------------------------------
+PageList::PageList(off_t size, bool is_loaded, size_t pagesize) : Size(0), PageSize(pagesize)
+{
+  if(0 == PageSize){
+    PageSize = FDPAGE_SIZE;
+  }
+  Init(size, is_loaded);
+}
+
+void PageList::Init(off_t size, bool is_loaded)
+{
+  Size = (0 < size ? size : 0);
+  Loaded.assign(PageCount(Size), is_loaded);
+  Busy.assign(PageCount(Size), false);
+  Dirty.assign(PageCount(Size), false);
+}
+
+// Pages which are added by extending are local data, thus those are
+// loaded as default. The last page keeps its status, so the caller
+// should load it before extending.
+// When the size is changed, the pages from the old(or new) last page
+// are dirty, because those are different from the object.
+void PageList::Resize(off_t size, bool is_loaded)
+{
+  if(size < 0){
+    size = 0;
+  }
+  off_t oldsize = Size;
+  Size = size;
+  Loaded.resize(PageCount(Size), is_loaded);
+  Busy.resize(PageCount(Size), false);
+  Dirty.resize(PageCount(Size), false);
+  if(oldsize != Size){
+    for(size_t pos = static_cast<size_t>(min(oldsize, Size) / PageSize); pos < Dirty.size(); pos++){
+      Dirty[pos] = true;
+    }
+  }
+}
+
+bool PageList::IsLoaded(off_t start, off_t size) const
+{
+  if(start < 0 || Size <= start){
+    return true;
+  }
+  if(size < 0 || Size < (start + size)){
+    size = Size - start;
+  }
+  if(0 == size){
+    return true;
+  }
+  size_t first = static_cast<size_t>(start / PageSize);
+  size_t last  = static_cast<size_t>((start + size - 1) / PageSize);
+  for(size_t pos = first; pos <= last && pos < Loaded.size(); pos++){
+    if(!Loaded[pos]){
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PageList::SetLoaded(off_t start, off_t size, bool is_loaded)
+{
+  if(start < 0 || size < 0){
+    return false;
+  }
+  if(Size <= start || 0 == size){
+    return true;
+  }
+  if(Size < (start + size)){
+    size = Size - start;
+  }
+  // Only pages which are fully covered(or reach to EOF) are changed.
+  size_t first = static_cast<size_t>((start + PageSize - 1) / PageSize);
+  size_t last  = ((start + size) == Size ? Loaded.size() : static_cast<size_t>((start + size) / PageSize));
+  for(size_t pos = first; pos < last && pos < Loaded.size(); pos++){
+    Loaded[pos] = is_loaded;
+  }
+  return true;
+}
+
+//
+// Find first area of continuous unloaded pages in the range.
+// The found area is aligned by page size, and it is limited by EOF.
+// The busy pages are skipped, those are loaded by other thread.
+//
+bool PageList::FindUnloaded(off_t start, off_t size, off_t& ustart, off_t& usize) const
+{
+  if(start < 0){
+    start = 0;
+  }
+  if(Size <= start){
+    return false;
+  }
+  if(size < 0 || Size < (start + size)){
+    size = Size - start;
+  }
+  if(0 == size){
+    return false;
+  }
+  size_t first = static_cast<size_t>(start / PageSize);
+  size_t last  = static_cast<size_t>((start + size - 1) / PageSize);
+  size_t pos;
+  for(pos = first; pos <= last && (Loaded[pos] || Busy[pos]); pos++);
+  if(last < pos){
+    return false;
+  }
+  size_t endpos;
+  for(endpos = pos; endpos <= last && !Loaded[endpos] && !Busy[endpos]; endpos++);
+
+  ustart = static_cast<off_t>(pos) * PageSize;
+  usize  = static_cast<off_t>(endpos - pos) * PageSize;
+  if(Size < (ustart + usize)){
+    usize = Size - ustart;
+  }
+  return true;
+}
+
+bool PageList::SetLoadedList(const std::vector<bool>& loaded)
+{
+  if(loaded.size() != Loaded.size()){
+    return false;
+  }
+  Loaded = loaded;
+  return true;
+}
+
+// Busy status is set to all pages which overlap the range.
+bool PageList::IsBusy(off_t start, off_t size) const
+{
+  if(start < 0 || Size <= start || 0 == size){
+    return false;
+  }
+  if(size < 0 || Size < (start + size)){
+    size = Size - start;
+  }
+  size_t first = static_cast<size_t>(start / PageSize);
+  size_t last  = static_cast<size_t>((start + size - 1) / PageSize);
+  for(size_t pos = first; pos <= last && pos < Busy.size(); pos++){
+    if(Busy[pos]){
+      return true;
+    }
+  }
+  return false;
+}
+
+void PageList::SetBusy(off_t start, off_t size, bool is_busy)
+{
+  if(start < 0 || Size <= start || 0 == size){
+    return;
+  }
+  if(size < 0 || Size < (start + size)){
+    size = Size - start;
+  }
+  size_t first = static_cast<size_t>(start / PageSize);
+  size_t last  = static_cast<size_t>((start + size - 1) / PageSize);
+  for(size_t pos = first; pos <= last && pos < Busy.size(); pos++){
+    Busy[pos] = is_busy;
+  }
+}
+
+// Dirty status is set to all pages which overlap the range.
+bool PageList::IsDirty(off_t start, off_t size) const
+{
+  if(start < 0 || Size <= start || 0 == size){
+    return false;
+  }
+  if(size < 0 || Size < (start + size)){
+    size = Size - start;
+  }
+  size_t first = static_cast<size_t>(start / PageSize);
+  size_t last  = static_cast<size_t>((start + size - 1) / PageSize);
+  for(size_t pos = first; pos <= last && pos < Dirty.size(); pos++){
+    if(Dirty[pos]){
+      return true;
+    }
+  }
+  return false;
+}
+
+void PageList::SetDirty(off_t start, off_t size)
+{
+  if(start < 0 || Size <= start || 0 == size){
+    return;
+  }
+  if(size < 0 || Size < (start + size)){
+    size = Size - start;
+  }
+  size_t first = static_cast<size_t>(start / PageSize);
+  size_t last  = static_cast<size_t>((start + size - 1) / PageSize);
+  for(size_t pos = first; pos <= last && pos < Dirty.size(); pos++){
+    Dirty[pos] = true;
+  }
+}
+
+void PageList::ClearDirty(void)
+{
+  Dirty.assign(PageCount(Size), false);
+}
+
 //-------------------------------------------------------------------
 // Static
 //-------------------------------------------------------------------
 FdCache FdCache::singleton;
 pthread_mutex_t FdCache::fd_cache_lock;
+pthread_cond_t FdCache::fd_cache_cond;
 
 //-------------------------------------------------------------------
 // Constructor/Destructor
@@ -48,6 +258,7 @@ FdCache::FdCache()
 {
   if(this == FdCache::getFdCacheData()){
     pthread_mutex_init(&(FdCache::fd_cache_lock), NULL);
+    pthread_cond_init(&(FdCache::fd_cache_cond), NULL);
   }else{
     assert(false);
   }
@@ -56,6 +267,7 @@ FdCache::FdCache()
 FdCache::~FdCache()
 {
   if(this == FdCache::getFdCacheData()){
+    pthread_cond_destroy(&(FdCache::fd_cache_cond));
     pthread_mutex_destroy(&(FdCache::fd_cache_lock));
   }else{
     assert(false);
@@ -65,190 +277,1055 @@ FdCache::~FdCache()
 //-------------------------------------------------------------------
 // Methods
 //-------------------------------------------------------------------
-bool FdCache::makeKey(const char* path, string& strkey)
+//
+// If path is already opened by other handle, the local file is shared.
+// The access mode of the file is widest mode of the handles.
+//
+bool FdCache::Open(const char* path, int flags, int* pfd)
 {
-  struct fuse_context* pcxt;
+  fd_cache_t::iterator iter;
 
-  if(NULL == (pcxt = fuse_get_context())){
+  if(!path){
     return false;
   }
-  if(!path){
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_cache.end() == (iter = fd_cache.find(string(path)))){
+    pthread_mutex_unlock(&FdCache::fd_cache_lock);
     return false;
   }
-  // make key string
-  ostringstream stream;
-  stream << pcxt->pid;
-  strkey = stream.str();
-  strkey += "#";
-  strkey += path;
+  (*iter).second.refcnt++;
+  if(((*iter).second.flags & O_ACCMODE) < (flags & O_ACCMODE)){
+    (*iter).second.flags = flags;
+  }
+  fd_flags[(*iter).second.fd] = (*iter).second.flags;
+  if(pfd){
+    *pfd = (*iter).second.fd;
+  }
+  FGPRINT("    FdCache::Open[path=%s] fd(%d),flags(%d),refcnt(%d)\n", path, (*iter).second.fd, (*iter).second.flags, (*iter).second.refcnt);
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
   return true;
 }
 
-bool FdCache::Add(const char* path, int fd, int flags)
+//
+// Add opened local file for path, and returns the fd which should be
+// used. If other handle has already added the path, its fd is returned
+// and the caller should close own fd.
+//
+int FdCache::Add(const char* path, int fd, int flags)
 {
   fd_cache_t::iterator iter;
 
-  // make key string
-  string strkey;
-  if(!FdCache::makeKey(path, strkey)){
-    return false;
+  if(!path){
+    return -1;
   }
   FGPRINT("    FdCache::Add[path=%s] fd(%d),flags(%d)\n", path, fd, flags);
 
   pthread_mutex_lock(&FdCache::fd_cache_lock);
-  if(fd_cache.end() != (iter = fd_cache.find(strkey))){
-    if(fd == (*iter).second.fd && flags == (*iter).second.flags){
-      // Do nothing
-
-    }else if(fd == (*iter).second.fd && flags != (*iter).second.flags){
-      // Check and Set flags
-      if(((*iter).second.flags & O_ACCMODE) < (flags & O_ACCMODE)){
-        (*iter).second.flags = flags;
-      }
-    }else{
-      // Check, Set fd & flags
-      if(((*iter).second.flags & O_ACCMODE) < (flags & O_ACCMODE)){
-        (*iter).second.fd    = fd;
-        (*iter).second.flags = flags;
-      }
+  if(fd_cache.end() != (iter = fd_cache.find(string(path)))){
+    (*iter).second.refcnt++;
+    if(((*iter).second.flags & O_ACCMODE) < (flags & O_ACCMODE)){
+      (*iter).second.flags = flags;
     }
+    fd    = (*iter).second.fd;
+    flags = (*iter).second.flags;
   }else{
     // Set new data
-    fd_cache[strkey].fd    = fd;
-    fd_cache[strkey].flags = flags;
+    fd_cache[string(path)].fd     = fd;
+    fd_cache[string(path)].flags  = flags;
+    fd_cache[string(path)].refcnt = 1;
   }
   // Set fd->flags
   fd_flags[fd] = flags;
 
   pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
-  return true;
+  return fd;
 }
 
-// Specified path(+pid) and fd are removed from fd_cache and fd_flags.
-bool FdCache::Del(const char* path, int fd)
+//
+// Release one handle for path. If it is last handle, *plast is set true
+// and the caller should remove the page list and close the fd.
+// If the last handle is released while the object is not created yet,
+// *pisnew is set true and its headers are set into *pnewmeta, then the
+// caller creates the object from fd.
+// If the path is not found(ex. renamed while opening), fd is searched.
+//
+bool FdCache::Close(const char* path, int fd, bool* plast, bool* pisnew, headers_t* pnewmeta)
 {
-  fd_cache_t::iterator fd_iter;
-  fd_flags_t::iterator flags_iter;
+  fd_cache_t::iterator iter;
 
-  // make key string
-  string strkey;
-  if(!FdCache::makeKey(path, strkey)){
-    return false;
+  if(plast){
+    *plast = true;
   }
-  FGPRINT("    FdCache::Del[path=%s][fd=%d]\n", path, fd);
+  if(pisnew){
+    *pisnew = false;
+  }
+  FGPRINT("    FdCache::Close[path=%s][fd=%d]\n", path ? path : "", fd);
 
   pthread_mutex_lock(&FdCache::fd_cache_lock);
-
-  // Delete path->fd
-  if(fd_cache.end() != (fd_iter = fd_cache.find(strkey))){
-    Del((*fd_iter).second.fd);
-    fd_cache.erase(fd_iter);
+  iter = (path ? fd_cache.find(string(path)) : fd_cache.end());
+  if(fd_cache.end() == iter || fd != (*iter).second.fd){
+    for(iter = fd_cache.begin(); fd_cache.end() != iter; ++iter){
+      if((*iter).second.fd == fd){
+        break;
+      }
+    }
   }
-  // search same fd in fd_cache and remove it (for case of pid=0).
-  for(fd_iter = fd_cache.begin(); fd_cache.end() != fd_iter; ){
-    if((*fd_iter).second.fd == fd){
-      // found same fd
-      fd_cache.erase(fd_iter++);
-    }else{
-      fd_iter++;
+  if(fd_cache.end() != iter){
+    if(0 < --((*iter).second.refcnt)){
+      if(plast){
+        *plast = false;
+      }
+      pthread_mutex_unlock(&FdCache::fd_cache_lock);
+      return true;
+    }
+    if((*iter).second.is_new){
+      if(pisnew){
+        *pisnew = true;
+      }
+      if(pnewmeta){
+        *pnewmeta = (*iter).second.newmeta;
+      }
     }
+    fd_cache.erase(iter);
   }
   // Delete fd->flags
-  if(fd_flags.end() != (flags_iter = fd_flags.find(fd))){
-    fd_flags.erase(flags_iter);
-  }
+  fd_flags.erase(fd);
 
   pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
   return true;
 }
 
-// Specified path(+pid) is removed from fd_cache.
-// And if can, fd_cache[path].fd is removed from fd_flags.
-bool FdCache::Del(const char* path)
+bool FdCache::Get(const char* path, int* pfd, int* pflags) const
 {
-  fd_cache_t::iterator fd_iter;
+  bool result = true;
+  fd_cache_t::const_iterator iter;
 
-  // make key string
-  string strkey;
-  if(!FdCache::makeKey(path, strkey)){
+  if(!path){
     return false;
   }
-  FGPRINT("    FdCache::Del[path=%s]\n", path);
-
   pthread_mutex_lock(&FdCache::fd_cache_lock);
-  if(fd_cache.end() != (fd_iter = fd_cache.find(strkey))){
-    Del((*fd_iter).second.fd);
-    fd_cache.erase(fd_iter);
+  if(fd_cache.end() != (iter = fd_cache.find(string(path)))){
+    if(pfd){
+      *pfd = (*iter).second.fd;
+    }
+    if(pflags){
+      *pflags = (*iter).second.flags;
+    }
+    FGPRINT("    FdCache::Get[path=%s] fd=%d,flags=%d\n", path, (*iter).second.fd, (*iter).second.flags);
+  }else{
+    result = false;
   }
   pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
-  return true;
+  return result;
 }
 
-// Only fd is removed from fd_flags.
-bool FdCache::Del(int fd)
+bool FdCache::Get(int fd, int* pflags) const
 {
-  fd_flags_t::iterator flags_iter;
+  bool result = true;
+  fd_flags_t::const_iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_flags.end() != (iter = fd_flags.find(fd))){
+    if(pflags){
+      *pflags = (*iter).second;
+    }
+    FGPRINT("    FdCache::Get[fd=%d] flags=%d\n", fd, (*iter).second);
+  }else{
+    result = false;
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
-  FGPRINT("    FdCache::Del[fd=%d]\n", fd);
+  return result;
+}
+
+bool FdCache::SetNewObject(const char* path, headers_t& meta)
+{
+  bool result = false;
+  fd_cache_t::iterator iter;
 
+  if(!path){
+    return false;
+  }
   pthread_mutex_lock(&FdCache::fd_cache_lock);
-  // Delete fd->flags
-  if(fd_flags.end() != (flags_iter = fd_flags.find(fd))){
-    fd_flags.erase(flags_iter);
+  if(fd_cache.end() != (iter = fd_cache.find(string(path)))){
+    (*iter).second.is_new  = true;
+    (*iter).second.newmeta = meta;
+    (*iter).second.newcount++;
+    result = true;
   }
   pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
-  return true;
+  return result;
 }
 
-bool FdCache::Get(const char* path, int* pfd, int* pflags) const
+bool FdCache::GetNewObject(const char* path, headers_t* pmeta, unsigned long* pcount) const
 {
-  bool result = true;
+  bool result = false;
   fd_cache_t::const_iterator iter;
 
-  // make key string
-  string strkey;
-  if(!FdCache::makeKey(path, strkey)){
+  if(!path){
     return false;
   }
-  
   pthread_mutex_lock(&FdCache::fd_cache_lock);
-  if(fd_cache.end() != (iter = fd_cache.find(strkey))){
-    if(pfd){
-      *pfd = (*iter).second.fd;
+  if(fd_cache.end() != (iter = fd_cache.find(string(path))) && (*iter).second.is_new){
+    if(pmeta){
+      *pmeta = (*iter).second.newmeta;
     }
-    if(pflags){
-      *pflags = (*iter).second.flags;
+    if(pcount){
+      *pcount = (*iter).second.newcount;
     }
-    FGPRINT("    FdCache::Get[path=%s] fd=%d,flags=%d\n", path, (*iter).second.fd, (*iter).second.flags);
-  }else{
-    result = false;
+    result = true;
   }
   pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
   return result;
 }
 
-bool FdCache::Get(int fd, int* pflags) const
+// Returns false if path is not new file, then the caller changes the object.
+bool FdCache::UpdateNewObject(const char* path, const string& key, const string& value)
+{
+  bool result = false;
+  fd_cache_t::iterator iter;
+
+  if(!path){
+    return false;
+  }
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_cache.end() != (iter = fd_cache.find(string(path))) && (*iter).second.is_new){
+    (*iter).second.newmeta[key] = value;
+    (*iter).second.newcount++;
+    result = true;
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+//
+// After uploading, the file is not new. If the headers are changed while
+// uploading(the count is changed), this returns false and the latest
+// headers are set into pmeta, then the caller should update the object.
+//
+bool FdCache::ClearNewObject(const char* path, unsigned long count, headers_t* pmeta)
 {
   bool result = true;
-  fd_flags_t::const_iterator iter;
+  fd_cache_t::iterator iter;
 
+  if(!path){
+    return false;
+  }
   pthread_mutex_lock(&FdCache::fd_cache_lock);
-  if(fd_flags.end() != (iter = fd_flags.find(fd))){
-    if(pflags){
-      *pflags = (*iter).second;
+  if(fd_cache.end() != (iter = fd_cache.find(string(path))) && (*iter).second.is_new){
+    if(count != (*iter).second.newcount){
+      if(pmeta){
+        *pmeta = (*iter).second.newmeta;
+      }
+      result = false;
     }
-    FGPRINT("    FdCache::Get[fd=%d] flags=%d\n", fd, (*iter).second);
-  }else{
-    result = false;
+    (*iter).second.is_new = false;
+    (*iter).second.newmeta.clear();
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+// Get paths of new files under dir(includes sub directories).
+bool FdCache::GetNewObjectList(const char* dir, list<string>& paths) const
+{
+  if(!dir){
+    return false;
+  }
+  string strdir = dir;
+  if(0 == strdir.length() || '/' != strdir[strdir.length() - 1]){
+    strdir += "/";
+  }
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  for(fd_cache_t::const_iterator iter = fd_cache.begin(); fd_cache.end() != iter; ++iter){
+    if((*iter).second.is_new && 0 == (*iter).first.compare(0, strdir.length(), strdir)){
+      paths.push_back((*iter).first);
+    }
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return true;
+}
+
+
+//-------------------------------------------------------------------
+// Methods for partial loading
+//-------------------------------------------------------------------
+bool FdCache::SetPageList(int fd, off_t size, time_t mtime, bool is_loaded, const char* etag)
+{
+  FGPRINT("    FdCache::SetPageList[fd=%d][size=%zd][loaded=%s]\n", fd, size, is_loaded ? "yes" : "no");
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  fd_pages[fd].pages.Init(size, is_loaded);
+  fd_pages[fd].mtime        = mtime;
+  fd_pages[fd].etag         = (etag ? etag : "");
+  fd_pages[fd].modified     = false;
+  fd_pages[fd].modify_count = 0;
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return true;
+}
+
+// Set the loaded pages which are restored from cache index.
+bool FdCache::SetPageList(int fd, off_t size, time_t mtime, const vector<bool>& loaded, const char* etag)
+{
+  if(!SetPageList(fd, size, mtime, false, etag)){
+    return false;
+  }
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  bool result = fd_pages[fd].pages.SetLoadedList(loaded);
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+bool FdCache::GetPageList(int fd, vector<bool>& loaded, string& etag, unsigned long* pcount) const
+{
+  bool result = false;
+  fd_pages_t::const_iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    loaded = (*iter).second.pages.GetLoadedList();
+    etag   = (*iter).second.etag;
+    if(pcount){
+      *pcount = (*iter).second.modify_count;
+    }
+    result = true;
   }
   pthread_mutex_unlock(&FdCache::fd_cache_lock);
 
   return result;
 }
 
+bool FdCache::DelPageList(int fd)
+{
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  fd_pages.erase(fd);
+  pthread_cond_broadcast(&FdCache::fd_cache_cond);
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return true;
+}
+
+bool FdCache::HasPageList(int fd) const
+{
+  bool result;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  result = (fd_pages.end() != fd_pages.find(fd));
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+//
+// Find unloaded pages in the range and set those busy, then the caller
+// downloads those and calls ReleasePage(). If the pages in the range are
+// loaded by other thread, this waits for it.
+// If fd does not have page list, it means that all pages are loaded.
+//
+bool FdCache::ReserveUnloadedPage(int fd, off_t start, off_t size, off_t& ustart, off_t& usize)
+{
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  while(fd_pages.end() != (iter = fd_pages.find(fd))){
+    if((*iter).second.pages.FindUnloaded(start, size, ustart, usize)){
+      (*iter).second.pages.SetBusy(ustart, usize, true);
+      pthread_mutex_unlock(&FdCache::fd_cache_lock);
+      return true;
+    }
+    if(!(*iter).second.pages.IsBusy(start, size)){
+      break;
+    }
+    pthread_cond_wait(&FdCache::fd_cache_cond, &FdCache::fd_cache_lock);
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return false;
+}
+
+//
+// Set all pages in the range busy for writing, it waits for the pages
+// which are loaded by other thread.
+//
+bool FdCache::ReservePage(int fd, off_t start, off_t size)
+{
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  while(fd_pages.end() != (iter = fd_pages.find(fd))){
+    if(!(*iter).second.pages.IsBusy(start, size)){
+      (*iter).second.pages.SetBusy(start, size, true);
+      pthread_mutex_unlock(&FdCache::fd_cache_lock);
+      return true;
+    }
+    pthread_cond_wait(&FdCache::fd_cache_cond, &FdCache::fd_cache_lock);
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return false;
+}
+
+bool FdCache::ReleasePage(int fd, off_t start, off_t size, bool is_loaded)
+{
+  bool result = false;
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    (*iter).second.pages.SetBusy(start, size, false);
+    if(is_loaded){
+      (*iter).second.pages.SetLoaded(start, size, true);
+    }
+    result = true;
+  }
+  pthread_cond_broadcast(&FdCache::fd_cache_cond);
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+bool FdCache::SetLoadedPage(int fd, off_t start, off_t size)
+{
+  bool result = false;
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    result = (*iter).second.pages.SetLoaded(start, size, true);
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+bool FdCache::ResizePageList(int fd, off_t size)
+{
+  bool result = false;
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    (*iter).second.pages.Resize(size, true);
+    result = true;
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+bool FdCache::IsAllLoaded(int fd, time_t* pmtime) const
+{
+  bool result = true;
+  fd_pages_t::const_iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    result = (*iter).second.pages.IsLoaded();
+    if(pmtime){
+      *pmtime = (*iter).second.mtime;
+    }
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+bool FdCache::SetModified(int fd)
+{
+  bool result = false;
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    (*iter).second.modified = true;
+    (*iter).second.modify_count++;
+    result = true;
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+// If fd does not have page list, it is unknown whether the file is
+// modified, so this returns true.
+// The count of changes is set into pcount, it is used for ClearModified().
+bool FdCache::IsModified(int fd, unsigned long* pcount) const
+{
+  bool result = true;
+  fd_pages_t::const_iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    result = (*iter).second.modified;
+    if(pcount){
+      *pcount = (*iter).second.modify_count;
+    }
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+// After uploading, the file is not modified if it is not changed
+// while uploading(the count is not changed).
+// The etag is the ETag of uploaded object, the dirty pages after this are
+// the changes from it. If the file is changed while uploading, the dirty
+// pages are kept(those include the changes after uploading).
+bool FdCache::ClearModified(int fd, unsigned long count, const char* etag)
+{
+  bool result = false;
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    if(count == (*iter).second.modify_count){
+      (*iter).second.modified = false;
+      (*iter).second.pages.ClearDirty();
+      result = true;
+    }
+    if(etag){
+      (*iter).second.etag = etag;
+    }
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+bool FdCache::SetDirtyPage(int fd, off_t start, off_t size)
+{
+  bool result = false;
+  fd_pages_t::iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    (*iter).second.pages.SetDirty(start, size);
+    result = true;
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+// If fd does not have page list, all pages are dirty.
+bool FdCache::IsDirtyPage(int fd, off_t start, off_t size) const
+{
+  bool result = true;
+  fd_pages_t::const_iterator iter;
+
+  pthread_mutex_lock(&FdCache::fd_cache_lock);
+  if(fd_pages.end() != (iter = fd_pages.find(fd))){
+    result = (*iter).second.pages.IsDirty(start, size);
+  }
+  pthread_mutex_unlock(&FdCache::fd_cache_lock);
+
+  return result;
+}
+
+//-------------------------------------------------------------------
+// Class DiskCache
+//-------------------------------------------------------------------
+DiskCache DiskCache::singleton;
+pthread_mutex_t DiskCache::disk_cache_lock;
+
+//
+// Utility for index records
+//
+// S<tab>path<tab>etag<tab>object size<tab>atime<tab>page size<tab>page count<tab>loaded pages(hex)
+// D<tab>path
+//
+static string encode_index_path(const string& path)
+{
+  static const char hexAlphabet[] = "0123456789ABCDEF";
+  string result;
+  for(string::const_iterator iter = path.begin(); iter != path.end(); ++iter){
+    if('%' == *iter || '\t' == *iter || '\n' == *iter || '\r' == *iter){
+      result += '%';
+      result += hexAlphabet[(*iter >> 4) & 0xf];
+      result += hexAlphabet[*iter & 0xf];
+    }else{
+      result += *iter;
+    }
+  }
+  return result;
+}
+
+static string decode_index_path(const string& str)
+{
+  string result;
+  for(size_t pos = 0; pos < str.length(); pos++){
+    if('%' == str[pos] && (pos + 2) < str.length()){
+      result += static_cast<char>(strtol(str.substr(pos + 1, 2).c_str(), NULL, 16));
+      pos    += 2;
+    }else{
+      result += str[pos];
+    }
+  }
+  return result;
+}
+
+static string encode_loaded_pages(const vector<bool>& loaded)
+{
+  static const char hexAlphabet[] = "0123456789abcdef";
+  string result;
+  for(size_t pos = 0; pos < loaded.size(); pos += 4){
+    int bits = 0;
+    for(size_t cnt = 0; cnt < 4 && (pos + cnt) < loaded.size(); cnt++){
+      if(loaded[pos + cnt]){
+        bits |= (1 << cnt);
+      }
+    }
+    result += hexAlphabet[bits];
+  }
+  return result;
+}
+
+static bool decode_loaded_pages(const string& str, size_t count, vector<bool>& loaded)
+{
+  if(str.length() != (count + 3) / 4){
+    return false;
+  }
+  loaded.assign(count, false);
+  for(size_t pos = 0; pos < count; pos++){
+    char ch   = str[pos / 4];
+    int  bits = ('a' <= ch ? ch - 'a' + 10 : ch - '0');
+    loaded[pos] = (0 != (bits & (1 << (pos % 4))));
+  }
+  return true;
+}
+
+static string make_index_record(const string& path, const disk_cache_entry& ent)
+{
+  return "S\t" + encode_index_path(path) + "\t" + ent.etag + "\t" + str(ent.objsize) + "\t" + str(ent.atime) + "\t" +
+         str(FDPAGE_SIZE) + "\t" + str(ent.loaded.size()) + "\t" + encode_loaded_pages(ent.loaded) + "\n";
+}
+
+DiskCache::DiskCache() : IndexFd(-1), MaxSize(0), LowWatermark(DISK_CACHE_LOW_WATERMARK), HighWatermark(DISK_CACHE_HIGH_WATERMARK),
+                         TotalSize(0), HitCount(0), MissCount(0), EvictCount(0)
+{
+  if(this == DiskCache::getDiskCache()){
+    pthread_mutex_init(&(DiskCache::disk_cache_lock), NULL);
+  }else{
+    assert(false);
+  }
+}
+
+DiskCache::~DiskCache()
+{
+  if(this == DiskCache::getDiskCache()){
+    if(-1 != IndexFd){
+      close(IndexFd);
+    }
+    pthread_mutex_destroy(&(DiskCache::disk_cache_lock));
+  }else{
+    assert(false);
+  }
+}
+
+off_t DiskCache::SetMaxSize(off_t size)
+{
+  off_t old = MaxSize;
+  MaxSize   = (0 < size ? size : 0);
+  return old;
+}
+
+bool DiskCache::SetWatermark(int low, int high)
+{
+  if(low < 0 || 100 < high || high < low){
+    return false;
+  }
+  LowWatermark  = low;
+  HighWatermark = high;
+  return true;
+}
+
+//
+// Make index from files in dir(use_cache/bucket) and index file.
+// The files are ordered by access time.
+//
+bool DiskCache::Init(const char* dir, const char* index)
+{
+  vector<pair<time_t, string> > files;
+  disk_cache_t records;
+
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  CacheDir  = dir;
+  IndexPath = index;
+  cache.clear();
+  lru.clear();
+  TotalSize = 0;
+  if(-1 != IndexFd){
+    close(IndexFd);
+    IndexFd = -1;
+  }
+  if(!LoadDirectory(string(""), files)){
+    pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+    return false;
+  }
+  LoadIndex(records);
+
+  for(vector<pair<time_t, string> >::iterator iter = files.begin(); iter != files.end(); ++iter){
+    disk_cache_t::const_iterator riter = records.find((*iter).second);
+    if(riter != records.end() && (*iter).first < (*riter).second.atime){
+      (*iter).first = (*riter).second.atime;
+    }
+  }
+  sort(files.begin(), files.end());
+  for(vector<pair<time_t, string> >::iterator iter = files.begin(); iter != files.end(); ++iter){
+    struct stat st;
+    if(0 != lstat((CacheDir + (*iter).second).c_str(), &st)){
+      continue;
+    }
+    SetEntry((*iter).second, static_cast<off_t>(st.st_blocks) * 512);
+
+    disk_cache_t::const_iterator riter = records.find((*iter).second);
+    if(riter != records.end() && st.st_size == (*riter).second.objsize){
+      disk_cache_entry& ent = cache[(*iter).second];
+      ent.has_index = true;
+      ent.etag      = (*riter).second.etag;
+      ent.objsize   = (*riter).second.objsize;
+      ent.atime     = (*riter).second.atime;
+      ent.loaded    = (*riter).second.loaded;
+    }
+  }
+  FGPRINT("    DiskCache::Init[dir=%s] files(%zu),size(%zd)\n", dir, cache.size(), TotalSize);
+
+  // compaction
+  if(!WriteIndex()){
+    SYSLOGERR("could not write cache index file %s(%d).", index, errno);
+  }
+  EvictCache();
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+
+  return true;
+}
+
+//
+// Read all records from the index file, the last record for each path
+// is used. The broken(not terminated) record at the end is ignored.
+//
+bool DiskCache::LoadIndex(disk_cache_t& records)
+{
+  ifstream IF(IndexPath.c_str());
+  if(!IF.good()){
+    return false;
+  }
+  string line;
+  while(getline(IF, line)){
+    if(IF.eof()){
+      // not terminated by LF
+      break;
+    }
+    vector<string> fields;
+    string::size_type start = 0;
+    string::size_type pos;
+    while(string::npos != (pos = line.find('\t', start))){
+      fields.push_back(line.substr(start, pos - start));
+      start = pos + 1;
+    }
+    fields.push_back(line.substr(start));
+
+    if(2 == fields.size() && "D" == fields[0]){
+      records.erase(decode_index_path(fields[1]));
+
+    }else if(8 == fields.size() && "S" == fields[0]){
+      disk_cache_entry ent;
+      size_t           count = static_cast<size_t>(strtoul(fields[6].c_str(), NULL, 10));
+      if(FDPAGE_SIZE != strtoul(fields[5].c_str(), NULL, 10) || !decode_loaded_pages(fields[7], count, ent.loaded)){
+        records.erase(decode_index_path(fields[1]));
+        continue;
+      }
+      ent.has_index = true;
+      ent.etag      = fields[2];
+      ent.objsize   = static_cast<off_t>(strtoll(fields[3].c_str(), NULL, 10));
+      ent.atime     = static_cast<time_t>(strtoll(fields[4].c_str(), NULL, 10));
+      records[decode_index_path(fields[1])] = ent;
+    }
+  }
+  return true;
+}
+
+// Must be locked by caller.
+bool DiskCache::WriteIndex(void)
+{
+  if(0 == IndexPath.size()){
+    return false;
+  }
+  string tmppath = IndexPath + ".tmp";
+  FILE*  fp;
+  if(NULL == (fp = fopen(tmppath.c_str(), "w"))){
+    return false;
+  }
+  for(disk_cache_t::const_iterator iter = cache.begin(); iter != cache.end(); ++iter){
+    if((*iter).second.has_index){
+      fputs(make_index_record((*iter).first, (*iter).second).c_str(), fp);
+    }
+  }
+  if(0 != fflush(fp) || 0 != fsync(fileno(fp))){
+    fclose(fp);
+    unlink(tmppath.c_str());
+    return false;
+  }
+  fclose(fp);
+  if(-1 == rename(tmppath.c_str(), IndexPath.c_str())){
+    unlink(tmppath.c_str());
+    return false;
+  }
+  if(-1 == (IndexFd = open(IndexPath.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600))){
+    return false;
+  }
+  return true;
+}
+
+// Must be locked by caller.
+bool DiskCache::AppendIndex(const string& line, bool is_sync)
+{
+  if(-1 == IndexFd){
+    return false;
+  }
+  if(static_cast<ssize_t>(line.length()) != write(IndexFd, line.c_str(), line.length())){
+    SYSLOGERR("could not write cache index file(%d).", errno);
+    return false;
+  }
+  if(is_sync && 0 != fdatasync(IndexFd)){
+    return false;
+  }
+  return true;
+}
+
+bool DiskCache::LoadDirectory(const string& dir, vector<pair<time_t, string> >& files)
+{
+  DIR* dp;
+  struct dirent* dent;
+
+  if(NULL == (dp = opendir((CacheDir + dir).c_str()))){
+    // the directory is made when the first file is cached.
+    return (ENOENT == errno);
+  }
+  while(NULL != (dent = readdir(dp))){
+    if(0 == strcmp(dent->d_name, ".") || 0 == strcmp(dent->d_name, "..")){
+      continue;
+    }
+    string      path = dir + "/" + dent->d_name;
+    struct stat st;
+    if(0 != lstat((CacheDir + path).c_str(), &st)){
+      continue;
+    }
+    if(S_ISDIR(st.st_mode)){
+      LoadDirectory(path, files);
+    }else if(S_ISREG(st.st_mode)){
+      files.push_back(make_pair(st.st_atime, path));
+    }
+  }
+  closedir(dp);
+
+  return true;
+}
+
+// Must be locked by caller.
+void DiskCache::SetEntry(const string& path, off_t size)
+{
+  disk_cache_t::iterator iter = cache.find(path);
+  if(iter != cache.end()){
+    TotalSize -= (*iter).second.size;
+    lru.erase((*iter).second.lru);
+  }else{
+    iter = cache.insert(make_pair(path, disk_cache_entry())).first;
+  }
+  (*iter).second.size = size;
+  (*iter).second.lru  = lru.insert(lru.begin(), path);
+  TotalSize += size;
+}
+
+// Must be locked by caller.
+void DiskCache::EvictCache(void)
+{
+  if(0 == MaxSize || TotalSize <= (MaxSize / 100) * HighWatermark){
+    return;
+  }
+  off_t target = (MaxSize / 100) * LowWatermark;
+
+  FGPRINT("    DiskCache::EvictCache[size=%zd][target=%zd]\n", TotalSize, target);
+
+  bool is_removed = false;
+  disk_cache_lru_t::iterator iter = lru.end();
+  while(target < TotalSize && iter != lru.begin()){
+    --iter;
+    // opened file is not removed.
+    if(FdCache::getFdCacheData()->Get((*iter).c_str())){
+      continue;
+    }
+    if(-1 == unlink((CacheDir + (*iter)).c_str()) && ENOENT != errno){
+      SYSLOGERR("could not remove cache file %s(%d).", (*iter).c_str(), errno);
+      continue;
+    }
+    disk_cache_t::iterator citer = cache.find(*iter);
+    if(citer != cache.end()){
+      if((*citer).second.has_index){
+        AppendIndex("D\t" + encode_index_path(*iter) + "\n", false);
+        is_removed = true;
+      }
+      TotalSize -= (*citer).second.size;
+      cache.erase(citer);
+    }
+    EvictCount++;
+    iter = lru.erase(iter);
+  }
+  if(is_removed && -1 != IndexFd){
+    fdatasync(IndexFd);
+  }
+  SYSLOGINFO("cache files are evicted: size(%zd), hit(%lu), miss(%lu), evict(%lu)", TotalSize, HitCount, MissCount, EvictCount);
+}
+
+void DiskCache::Hit(const char* path)
+{
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  HitCount++;
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+}
+
+void DiskCache::Miss(const char* path)
+{
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  MissCount++;
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+}
+
+//
+// Update the size of cache file for path, and it is moved to the head
+// of LRU list. If the total size is over, old files are evicted.
+//
+bool DiskCache::Update(const char* path)
+{
+  struct stat st;
+
+  if(!path || 0 == CacheDir.size()){
+    return false;
+  }
+  if(0 != lstat((CacheDir + path).c_str(), &st)){
+    return Remove(path);
+  }
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  SetEntry(string(path), static_cast<off_t>(st.st_blocks) * 512);
+  EvictCache();
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+
+  return true;
+}
+
+bool DiskCache::Remove(const char* path)
+{
+  if(!path){
+    return false;
+  }
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  disk_cache_t::iterator iter = cache.find(string(path));
+  if(iter != cache.end()){
+    if((*iter).second.has_index){
+      AppendIndex("D\t" + encode_index_path(string(path)) + "\n", true);
+    }
+    TotalSize -= (*iter).second.size;
+    lru.erase((*iter).second.lru);
+    cache.erase(iter);
+  }
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+
+  return true;
+}
+
+bool DiskCache::GetIndex(const char* path, string& etag, off_t& size, vector<bool>& loaded) const
+{
+  bool result = false;
+
+  if(!path){
+    return false;
+  }
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  disk_cache_t::const_iterator iter = cache.find(string(path));
+  if(iter != cache.end() && (*iter).second.has_index){
+    etag   = (*iter).second.etag;
+    size   = (*iter).second.objsize;
+    loaded = (*iter).second.loaded;
+    result = true;
+  }
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+
+  return result;
+}
+
+//
+// Set the index record for the cache file, the caller must sync the file
+// before calling this.
+//
+bool DiskCache::SetIndex(const char* path, const string& etag, off_t size, const vector<bool>& loaded)
+{
+  struct stat st;
+
+  if(!path || 0 == CacheDir.size() || 0 == etag.size()){
+    return false;
+  }
+  if(0 != lstat((CacheDir + path).c_str(), &st)){
+    return false;
+  }
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  SetEntry(string(path), static_cast<off_t>(st.st_blocks) * 512);
+
+  disk_cache_entry& ent = cache[string(path)];
+  ent.has_index = true;
+  ent.etag      = etag;
+  ent.objsize   = size;
+  ent.atime     = time(NULL);
+  ent.loaded    = loaded;
+  bool result   = AppendIndex(make_index_record(string(path), ent), false);
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+
+  return result;
+}
+
+//
+// Remove the index record before the cache file is changed.
+//
+bool DiskCache::DelIndex(const char* path)
+{
+  bool result = true;
+
+  if(!path){
+    return false;
+  }
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  disk_cache_t::iterator iter = cache.find(string(path));
+  if(iter != cache.end() && (*iter).second.has_index){
+    (*iter).second.has_index = false;
+    (*iter).second.loaded.clear();
+    result = AppendIndex("D\t" + encode_index_path(string(path)) + "\n", true);
+  }
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+
+  return result;
+}
+
+void DiskCache::GetCounts(unsigned long* phit, unsigned long* pmiss, unsigned long* pevict) const
+{
+  pthread_mutex_lock(&DiskCache::disk_cache_lock);
+  if(phit){
+    *phit = HitCount;
+  }
+  if(pmiss){
+    *pmiss = MissCount;
+  }
+  if(pevict){
+    *pevict = EvictCount;
+  }
+  pthread_mutex_unlock(&DiskCache::disk_cache_lock);
+}
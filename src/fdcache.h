@@ -3,19 +3,94 @@
 
 #include "common.h"
 
+// A read range is downloaded in parallel only when download_chunk_size
+// is smaller than FDPAGE_SIZE.
+#define FDPAGE_SIZE    4194304     // 4MB: block size of partial(ranged) download
+
+//
+// Class for loaded page(block) status in local file
+//
+// The local file is made as sparse file which has same size as the object,
+// and the pages are downloaded by ranged GET when they are needed.
+//
+class PageList
+{
+  private:
+    off_t             Size;       // file size
+    size_t            PageSize;   // block size
+    std::vector<bool> Loaded;     // true: the block is downloaded into local file
+    std::vector<bool> Busy;       // true: the block is being downloaded or written
+    std::vector<bool> Dirty;      // true: the block is changed after the object is loaded(uploaded)
+
+  private:
+    size_t PageCount(off_t size) const {
+      return static_cast<size_t>((size + PageSize - 1) / PageSize);
+    }
+
+  public:
+    PageList(off_t size = 0, bool is_loaded = false, size_t pagesize = FDPAGE_SIZE);
+    ~PageList() {}
+
+    off_t GetSize(void) const {
+      return Size;
+    }
+    size_t GetPageSize(void) const {
+      return PageSize;
+    }
+    void Init(off_t size, bool is_loaded);
+    void Resize(off_t size, bool is_loaded = true);
+    bool IsLoaded(off_t start = 0, off_t size = -1) const;
+    bool SetLoaded(off_t start, off_t size, bool is_loaded = true);
+    bool FindUnloaded(off_t start, off_t size, off_t& ustart, off_t& usize) const;
+    bool IsBusy(off_t start, off_t size) const;
+    void SetBusy(off_t start, off_t size, bool is_busy);
+    bool IsDirty(off_t start, off_t size) const;
+    void SetDirty(off_t start, off_t size);
+    void ClearDirty(void);
+    const std::vector<bool>& GetLoadedList(void) const {
+      return Loaded;
+    }
+    bool SetLoadedList(const std::vector<bool>& loaded);
+};
+
 //
 // Struct for fuse file handle cache
 //
+// One local file is shared by all handles which open same path, and it
+// is closed when the last handle is released.
+//
+// The new file(created but not uploaded yet) does not have the object,
+// then its headers are kept here until it is uploaded with its content.
+//
 struct fd_cache_entry {
   int fd;
   int flags;
+  int refcnt;     // count of opened handles
+  bool          is_new;     // the object is not created yet
+  headers_t     newmeta;    // headers of the new object
+  unsigned long newcount;   // count up by each change of newmeta
 
-  fd_cache_entry() : fd(0), flags(0) {}
+  fd_cache_entry() : fd(0), flags(0), refcnt(0), is_new(false), newcount(0) {}
 };
 
-typedef std::map<std::string, struct fd_cache_entry> fd_cache_t; // key="pid(oct)#path"
+typedef std::map<std::string, struct fd_cache_entry> fd_cache_t; // key=path
 typedef std::map<int, int> fd_flags_t;                           // key=file discriptor
 
+//
+// Struct for file descriptor which is loaded partially
+//
+struct fd_page_entry {
+  PageList      pages;
+  time_t        mtime;         // mtime of the object(for validating local cache file)
+  std::string   etag;          // ETag of the object which is loaded
+  bool          modified;      // the local file is changed by write/truncate
+  unsigned long modify_count;  // count up by each change
+
+  fd_page_entry() : mtime(0), modified(false), modify_count(0) {}
+};
+
+typedef std::map<int, struct fd_page_entry> fd_pages_t;          // key=file discriptor
+
 //
 // Class for fuse file handle cache
 //
@@ -24,11 +99,10 @@ class FdCache
   private:
     static FdCache singleton;
     static pthread_mutex_t fd_cache_lock;
+    static pthread_cond_t  fd_cache_cond;   // broadcast when busy pages are released
     fd_cache_t fd_cache;
     fd_flags_t fd_flags;
-
-  private:
-    static bool makeKey(const char* path, std::string& strkey);
+    fd_pages_t fd_pages;
 
   public:
     FdCache();
@@ -39,12 +113,125 @@ class FdCache
       return &singleton;
     }
 
-    bool Add(const char* path, int fd, int flags);
-    bool Del(const char* path, int fd);
-    bool Del(const char* path);
-    bool Del(int fd);
+    bool Open(const char* path, int flags, int* pfd);
+    int Add(const char* path, int fd, int flags);
+    bool Close(const char* path, int fd, bool* plast, bool* pisnew = NULL, headers_t* pnewmeta = NULL);
     bool Get(const char* path, int* pfd = NULL, int* pflags = NULL) const;
     bool Get(int fd, int* pflags = NULL) const;
+
+    // For new file which object is not created yet
+    bool SetNewObject(const char* path, headers_t& meta);
+    bool GetNewObject(const char* path, headers_t* pmeta = NULL, unsigned long* pcount = NULL) const;
+    bool UpdateNewObject(const char* path, const std::string& key, const std::string& value);
+    bool ClearNewObject(const char* path, unsigned long count, headers_t* pmeta = NULL);
+    bool GetNewObjectList(const char* dir, std::list<std::string>& paths) const;
+
+    // For partial loading
+    bool SetPageList(int fd, off_t size, time_t mtime, bool is_loaded = false, const char* etag = NULL);
+    bool SetPageList(int fd, off_t size, time_t mtime, const std::vector<bool>& loaded, const char* etag);
+    bool GetPageList(int fd, std::vector<bool>& loaded, std::string& etag, unsigned long* pcount = NULL) const;
+    bool DelPageList(int fd);
+    bool HasPageList(int fd) const;
+    bool ReserveUnloadedPage(int fd, off_t start, off_t size, off_t& ustart, off_t& usize);
+    bool ReservePage(int fd, off_t start, off_t size);
+    bool ReleasePage(int fd, off_t start, off_t size, bool is_loaded);
+    bool SetLoadedPage(int fd, off_t start, off_t size);
+    bool ResizePageList(int fd, off_t size);
+    bool IsAllLoaded(int fd, time_t* pmtime = NULL) const;
+    bool SetModified(int fd);
+    bool IsModified(int fd, unsigned long* pcount = NULL) const;
+    bool ClearModified(int fd, unsigned long count, const char* etag = NULL);
+    bool SetDirtyPage(int fd, off_t start, off_t size);
+    bool IsDirtyPage(int fd, off_t start, off_t size) const;
+};
+
+//
+// Struct for local cache file in use_cache directory
+//
+typedef std::list<std::string> disk_cache_lru_t;                  // front is most recently used
+
+struct disk_cache_entry {
+  off_t                      size;      // allocated bytes of the file(sparse)
+  disk_cache_lru_t::iterator lru;
+  bool                       has_index; // following members are valid
+  std::string                etag;      // ETag of the object which is loaded
+  off_t                      objsize;
+  time_t                     atime;     // last access
+  std::vector<bool>          loaded;    // loaded pages
+
+  disk_cache_entry() : size(0), has_index(false), objsize(0), atime(0) {}
+};
+
+typedef std::map<std::string, struct disk_cache_entry> disk_cache_t; // key=path
+
+#define DISK_CACHE_LOW_WATERMARK   70   // percent of max size for stopping eviction
+#define DISK_CACHE_HIGH_WATERMARK  90   // percent of max size for starting eviction
+
+//
+// Class for local cache files
+//
+// The index of cache files is made from use_cache directory at mount,
+// and it is updated when the file is opened, loaded and released.
+// If the total size is over the high watermark, the least recently used
+// files which are not opened are removed until the total size is under
+// the low watermark.
+//
+// The ETag and loaded pages of each file are kept in the index file as
+// append-only log, then the files(and partially loaded files) are used
+// after remounting. The log is compacted at mount. A record is written
+// after the cache file is synced, and the record is removed before the
+// file is changed, so the index does not point at broken data.
+//
+class DiskCache
+{
+  private:
+    static DiskCache singleton;
+    static pthread_mutex_t disk_cache_lock;
+    std::string      CacheDir;        // use_cache/bucket
+    std::string      IndexPath;       // use_cache/.bucket.index
+    int              IndexFd;
+    off_t            MaxSize;         // 0 means no limit
+    int              LowWatermark;
+    int              HighWatermark;
+    off_t            TotalSize;
+    disk_cache_t     cache;
+    disk_cache_lru_t lru;
+    unsigned long    HitCount;
+    unsigned long    MissCount;
+    unsigned long    EvictCount;
+
+  private:
+    bool LoadDirectory(const std::string& dir, std::vector<std::pair<time_t, std::string> >& files);
+    bool LoadIndex(disk_cache_t& records);
+    bool WriteIndex(void);
+    bool AppendIndex(const std::string& line, bool is_sync);
+    void SetEntry(const std::string& path, off_t size);
+    void EvictCache(void);
+
+  public:
+    DiskCache();
+    ~DiskCache();
+
+    // Reference singleton
+    static DiskCache* getDiskCache(void) {
+      return &singleton;
+    }
+
+    off_t SetMaxSize(off_t size);
+    off_t GetMaxSize(void) const {
+      return MaxSize;
+    }
+    bool SetWatermark(int low, int high);
+
+    bool Init(const char* dir, const char* index);
+    void Hit(const char* path);
+    void Miss(const char* path);
+    bool Update(const char* path);
+    bool Remove(const char* path);
+    bool GetIndex(const char* path, std::string& etag, off_t& size, std::vector<bool>& loaded) const;
+    bool SetIndex(const char* path, const std::string& etag, off_t size, const std::vector<bool>& loaded);
+    bool DelIndex(const char* path);
+    void GetCounts(unsigned long* phit, unsigned long* pmiss, unsigned long* pevict) const;
 };
 
 #endif // FD_CACHE_H_
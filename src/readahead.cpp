@@ -0,0 +1,299 @@
+/*
+ * s3fs - FUSE-based file system backed by Amazon S3
+ *
+ * Copyright 2007-2008 Randy Rizun <rrizun@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <assert.h>
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "fdcache.h"
+#include "readahead.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------
+// Static
+//-------------------------------------------------------------------
+ReadAhead ReadAhead::singleton;
+pthread_mutex_t ReadAhead::readahead_lock;
+pthread_cond_t  ReadAhead::readahead_cond;
+
+//-------------------------------------------------------------------
+// Class ReadAhead
+//-------------------------------------------------------------------
+ReadAhead::ReadAhead() : is_running(false), is_stop(false), load_func(NULL)
+{
+  if(this == ReadAhead::getReadAhead()){
+    pthread_mutex_init(&(ReadAhead::readahead_lock), NULL);
+    pthread_cond_init(&(ReadAhead::readahead_cond), NULL);
+  }else{
+    assert(false);
+  }
+  MaxWindow = READAHEAD_MAX_WINDOW;
+  MinWindow = FDPAGE_SIZE;
+}
+
+ReadAhead::~ReadAhead()
+{
+  if(this == ReadAhead::getReadAhead()){
+    pthread_mutex_destroy(&(ReadAhead::readahead_lock));
+    pthread_cond_destroy(&(ReadAhead::readahead_cond));
+  }else{
+    assert(false);
+  }
+}
+
+off_t ReadAhead::SetMaxWindow(off_t size)
+{
+  off_t old = MaxWindow;
+  MaxWindow = size;
+  return old;
+}
+
+off_t ReadAhead::SetMinWindow(off_t size)
+{
+  off_t old = MinWindow;
+  MinWindow = size;
+  return old;
+}
+
+bool ReadAhead::Start(readahead_load_t func)
+{
+  if(is_running || !func){
+    return false;
+  }
+  if(MaxWindow < MinWindow){
+    // prefetch is disabled
+    return true;
+  }
+  load_func = func;
+  is_stop   = false;
+  for(int cnt = 0; cnt < READAHEAD_THREADS; cnt++){
+    if(0 != pthread_create(&threads[cnt], NULL, ReadAhead::Worker, this)){
+      SYSLOGERR("could not create prefetch thread.");
+      // stop threads which are already created.
+      pthread_mutex_lock(&ReadAhead::readahead_lock);
+      is_stop = true;
+      pthread_cond_broadcast(&ReadAhead::readahead_cond);
+      pthread_mutex_unlock(&ReadAhead::readahead_lock);
+      for(int cnt2 = 0; cnt2 < cnt; cnt2++){
+        pthread_join(threads[cnt2], NULL);
+      }
+      return false;
+    }
+  }
+  is_running = true;
+  return true;
+}
+
+bool ReadAhead::Stop(void)
+{
+  if(!is_running){
+    return true;
+  }
+  pthread_mutex_lock(&ReadAhead::readahead_lock);
+  is_running = false;
+  is_stop    = true;
+  tasks.clear();
+  pthread_cond_broadcast(&ReadAhead::readahead_cond);
+  pthread_mutex_unlock(&ReadAhead::readahead_lock);
+
+  for(int cnt = 0; cnt < READAHEAD_THREADS; cnt++){
+    pthread_join(threads[cnt], NULL);
+  }
+  entries.clear();
+  return true;
+}
+
+void* ReadAhead::Worker(void* arg)
+{
+  ReadAhead* pra = reinterpret_cast<ReadAhead*>(arg);
+
+  pthread_mutex_lock(&ReadAhead::readahead_lock);
+  while(true){
+    while(!pra->is_stop && pra->tasks.empty()){
+      pthread_cond_wait(&ReadAhead::readahead_cond, &ReadAhead::readahead_lock);
+    }
+    if(pra->is_stop){
+      break;
+    }
+    readahead_task task = pra->tasks.front();
+    pra->tasks.pop_front();
+
+    // the entry is not removed while it has running task.
+    readahead_entry& ent = pra->entries[task.fd];
+    string path = ent.path;
+    ent.running++;
+    pthread_mutex_unlock(&ReadAhead::readahead_lock);
+
+    int result;
+    if(0 != (result = (*(pra->load_func))(path.c_str(), task.fd, task.start, task.size))){
+      FGPRINT("    ReadAhead: failed to prefetch[path=%s][start=%zd][size=%zd]: %d\n", path.c_str(), task.start, task.size, result);
+    }
+
+    pthread_mutex_lock(&ReadAhead::readahead_lock);
+    ent.running--;
+    pthread_cond_broadcast(&ReadAhead::readahead_cond);
+  }
+  pthread_mutex_unlock(&ReadAhead::readahead_lock);
+
+  return NULL;
+}
+
+//
+// The read which starts near the end of previous read is sequential(the
+// reads from kernel may be reordered by threads). The reads which have
+// same distance between starts are strided. Others are random.
+//
+void ReadAhead::Detect(readahead_entry& ent, off_t start, off_t size)
+{
+  int pattern = READAHEAD_RANDOM;
+
+  if(0 <= ent.last_end && (ent.last_end - READAHEAD_SEQ_GAP) <= start && start <= (ent.last_end + READAHEAD_SEQ_GAP)){
+    pattern = READAHEAD_SEQUENTIAL;
+  }else if(0 <= ent.last_start && 0 < (start - ent.last_start) && ent.stride == (start - ent.last_start)){
+    pattern = READAHEAD_STRIDED;
+  }else if(0 <= ent.last_start){
+    ent.stride = start - ent.last_start;
+  }
+
+  if(pattern != ent.pattern){
+    ent.pattern = pattern;
+    ent.hits    = 0;
+  }
+  if(READAHEAD_RANDOM != pattern){
+    ent.hits++;
+  }
+  if(READAHEAD_SEQUENTIAL == pattern){
+    ent.last_end = max(ent.last_end, start + size);
+  }else{
+    ent.last_end = start + size;
+  }
+  ent.last_start = start;
+}
+
+// Queue the range by pages(need to lock), then the reader which waits for
+// the page does not wait for whole range.
+void ReadAhead::Queue(int fd, off_t start, off_t size)
+{
+  for(off_t pos = start; pos < (start + size); pos += MinWindow){
+    tasks.push_back(readahead_task(fd, pos, min(MinWindow, (start + size) - pos)));
+  }
+  pthread_cond_broadcast(&ReadAhead::readahead_cond);
+}
+
+// Remove queued tasks of fd(need to lock)
+void ReadAhead::Cancel(int fd)
+{
+  for(readahead_tasks_t::iterator iter = tasks.begin(); iter != tasks.end(); ){
+    if(iter->fd == fd){
+      iter = tasks.erase(iter);
+    }else{
+      iter++;
+    }
+  }
+}
+
+void ReadAhead::Read(const char* path, int fd, off_t start, off_t size, off_t filesize)
+{
+  if(!is_running || 0 >= size){
+    return;
+  }
+  pthread_mutex_lock(&ReadAhead::readahead_lock);
+
+  readahead_map_t::iterator iter = entries.find(fd);
+  if(entries.end() == iter){
+    iter = entries.insert(make_pair(fd, readahead_entry())).first;
+    iter->second.path   = path;
+    iter->second.window = MinWindow;
+  }
+  readahead_entry& ent = iter->second;
+  int oldpattern       = ent.pattern;
+
+  Detect(ent, start, size);
+
+  if(oldpattern != ent.pattern && READAHEAD_RANDOM != oldpattern){
+    // pattern is broken
+    FGPRINT("    ReadAhead: cancel prefetch[path=%s][fd=%d]\n", path, fd);
+    Cancel(fd);
+    ent.window = MinWindow;
+    ent.ahead  = 0;
+  }
+  if(READAHEAD_TRIGGER <= ent.hits){
+    if(READAHEAD_SEQUENTIAL == ent.pattern){
+      // prefetch next window when the reader reaches into last half of
+      // prefetched range, and grow the window.
+      if(ent.ahead < ent.last_end){
+        ent.ahead = ent.last_end;
+      }else if((ent.ahead - ent.last_end) <= (ent.window / 2)){
+        ent.window = min(ent.window * 2, MaxWindow);
+      }
+      if(ent.ahead < filesize && (ent.ahead - ent.last_end) <= (ent.window / 2)){
+        off_t qsize = min(ent.window, filesize - ent.ahead);
+        FGPRINT("    ReadAhead: sequential prefetch[path=%s][start=%zd][size=%zd]\n", path, ent.ahead, qsize);
+        Queue(fd, ent.ahead, qsize);
+        ent.ahead += qsize;
+      }
+    }else if(READAHEAD_STRIDED == ent.pattern){
+      // prefetch next blocks, the count of blocks grows with hits.
+      int count = min(ent.hits, READAHEAD_MAX_STRIDES);
+      for(int cnt = 1; cnt <= count; cnt++){
+        off_t next = start + ent.stride * cnt;
+        if(filesize <= next){
+          break;
+        }
+        if(next <= ent.ahead){
+          continue;
+        }
+        FGPRINT("    ReadAhead: strided prefetch[path=%s][start=%zd][size=%zd]\n", path, next, size);
+        Queue(fd, next, min(size, filesize - next));
+        ent.ahead = next;
+      }
+    }
+  }
+  pthread_mutex_unlock(&ReadAhead::readahead_lock);
+}
+
+void ReadAhead::Close(int fd)
+{
+  if(!is_running){
+    return;
+  }
+  pthread_mutex_lock(&ReadAhead::readahead_lock);
+  Cancel(fd);
+  readahead_map_t::iterator iter;
+  while(entries.end() != (iter = entries.find(fd)) && 0 < iter->second.running){
+    pthread_cond_wait(&ReadAhead::readahead_cond, &ReadAhead::readahead_lock);
+  }
+  if(entries.end() != iter){
+    entries.erase(iter);
+  }
+  pthread_mutex_unlock(&ReadAhead::readahead_lock);
+}
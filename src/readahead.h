@@ -0,0 +1,109 @@
+#ifndef S3FS_READAHEAD_H_
+#define S3FS_READAHEAD_H_
+
+//
+// Define
+//
+#define READAHEAD_THREADS       4                   // count of prefetch threads
+#define READAHEAD_TRIGGER       2                   // count of matched reads before prefetching
+#define READAHEAD_SEQ_GAP       (1024 * 1024)       // reads reordered in this distance are sequential
+#define READAHEAD_MAX_STRIDES   8                   // max count of blocks prefetched for strided reads
+#define READAHEAD_MAX_WINDOW    (64 * 1024 * 1024)  // default max prefetch size
+
+#define READAHEAD_RANDOM        0
+#define READAHEAD_SEQUENTIAL    1
+#define READAHEAD_STRIDED       2
+
+//
+// Typedef
+//
+// load the range of fd from the object, called in prefetch thread.
+typedef int (*readahead_load_t)(const char* path, int fd, off_t start, off_t size);
+
+//
+// Struct
+//
+// Access pattern of the opened file. The fd is shared by all handles of
+// the file, then the pattern is detected by reads of all handles.
+struct readahead_entry {
+  std::string path;
+  int   pattern;      // READAHEAD_RANDOM/SEQUENTIAL/STRIDED
+  int   hits;         // count of continuous reads which match the pattern
+  off_t last_start;   // range of previous read
+  off_t last_end;
+  off_t stride;       // distance between starts of previous reads
+  off_t window;       // prefetch size for sequential reads
+  off_t ahead;        // end of queued range(sequential), or start of last queued block(strided)
+  int   running;      // count of tasks which are loading now
+
+  readahead_entry() : pattern(READAHEAD_RANDOM), hits(0), last_start(-1), last_end(-1),
+                      stride(0), window(0), ahead(0), running(0) {}
+};
+
+struct readahead_task {
+  int   fd;
+  off_t start;
+  off_t size;
+
+  readahead_task(int nfd, off_t nstart, off_t nsize) : fd(nfd), start(nstart), size(nsize) {}
+};
+
+typedef std::map<int, readahead_entry> readahead_map_t;   // key=fd
+typedef std::list<readahead_task> readahead_tasks_t;
+
+//
+// Class ReadAhead
+//
+// Detects the access pattern(sequential, strided or random) from reads of
+// each opened file, and prefetches following blocks by threads.
+// The prefetch window for sequential reads starts from one page, and it
+// is doubled every time the reader reaches into the last half of the
+// prefetched range, up to MaxWindow. When the pattern is broken, the
+// queued prefetches for the file are canceled and the window is reset.
+//
+class ReadAhead
+{
+  private:
+    static ReadAhead singleton;
+    static pthread_mutex_t readahead_lock;
+    static pthread_cond_t  readahead_cond;   // signaled when task is queued or done
+    pthread_t         threads[READAHEAD_THREADS];
+    bool              is_running;
+    bool              is_stop;
+    off_t             MaxWindow;
+    off_t             MinWindow;
+    readahead_load_t  load_func;
+    readahead_map_t   entries;
+    readahead_tasks_t tasks;
+
+  private:
+    static void* Worker(void* arg);
+    void Detect(readahead_entry& ent, off_t start, off_t size);
+    void Queue(int fd, off_t start, off_t size);
+    void Cancel(int fd);
+
+  public:
+    ReadAhead();
+    ~ReadAhead();
+
+    // Reference singleton
+    static ReadAhead* getReadAhead(void) {
+      return &singleton;
+    }
+
+    off_t SetMaxWindow(off_t size);
+    off_t GetMaxWindow(void) const {
+      return MaxWindow;
+    }
+    off_t SetMinWindow(off_t size);
+
+    bool Start(readahead_load_t func);
+    bool Stop(void);
+
+    // Called for each read of fd, and queues prefetch if it is needed.
+    void Read(const char* path, int fd, off_t start, off_t size, off_t filesize);
+    // Cancel prefetch, and wait for loading threads before closing fd.
+    void Close(int fd);
+};
+
+#endif // S3FS_READAHEAD_H_
@@ -30,6 +30,7 @@
 #include <libxml/tree.h>
 #include <curl/curl.h>
 #include <openssl/crypto.h>
+#include <openssl/md5.h>
 #include <pwd.h>
 #include <grp.h>
 #include <getopt.h>
@@ -40,14 +41,18 @@
 #include <map>
 #include <string>
 #include <list>
+#include <set>
 
 #include "common.h"
 #include "s3fs.h"
 #include "curl.h"
+#include "curl_engine.h"
 #include "cache.h"
 #include "string_util.h"
 #include "s3fs_util.h"
 #include "fdcache.h"
+#include "readahead.h"
+#include "writeback.h"
 
 using namespace std;
 
@@ -55,6 +60,7 @@ using namespace std;
 // Define
 //-------------------------------------------------------------------
 #define	MAX_MULTI_HEADREQ   500   // max request count in readdir curl_multi.
+#define	MAX_LIST_KEYS       1000  // max-keys in one ListBucket request.
 #define	DIRTYPE_UNKNOWN    -1
 #define	DIRTYPE_NEW         0
 #define	DIRTYPE_OLD         1
@@ -75,6 +81,112 @@ struct file_part {
   file_part() : uploaded(false) {}
 };
 
+// for parallel ranged GET
+struct range_get_part {
+  off_t start;
+  off_t size;
+  struct curl_slist* headers;
+  fd_range_data range;
+  CurlRequest request;
+
+  range_get_part(int fd, off_t nstart, off_t nsize) : start(nstart), size(nsize), headers(NULL), range(fd, nstart) {}
+};
+
+// for conditional GET which writes into fd and keeps response headers
+struct cond_get_data {
+  fd_range_data range;
+  headers_t     headers;
+
+  cond_get_data(int fd) : range(fd, 0) {}
+};
+
+// for parallel multipart upload
+struct upload_part_data {
+  int    part_number;
+  int    retry;
+  bool   is_copy;       // the part is copied from the object(UploadPartCopy)
+  fd_part_data fdpart;  // the part is read from fd directly
+  struct curl_slist* headers;
+  BodyData body;
+  BodyData header;
+  CurlRequest request;
+
+  upload_part_data() : part_number(0), retry(0), is_copy(false), headers(NULL) {}
+};
+
+// for parallel moving objects in rename_directory
+struct move_object_data {
+  MVNODE* node;
+  int     retry;
+  struct curl_slist* headers;
+  BodyData body;
+  CurlRequest request;
+
+  move_object_data() : node(NULL), retry(0), headers(NULL) {}
+};
+
+// for streaming readdir, this is set into fuse_file_info by s3fs_opendir.
+// Only the objects in current page are kept.
+#define DIR_HANDLE_FIRST_OFFSET  2   // offset of first object("." and ".." are 0 and 1)
+
+struct dir_handle {
+  std::string  marker;        // marker for next page
+  bool         truncated;     // there is next page
+  off_t        page_offset;   // offset of first object in page
+  off_t        page_count;
+  s3obj_list_t page;          // object names in page
+  bool         is_listed_new; // new files which are not uploaded are listed(in last page)
+  std::set<std::string> straddle;   // names in previous pages which other forms("dir/", "dir_$folder$") may be in next pages
+  std::set<std::string> listed_new; // new files which are listed in pages(uploaded while listing)
+
+  dir_handle() { Clear(); }
+  void Clear(void) {
+    marker.erase();
+    truncated     = true;
+    page_offset   = DIR_HANDLE_FIRST_OFFSET;
+    page_count    = 0;
+    page.clear();
+    is_listed_new = false;
+    straddle.clear();
+    listed_new.clear();
+  }
+};
+
+// one page of ListBucket result which is shared with waiting threads
+struct list_page_result {
+  S3ObjList   head;
+  std::string marker;
+  bool        truncated;
+
+  list_page_result() : truncated(false) {}
+};
+
+// for parsing ListBucket result by SAX(push) parser
+struct list_bucket_parser {
+  xmlParserCtxtPtr ctxt;
+  CURL*       curl;
+  BodyData*   body;         // response body which is not 200(error)
+  const char* path;
+  S3ObjList*  head;
+  int         depth;        // element depth(ListBucketResult is 1)
+  bool        in_contents;
+  bool        in_cprefix;
+  std::string text;
+  std::string key;
+  std::string etag;
+  std::string size;
+  std::string lastmod;
+  std::string prefix;
+  std::string next_marker;
+  std::string last_key;
+  bool        truncated;
+  int         result;
+
+  list_bucket_parser(const char* npath, S3ObjList* nhead, BodyData* nbody)
+    : ctxt(NULL), curl(NULL), body(nbody), path(npath), head(nhead), depth(0),
+      in_contents(false), in_cprefix(false), truncated(false), result(0) {}
+};
+
 //-------------------------------------------------------------------
 // Global valiables
 //-------------------------------------------------------------------
@@ -110,6 +222,8 @@ static bool allow_other           = false;
 static uid_t s3fs_uid             = 0;    // default = root.
 static gid_t s3fs_gid             = 0;    // default = root.
 static bool dns_cache             = true; // default = true
+static bool sslsession_cache      = true; // default = true
+static bool list_stat             = false;
 
 // if .size()==0 then local file cache is disabled
 static std::string use_cache;
@@ -119,6 +233,9 @@ static std::string use_sse;
 // TODO(apetresc): make this an enum
 // private, public-read, public-read-write, authenticated-read
 static std::string default_acl("private");
+static int parallel_count         = 5;
+static int parallel_copy_count    = 10;
+static off_t download_chunk_size  = MULTIPART_SIZE;
 
 // mutex
 static pthread_mutex_t *mutex_buf = NULL;
@@ -129,32 +246,57 @@ static pthread_mutex_t *mutex_buf = NULL;
 static bool is_special_name_folder_object(const char *path);
 static int chk_dir_object_type(const char *path, string& newpath, string& nowpath, string& nowcache, headers_t* pmeta = NULL, int* pDirType = NULL);
 static int get_object_attribute(const char *path, struct stat *pstbuf, headers_t* pmeta = NULL, bool overcheck = true, bool* pisforce = NULL);
+static void revalidate_stat_cache(std::string& key, std::string& etag);
+static int revalidate_cache_file(std::string& strpath);
+static int get_object_conditional(const char* path, const char* etag, headers_t& meta, bool* pnotmodified);
+static size_t HeaderCondGetCallback(void* data, size_t blockSize, size_t numBlocks, void* userPtr);
 static int check_object_access(const char *path, int mask, struct stat* pstbuf);
 static int check_object_owner(const char *path, struct stat* pstbuf);
 static int check_parent_object_access(const char *path, int mask);
 static int readdir_multi_head(const char *path, S3ObjList& head);
 static int list_bucket(const char *path, S3ObjList& head, const char* delimiter);
+static int list_bucket_page(const char *path, S3ObjList& head, const char* delimiter, std::string& marker, bool& truncated, int max_keys);
+static int send_list_bucket_page(const char *path, S3ObjList& head, const char* delimiter, std::string& marker, bool& truncated, int max_keys);
 static int directory_empty(const char *path);
-static bool is_truncated(const char *xml);
-static int append_objects_from_xml_ex(const char* path, xmlDocPtr doc, xmlXPathContextPtr ctx, 
-              const char* ex_contents, const char* ex_key, const char* ex_etag, int isCPrefix, S3ObjList& head);
-static int append_objects_from_xml(const char* path, const char *xml, S3ObjList& head);
-static bool GetXmlNsUrl(xmlDocPtr doc, string& nsurl);
-static xmlChar* get_base_exp(const char* xml, const char* exp);
-static xmlChar* get_prefix(const char *xml);
-static xmlChar* get_next_marker(const char *xml);
-static char *get_object_name(xmlDocPtr doc, xmlNodePtr node, const char* path);
+static void list_parser_add_object(list_bucket_parser* parser, const char* fullpath, bool is_dir);
+static void list_parser_start_element(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI,
+                   int nb_namespaces, const xmlChar** namespaces, int nb_attributes, int nb_defaulted, const xmlChar** attributes);
+static void list_parser_end_element(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI);
+static void list_parser_characters(void* ctx, const xmlChar* ch, int len);
+static bool init_list_parser(list_bucket_parser* parser);
+static void reset_list_parser(void* data);
+static void free_list_parser(list_bucket_parser* parser);
+static size_t WriteListBucketCallback(void* ptr, size_t blockSize, size_t numBlocks, void* userp);
+static char *get_object_name(const char* fullpath, const char* path);
 
 static int put_headers(const char *path, headers_t meta, bool ow_sse_flg);
 static int put_multipart_headers(const char *path, headers_t meta, bool ow_sse_flg);
 static int put_local_fd_small_file(const char* path, headers_t meta, int fd, bool ow_sse_flg);
-static int put_local_fd_big_file(const char* path, headers_t meta, int fd, bool ow_sse_flg);
-static int put_local_fd(const char* path, headers_t meta, int fd, bool ow_sse_flg);
+static int put_local_fd_big_file(const char* path, headers_t meta, int fd, bool ow_sse_flg, const std::vector<bool>* pcopyparts = NULL);
+static int put_local_fd(const char* path, headers_t meta, int fd, bool ow_sse_flg, const std::vector<bool>* pcopyparts = NULL);
+static int upload_local_fd(const char* path, int fd, unsigned long count);
+static int flush_local_fd(const char* path, int fd);
+static int release_shared_fd(const char* path, int fd);
+static int truncate_shared_fd(const char* path, int fd, off_t size);
+static int sync_new_objects(const char* path);
+static bool chmod_new_object(const char *path, mode_t mode);
+static bool chown_new_object(const char *path, uid_t uid, gid_t gid);
+static bool utimens_new_object(const char *path, const struct timespec ts[2]);
+static int create_shared_fd(const char* path, int flags, headers_t& meta);
+static void release_dirty_fd(const char* path, int fd);
+static int save_dirty_fd(const char* path, int fd);
 static std::string initiate_multipart_upload(const char *path, off_t size, headers_t meta, bool ow_sse_flg);
 static int complete_multipart_upload(const char *path, std::string upload_id, std::vector <file_part> parts);
-static std::string upload_part(const char *path, const char *source, int part_number, string upload_id);
-static std::string copy_part(const char *from, const char *to, int part_number, std::string upload_id, headers_t meta);
+static CURL* create_upload_part_handle(const char *path, upload_part_data* part, string upload_id);
+static int abort_multipart_upload(const char *path, string upload_id);
+static CURL* create_copy_part_handle(const char *from, const char *to, upload_part_data* part, std::string upload_id, headers_t meta);
+static std::string get_copy_etag(BodyData& body);
+static int copy_multipart_parts(const char *from, const char *to, off_t size, std::string upload_id, headers_t meta, std::vector <file_part>& parts);
 static int list_multipart_uploads(void);
+static CURL* create_copy_object_handle(const char *from, const char *to, BodyData* body, struct curl_slist** pheaders);
+static int send_delete_objects(const std::list<std::string>& paths, std::list<std::string>& failed);
+static int delete_objects(const std::list<std::string>& paths);
+static int move_objects(MVNODE* head, bool nocopy);
 
 // fuse interface functions
 static int s3fs_getattr(const char *path, struct stat *stbuf);
@@ -174,9 +316,12 @@ static int s3fs_read(const char *path, char *buf, size_t size, off_t offset, str
 static int s3fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
 static int s3fs_statfs(const char *path, struct statvfs *stbuf);
 static int s3fs_flush(const char *path, struct fuse_file_info *fi);
+static int s3fs_fsync(const char *path, int datasync, struct fuse_file_info *fi);
 static int s3fs_release(const char *path, struct fuse_file_info *fi);
 static int s3fs_opendir(const char *path, struct fuse_file_info *fi);
+static void readdir_skip_listed(const std::string& strpath, dir_handle* dh);
 static int s3fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
+static int s3fs_releasedir(const char *path, struct fuse_file_info *fi);
 static int s3fs_access(const char *path, int mask);
 static int s3fs_utimens(const char *path, const struct timespec ts[2]);
 static int remote_mountpath_exists(const char *path);
@@ -326,6 +471,12 @@ static int get_object_attribute(const char *path, struct stat *pstbuf, headers_t
     return 0;
   }
 
+  // the new file which is not uploaded yet has only local headers.
+  if(FdCache::getFdCacheData()->GetNewObject(path, pheader)){
+    convert_header_to_stat(path, (*pheader), pstat);
+    return 0;
+  }
+
   // Check cache.
   strpath = path;
   if(overcheck){
@@ -338,7 +489,10 @@ static int get_object_attribute(const char *path, struct stat *pstbuf, headers_t
   if(pisforce){
     (*pisforce) = false;
   }
-  if(StatCache::getStatCacheData()->GetStat(strpath, pstat, pheader, overcheck, pisforce)){
+  // the expired entry of the file which has the cache file is revalidated
+  // with the cache file by one conditional GET.
+  revalidate_cache_file(strpath);
+  if(StatCache::getStatCacheData()->GetStat(strpath, pstat, pmeta, overcheck, pisforce)){
     return 0;
   }
   if(StatCache::getStatCacheData()->IsNoObjectCache(strpath)){
@@ -426,6 +580,33 @@ static int get_object_attribute(const char *path, struct stat *pstbuf, headers_t
   return 0;
 }
 
+//
+// Called from the revalidation threads of StatCache for the stale entry
+// or the entry which is refreshed ahead. If the object is not modified,
+// only the cache date of the entry is updated.
+//
+static void revalidate_stat_cache(string& key, string& etag)
+{
+  headers_t meta;
+  bool      notmodified = false;
+  string    s3_realpath = get_realpath(key.c_str());
+  int       result;
+
+  FGPRINT("   revalidate_stat_cache[path=%s][etag=%s]\n", key.c_str(), etag.c_str());
+
+  result = curl_get_headers(s3_realpath.c_str(), meta, (etag.empty() ? NULL : etag.c_str()), &notmodified);
+  if(0 == result){
+    if(notmodified){
+      StatCache::getStatCacheData()->TouchStat(key);
+    }else{
+      StatCache::getStatCacheData()->AddStat(key, meta);
+    }
+  }else if(-ENOENT == result){
+    StatCache::getStatCacheData()->DelStat(key);
+  }
+  // other error: the entry is left, and it is expired in time.
+}
+
 //
 // Check the object uid and gid for write/read/execute.
 // The param "mask" is as same as access() function.
@@ -448,7 +629,10 @@ static int check_object_access(const char *path, int mask, struct stat* pstbuf)
   if(NULL == (pcxt = fuse_get_context())){
     return -EIO;
   }
-  if(0 != (result = get_object_attribute(path, pst))){
+  // The headers are needed for mode and uid/gid, then the stat cache
+  // entry made from listing(which does not have them) is not used here.
+  headers_t meta;
+  if(0 != (result = get_object_attribute(path, pst, &meta))){
     // If there is not tha target file(object), reusult is -ENOENT.
     return result;
   }
@@ -516,7 +700,9 @@ static int check_object_owner(const char *path, struct stat* pstbuf)
   if(NULL == (pcxt = fuse_get_context())){
     return -EIO;
   }
-  if(0 != (result = get_object_attribute(path, pst))){
+  // need headers for uid/gid(see check_object_access)
+  headers_t meta;
+  if(0 != (result = get_object_attribute(path, pst, &meta))){
     // If there is not tha target file(object), reusult is -ENOENT.
     return result;
   }
@@ -575,39 +761,373 @@ static int check_parent_object_access(const char *path, int mask)
   return 0;
 }
 
+//
+// Make curl handle for ranged GET which writes into fd.
+// The request headers are returned by pheaders, caller must free it.
+//
+static CURL* create_range_get_handle(const char* path, fd_range_data* prange, off_t size, struct curl_slist** pheaders, const char* etag = NULL)
+{
+  CURL* curl;
+  struct curl_slist* headers = NULL;
+
+  string resource = urlEncode(service_path + bucket + get_realpath(path));
+  string url      = host + resource;
+  string date     = get_date();
+  string my_url   = prepare_url(url.c_str());
+
+  headers = curl_slist_append(headers, string("Date: " + date).c_str());
+  headers = curl_slist_append(headers, "Content-Type: ");
+  if(etag && '\0' != etag[0]){
+    headers = curl_slist_append(headers, (string("If-None-Match: ") + etag).c_str());
+  }
+  if(public_bucket.substr(0,1) != "1") {
+    headers = curl_slist_append(headers, string("Authorization: AWS " + AWSAccessKeyId + ":" +
+      calc_signature("GET", "", "", date, headers, resource)).c_str());
+  }
+
+  stringstream ss;
+  ss << prange->start << "-" << (prange->start + size - 1);
+  string strrange = ss.str();
+
+  curl               = create_curl_handle();
+  prange->curl       = curl;
+  prange->size       = size;
+  prange->offset     = -1;
+  prange->is_dropped = false;
+  curl_easy_setopt(curl, CURLOPT_RANGE, strrange.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)prange);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteFdRangeCallback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*)prange);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderFdRangeCallback);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
+
+  *pheaders = headers;
+  return curl;
+}
+
+//
+// Download the range of object into fd by ranged GET.
+//
+static int get_object_range(const char* path, int fd, off_t start, off_t size)
+{
+  int result;
+  CURL* curl;
+  struct curl_slist* headers = NULL;
+
+  if(0 >= size){
+    return 0;
+  }
+  FGPRINT("      downloading range[path=%s][fd=%d][start=%zd][size=%zd]\n", path, fd, start, size);
+  SYSLOGDBG("LOCAL FD RANGE");
+
+  fd_range_data range(fd, start);
+  curl   = create_range_get_handle(path, &range, size, &headers);
+  result = my_curl_easy_perform(curl);
+  destroy_curl_handle(curl);
+  curl_slist_free_all(headers);
+
+  if(0 == result && range.is_dropped){
+    SYSLOGERR("get_object_range: unexpected response body is dropped[path=%s][start=%zd]", path, start);
+    result = -EIO;
+  }
+  return result;
+}
+
+//
+// Revalidate the expired stat cache entry of the file which has the cache
+// file, by one conditional GET(If-None-Match with ETag in the index) for
+// the first page instead of HEAD.
+// If the object is not modified(304), the stat cache entry and the cache
+// file are still valid. If it is modified, the stat cache entry is made
+// from the response headers, and the cache file is replaced by new file
+// which has the first page of the response body.
+// Returns 0 if the stat cache entry is refreshed, otherwise the caller
+// gets the headers by HEAD as before.
+//
+static int revalidate_cache_file(string& strpath)
+{
+  int          result;
+  headers_t    meta;
+  string       etag;
+  string       idxetag;
+  off_t        idxsize = 0;
+  vector<bool> loaded;
+  struct stat  st;
+  const char*  path = strpath.c_str();
+
+  if(0 == use_cache.size() || !StatCache::getStatCacheData()->GetExpiredStat(strpath, meta)){
+    return -ENOENT;
+  }
+  if(meta.end() == meta.find("ETag") || 0 == (etag = meta["ETag"]).length()){
+    return -ENOENT;
+  }
+  if(!DiskCache::getDiskCache()->GetIndex(path, idxetag, idxsize, loaded) || idxetag != etag || 0 == idxsize){
+    return -ENOENT;
+  }
+  string cache_path(use_cache + "/" + bucket + strpath);
+  if(-1 == stat(cache_path.c_str(), &st) || st.st_size != idxsize){
+    return -ENOENT;
+  }
+  if(FdCache::getFdCacheData()->Get(path)){
+    // the opened file has own page list, do not replace it.
+    return -ENOENT;
+  }
+
+  inflight_entry* pentry;
+  string key = string("REVALIDATE:") + strpath;
+  if(!InflightRequests::getInflightRequests()->Join(key, &pentry)){
+    result = InflightRequests::getInflightRequests()->Wait(pentry);
+    InflightRequests::getInflightRequests()->Leave(pentry);
+    return result;
+  }
+
+  bool notmodified = false;
+  if(0 == (result = get_object_conditional(path, etag.c_str(), meta, &notmodified))){
+    if(notmodified){
+      StatCache::getStatCacheData()->TouchStat(strpath);
+    }else if(!StatCache::getStatCacheData()->AddStat(strpath, meta)){
+      result = -ENOENT;
+    }
+  }
+  InflightRequests::getInflightRequests()->Done(pentry, result);
+
+  return result;
+}
+
+//
+// Send GET for the first page of the object with If-None-Match, and the
+// response body is written into new file which replaces the cache file.
+// If the object is not modified, *pnotmodified is set true and meta and
+// the cache file are not changed.
+//
+static int get_object_conditional(const char* path, const char* etag, headers_t& meta, bool* pnotmodified)
+{
+  int    result;
+  int    fd;
+  CURL*  curl;
+  struct curl_slist* headers = NULL;
+  string cache_path(use_cache + "/" + bucket + path);
+  string tmp_path(cache_path + ".XXXXXX");
+
+  *pnotmodified = false;
+
+  FGPRINT("      conditional downloading[path=%s][ETag=%s]\n", path, etag);
+  SYSLOGDBG("LOCAL FD CONDITIONAL");
+
+  vector<char> tmpname(tmp_path.begin(), tmp_path.end());
+  tmpname.push_back('\0');
+  if(-1 == (fd = mkstemp(&tmpname[0]))){
+    SYSLOGERR("line %d: mkstemp: %d", __LINE__, -errno);
+    return -errno;
+  }
+  tmp_path = &tmpname[0];
+
+  cond_get_data cond(fd);
+  curl = create_range_get_handle(path, &(cond.range), FDPAGE_SIZE, &headers, etag);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*)&cond);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCondGetCallback);
+  result = my_curl_easy_perform(curl);
+
+  long responseCode = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
+  destroy_curl_handle(curl);
+  curl_slist_free_all(headers);
+
+  if(0 == result && 304 == responseCode){
+    FGPRINT("      conditional downloading: not modified[path=%s]\n", path);
+    *pnotmodified = true;
+  }else if(0 == result){
+    // object size is in Content-Range(206), or Content-Length(200)
+    // (the body of 200 is dropped if the object is larger than the range)
+    off_t  size   = -1;
+    off_t  loaded = (-1 == cond.range.offset ? 0 : cond.range.offset);
+    string range  = cond.headers["Content-Range"];
+    string::size_type pos;
+    if(206 == responseCode && string::npos != (pos = range.find('/'))){
+      size = strtoll(range.c_str() + pos + 1, NULL, 10);
+    }else if(200 == responseCode && cond.range.is_dropped && cond.headers.end() != cond.headers.find("Content-Length")){
+      size = strtoll(cond.headers["Content-Length"].c_str(), NULL, 10);
+    }else if(200 == responseCode){
+      size = loaded;
+    }
+    filter_object_headers(cond.headers, meta);
+    meta["Content-Length"] = str(size);
+
+    struct stat stobj;
+    if(0 > size || loaded > size || meta.end() == meta.find("ETag") || !convert_header_to_stat(path, meta, &stobj)){
+      result = -EIO;
+    }else if(-1 == ftruncate(fd, size) || -1 == fchmod(fd, stobj.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO)) || -1 == fsync(fd)){
+      result = -errno;
+    }else{
+      // replace the cache file, the file which is opened by other process
+      // is not changed.
+      PageList pagelist(size, false);
+      pagelist.SetLoaded(0, loaded);
+      DiskCache::getDiskCache()->DelIndex(path);
+      if(-1 == rename(tmp_path.c_str(), cache_path.c_str())){
+        result = -errno;
+      }else{
+        DiskCache::getDiskCache()->SetIndex(path, meta["ETag"], size, pagelist.GetLoadedList());
+        DiskCache::getDiskCache()->Update(path);
+      }
+    }
+    if(0 != result){
+      SYSLOGERR("conditional downloading failed[path=%s]: %d", path, result);
+      FGPRINT("      conditional downloading failed[path=%s]: %d\n", path, result);
+    }
+  }
+  close(fd);
+  if(*pnotmodified || 0 != result){
+    unlink(tmp_path.c_str());
+  }
+  return result;
+}
+
+// libcurl header callback for conditional GET
+static size_t HeaderCondGetCallback(void* data, size_t blockSize, size_t numBlocks, void* userPtr)
+{
+  cond_get_data* cond = reinterpret_cast<cond_get_data*>(userPtr);
+
+  HeaderFdRangeCallback(data, blockSize, numBlocks, &(cond->range));
+  return header_callback(data, blockSize, numBlocks, &(cond->headers));
+}
+
+//
+// Download the range of object into fd by parallel ranged GET requests.
+//
+// The range is split into download_chunk_size parts, and at most
+// parallel_count parts are sent to CurlEngine at once. Each part is
+// written into fd at its offset, and a failed part is retried by
+// CurlEngine by itself.
+//
+static int parallel_get_object(const char* path, int fd, off_t start, off_t size)
+{
+  int result = 0;
+  list<range_get_part>                    parts;    // all parts(address of element is not changed)
+  list<range_get_part>::iterator          next;
+  curl_request_list_t                     running;
+  map<CurlRequest*, range_get_part*>      partmap;
+
+  FGPRINT("      parallel downloading[path=%s][fd=%d][start=%zd][size=%zd]\n", path, fd, start, size);
+  SYSLOGDBG("LOCAL FD PARALLEL RANGE");
+
+  for(off_t pos = start; pos < (start + size); pos += download_chunk_size){
+    off_t partsize = min(download_chunk_size, (start + size) - pos);
+    parts.push_back(range_get_part(fd, pos, partsize));
+  }
+
+  for(next = parts.begin(); true; ){
+    // send parts up to parallel_count
+    for(; 0 == result && parts.end() != next && running.size() < static_cast<size_t>(parallel_count); next++){
+      CURL* curl     = create_range_get_handle(path, &(next->range), next->size, &(next->headers));
+      next->request  = CurlRequest(curl);
+      CurlEngine::getCurlEngine()->Submit(&(next->request));
+      running.push_back(&(next->request));
+      partmap[&(next->request)] = &(*next);
+    }
+
+    // wait for any part(even if error, wait for all running parts)
+    CurlRequest* request;
+    if(NULL == (request = CurlEngine::getCurlEngine()->WaitAny(running))){
+      break;
+    }
+    range_get_part* part = partmap[request];
+    int partresult       = request->GetResult();
+    if(0 == partresult && part->range.is_dropped){
+      // the response body was not written into fd
+      partresult = -EIO;
+    }
+    if(0 != partresult && 0 == result){
+      SYSLOGERR("parallel_get_object: failed part[start=%zd] result: %d", part->start, partresult);
+      FGPRINT("  parallel_get_object: failed part[start=%zd] result: %d\n", part->start, partresult);
+      result = partresult;
+    }
+    destroy_curl_handle(request->GetHandle());
+    curl_slist_free_all(part->headers);
+    part->headers = NULL;
+  }
+  return result;
+}
+
+//
+// Load the pages which are not loaded yet in the range.
+// If fd does not have page list, fd is already loaded.
+// (size = -1 means the range to EOF)
+//
+static int load_local_fd(const char* path, int fd, off_t start, off_t size)
+{
+  int   result;
+  off_t ustart;
+  off_t usize;
+  bool  is_loaded = false;
+
+  // The fd is shared by handles, so the pages which are loading by
+  // other thread are not downloaded again.
+  while(FdCache::getFdCacheData()->ReserveUnloadedPage(fd, start, size, ustart, usize)){
+    if(1 < parallel_count && download_chunk_size < usize){
+      result = parallel_get_object(path, fd, ustart, usize);
+    }else{
+      result = get_object_range(path, fd, ustart, usize);
+    }
+    FdCache::getFdCacheData()->ReleasePage(fd, ustart, usize, (0 == result));
+    if(0 != result){
+      FGPRINT("   load_local_fd - failed to download range(%d)\n", result);
+      return result;
+    }
+    is_loaded = true;
+  }
+  if(is_loaded && 0 < use_cache.size()){
+    // cache file is grown
+    DiskCache::getDiskCache()->Update(path);
+  }
+  return 0;
+}
+
 // Get fd in mapping data by path
-static int get_opened_fd(const char* path)
+// If is_load is true, all pages of fd are loaded.
+static int get_opened_fd(const char* path, bool is_load = true)
 {
   int fd = -1;
 
   if(FdCache::getFdCacheData()->Get(path, &fd)){
     FGPRINT("  get_opened_fd: found fd [path=%s] [fd=%d]\n", path, fd);
+    if(is_load && 0 <= fd && 0 != load_local_fd(path, fd, 0, -1)){
+      return -1;
+    }
   }
   return fd;
 }
 
-static int get_local_fd(const char* path) {
+//
+// Open local file for the object.
+//
+// The local file is made as same size as the object(sparse file), and
+// if is_lazy is true, the pages of the file are not downloaded here.
+// Those are downloaded by load_local_fd() when those are needed.
+// If is_lazy is false, all of the object is downloaded.
+//
+static int open_local_fd(const char* path, bool is_lazy) {
   int fd = -1;
   int result;
+  bool is_loaded = false;
+  bool is_indexed = false;
   struct stat st;
   struct stat stobj;
-  CURL *curl = NULL;
-  string url;
-  string resource;
-  string local_md5;
-  string baseName = mybasename(path);
+  headers_t meta;
+  string etag;
+  vector<bool> loaded;
   string resolved_path(use_cache + "/" + bucket);
   string cache_path(resolved_path + path);
 
-  FGPRINT("   get_local_fd[path=%s]\n", path);
+  FGPRINT("   get_local_fd[path=%s][lazy=%s]\n", path, is_lazy ? "yes" : "no");
 
-  string s3_realpath = get_realpath(path);
-  resource = urlEncode(service_path + bucket + s3_realpath);
-  url = host + resource;
-
-  if(0 != (result = get_object_attribute(path, &stobj))){
+  if(0 != (result = get_object_attribute(path, &stobj, &meta))){
     return result;
   }
+  if(meta.end() != meta.find("ETag")){
+    etag = meta["ETag"];
+  }
 
   if(use_cache.size() > 0) {
     fd = open(cache_path.c_str(), O_RDWR); // ### TODO should really somehow obey flags here
@@ -617,23 +1137,48 @@ static int get_local_fd(const char* path) {
         YIKES(-errno);
       }
 
-      // if the local and remote mtime/size
-      // do not match we have an invalid cache entry
-      if(st.st_size  != stobj.st_size || st.st_mtime != stobj.st_mtime){
+      if(0 < etag.length()){
+        // the cache file is valid when the index has same ETag, and
+        // the pages in the index are loaded.
+        string idxetag;
+        off_t  idxsize = 0;
+        if(st.st_size == stobj.st_size && DiskCache::getDiskCache()->GetIndex(path, idxetag, idxsize, loaded) &&
+           idxetag == etag && idxsize == stobj.st_size){
+          is_indexed = true;
+        }
+      }else if(st.st_size == stobj.st_size && st.st_mtime == stobj.st_mtime){
+        // if the local and remote mtime/size
+        // do not match we have an invalid cache entry
+        is_loaded = true;
+      }
+      if(!is_indexed && !is_loaded){
         if(close(fd) == -1){
           YIKES(-errno);
         }
         fd = -1;
       }
     }
+    if(S_ISREG(stobj.st_mode)){
+      if(is_indexed || is_loaded){
+        DiskCache::getDiskCache()->Hit(path);
+      }else{
+        DiskCache::getDiskCache()->Miss(path);
+      }
+    }
   }
 
-  // need to download?
+  // need to make new local file?
   if(fd == -1) {
     if(use_cache.size() > 0) {
       // only download files, not folders
       if (S_ISREG(stobj.st_mode)) {
         mkdirp(resolved_path + mydirname(path), 0777);
+        // Other process may open the invalid cache file and it may be loading
+        // the pages, so do not truncate that file but make new one.
+        DiskCache::getDiskCache()->DelIndex(path);
+        if(-1 == unlink(cache_path.c_str()) && ENOENT != errno){
+          YIKES(-errno);
+        }
         fd = open(cache_path.c_str(), O_CREAT|O_RDWR|O_TRUNC, stobj.st_mode);
       } else {
         // its a folder; do *not* create anything in local cache... 
@@ -647,70 +1192,126 @@ static int get_local_fd(const char* path) {
     if(fd == -1){
       YIKES(-errno);
     }
-    // seek to head of file.
-    if(0 != lseek(fd, 0, SEEK_SET)){
-      SYSLOGERR("line %d: lseek: %d", __LINE__, -errno);
-      FGPRINT("   get_local_fd - lseek error(%d)\n", -errno);
-      return -errno;
-    }
-
-    FILE *f = fdopen(fd, "w+");
-    if(f == 0){
+    // make sparse file as same size as the object.
+    if(-1 == ftruncate(fd, stobj.st_size)){
+      SYSLOGERR("line %d: ftruncate: %d", __LINE__, -errno);
+      FGPRINT("   get_local_fd - ftruncate error(%d)\n", -errno);
+      result = -errno;
       close(fd);
-      YIKES(-errno);
+      return result;
     }
+  }
 
-    FGPRINT("      downloading[path=%s][fd=%d]\n", path, fd);
-    SYSLOGDBG("LOCAL FD");
+  if(is_indexed){
+    FdCache::getFdCacheData()->SetPageList(fd, stobj.st_size, stobj.st_mtime, loaded, etag.c_str());
+  }else{
+    FdCache::getFdCacheData()->SetPageList(fd, stobj.st_size, stobj.st_mtime, is_loaded, etag.c_str());
+  }
 
-    auto_curl_slist headers;
-    string date = get_date();
-    string my_url = prepare_url(url.c_str());
-    headers.append("Date: " + date);
-    headers.append("Content-Type: ");
-    if(public_bucket.substr(0,1) != "1") {
-      headers.append("Authorization: AWS " + AWSAccessKeyId + ":" +
-        calc_signature("GET", "", "", date, headers.get(), resource));
+  if(!is_lazy){
+    // download all pages
+    result = load_local_fd(path, fd, 0, -1);
+    FdCache::getFdCacheData()->DelPageList(fd);
+    if(0 != result){
+      close(fd);
+      return result;
     }
 
-    curl = create_curl_handle();
-    curl_easy_setopt(curl, CURLOPT_FILE, f);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.get());
-    curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
-
-    result = my_curl_easy_perform(curl, NULL, NULL, f);
-    destroy_curl_handle(curl);
-    if(result != 0) {
-      fclose(f);
-      return -result;
-    }
-
-    // only one of these is needed...
-    fflush(f);
-    fsync(fd);
-
-    if(S_ISREG(stobj.st_mode) && !S_ISLNK(stobj.st_mode)) {
-      // make the file's mtime match that of the file on s3
-      // if fd is tmpfile, but we force tor set mtime.
-      struct timeval tv[2];
-      tv[0].tv_sec = stobj.st_mtime;
-      tv[0].tv_usec= 0L;
-      tv[1].tv_sec = tv[0].tv_sec;
-      tv[1].tv_usec= 0L;
-      if(-1 == futimes(fd, tv)){
-        fclose(f);
-        YIKES(-errno);
+    if(!is_loaded){
+      fsync(fd);
+
+      if(S_ISREG(stobj.st_mode) && !S_ISLNK(stobj.st_mode)) {
+        // make the file's mtime match that of the file on s3
+        // if fd is tmpfile, but we force tor set mtime.
+        struct timeval tv[2];
+        tv[0].tv_sec = stobj.st_mtime;
+        tv[0].tv_usec= 0L;
+        tv[1].tv_sec = tv[0].tv_sec;
+        tv[1].tv_usec= 0L;
+        if(-1 == futimes(fd, tv)){
+          result = -errno;
+          close(fd);
+          YIKES(result);
+        }
       }
     }
+  }
 
-    // seek to head of file.
-    if(0 != lseek(fd, 0, SEEK_SET)){
-      SYSLOGERR("line %d: lseek: %d", __LINE__, -errno);
-      FGPRINT("   get_local_fd - lseek error(%d)\n", -errno);
-      return -errno;
+  // seek to head of file.
+  if(0 != lseek(fd, 0, SEEK_SET)){
+    SYSLOGERR("line %d: lseek: %d", __LINE__, -errno);
+    FGPRINT("   get_local_fd - lseek error(%d)\n", -errno);
+    return -errno;
+  }
+  if(use_cache.size() > 0 && S_ISREG(stobj.st_mode)){
+    DiskCache::getDiskCache()->Update(path);
+  }
+
+  return fd;
+}
+
+//
+// If use_cache is specified, the object which is downloading into the
+// cache file by other thread is not downloaded again. After waiting for
+// it, the cache file is opened as loaded file.
+//
+static int get_local_fd(const char* path, bool is_lazy = false) {
+  if(is_lazy || 0 == use_cache.size()){
+    return open_local_fd(path, is_lazy);
+  }
+
+  int fd;
+  inflight_entry* pentry;
+  string key = string("GET:") + path;
+  if(InflightRequests::getInflightRequests()->Join(key, &pentry)){
+    fd = open_local_fd(path, is_lazy);
+    InflightRequests::getInflightRequests()->Done(pentry, (0 > fd ? fd : 0));
+  }else{
+    int result = InflightRequests::getInflightRequests()->Wait(pentry);
+    InflightRequests::getInflightRequests()->Leave(pentry);
+    if(0 != result){
+      return result;
     }
+    fd = open_local_fd(path, is_lazy);
   }
+  return fd;
+}
 
+//
+// Open the local file for fuse handle. All handles which open same path
+// share one local file(and its loaded pages), so the object is opened
+// by only one thread at the same time.
+//
+static int open_shared_fd(const char* path, int flags)
+{
+  int fd = -1;
+  int result;
+  inflight_entry* pentry;
+  string key = string("OPEN:") + path;
+
+  while(!FdCache::getFdCacheData()->Open(path, flags, &fd)){
+    if(InflightRequests::getInflightRequests()->Join(key, &pentry)){
+      if(0 < (fd = get_local_fd(path, true))){
+        int newfd = FdCache::getFdCacheData()->Add(path, fd, flags);
+        if(newfd != fd){
+          // other thread has opened it already
+          close(fd);
+          fd = newfd;
+        }
+      }
+      InflightRequests::getInflightRequests()->Done(pentry, (0 < fd ? 0 : -EIO));
+      break;
+    }
+    result = InflightRequests::getInflightRequests()->Wait(pentry);
+    InflightRequests::getInflightRequests()->Leave(pentry);
+    if(0 != result){
+      return result;
+    }
+  }
+  // the cache file may be changed, so its index is removed.
+  if(0 < fd && O_RDONLY != (flags & O_ACCMODE) && 0 < use_cache.size()){
+    DiskCache::getDiskCache()->DelIndex(path);
+  }
   return fd;
 }
 
@@ -800,7 +1401,7 @@ static int put_headers(const char *path, headers_t meta, bool ow_sse_flg)
   // Update mtime in local file cache.
   int fd;
   time_t mtime = get_mtime(meta);
-  if(0 <= (fd = get_opened_fd(path))){
+  if(0 <= (fd = get_opened_fd(path, false))){
     // The file already is opened, so update fd before close(flush);
     struct timeval tv[2];
     memset(tv, 0, sizeof(struct timeval) * 2);
@@ -853,26 +1454,10 @@ static int put_multipart_headers(const char *path, headers_t meta, bool ow_sse_f
     return(-EIO);
   }
 
-  off_t chunk = 0;
-  off_t bytes_written = 0;
-  off_t bytes_remaining = buf.st_size;
-  while(bytes_remaining > 0) {
-    file_part part;
-
-    if(bytes_remaining > MAX_COPY_SOURCE_SIZE)
-      chunk = MAX_COPY_SOURCE_SIZE;
-    else
-      chunk = bytes_remaining - 1;
-
-    stringstream ss;
-    ss << "bytes=" << bytes_written << "-" << (bytes_written + chunk);
-    meta["x-amz-copy-source-range"] = ss.str();
-
-    part.etag = copy_part(path, path, parts.size() + 1, upload_id, meta);
-    parts.push_back(part);
-
-    bytes_written += (chunk + 1);
-    bytes_remaining = buf.st_size - bytes_written;
+  // meta has "x-amz-copy-source" of this object.
+  if(0 != (result = copy_multipart_parts(path, path, buf.st_size, upload_id, meta, parts))){
+    abort_multipart_upload(path, upload_id);
+    return result;
   }
 
   result = complete_multipart_upload(path, upload_id, parts);
@@ -986,19 +1571,36 @@ static int put_local_fd_small_file(const char* path, headers_t meta, int fd, boo
   return 0;
 }
 
-static int put_local_fd_big_file(const char* path, headers_t meta, int fd, bool ow_sse_flg)
+static void reset_upload_part(void* data)
+{
+  static_cast<fd_part_data*>(data)->Reset();
+}
+
+//
+// Upload the file by multipart upload.
+//
+// The file is split into MULTIPART_SIZE parts, and at most parallel_count
+// parts are sent to CurlEngine at once. A failed part is retried by
+// CurlEngine, and a part which ETag does not match its md5 is sent again
+// up to "retries" times. The parts are completed in order of the part
+// number.
+// If pcopyparts is specified, the parts which are true in it are not
+// changed from the object(meta), and those are copied from the object by
+// UploadPartCopy instead of uploading. The copies are done only when the
+// object is not changed from meta(x-amz-copy-source-if-match).
+//
+static int put_local_fd_big_file(const char* path, headers_t meta, int fd, bool ow_sse_flg, const vector<bool>* pcopyparts)
 {
   struct stat st;
-  off_t lSize;
-  int partfd = -1;
-  FILE* pSourceFile;
-  FILE* pPartFile;
-  char *buffer;
-  unsigned long lBufferSize = 0;
-  size_t bytesRead;
-  size_t bytesWritten;
-  string uploadId;
-  vector <file_part> parts;
+  int       result = 0;
+  string    uploadId;
+  vector<upload_part_data>              partdata;
+  vector<file_part>                     parts;
+  list<upload_part_data*>               waitlist;  // parts which are not sent
+  curl_request_list_t                   running;
+  map<CurlRequest*, upload_part_data*>  partmap;
+  headers_t copymeta;
+  size_t    copycount = 0;
 
   FGPRINT("   put_local_fd_big_file[path=%s][fd=%d]\n", path, fd);
 
@@ -1011,110 +1613,99 @@ static int put_local_fd_big_file(const char* path, headers_t meta, int fd, bool
     return(-EIO);
   }
 
-  // Open the source file
-  pSourceFile = fdopen(fd, "rb");
-  if(pSourceFile == NULL) {
-    SYSLOGERR("%d###result=%d", __LINE__, errno);
-    return(-errno);
-  }
-
-  // Source sucessfully opened, obtain file size:
-  lSize = st.st_size;
-
-  lBufferSize = 0;
- 
-  // cycle through open fd, pulling off 10MB chunks at a time
-  while(lSize > 0) {
-    file_part part;
-    size_t totalSize;
-
-    if(lSize >= MULTIPART_SIZE){
-       lBufferSize = MULTIPART_SIZE;
-    }else{
-       lBufferSize = lSize;
-    }
-    lSize = lSize - lBufferSize;
-      
-    if((buffer = (char *) malloc(sizeof(char) * lBufferSize)) == NULL) {
-      SYSLOGCRIT("Could not allocate memory for buffer\n");
-      S3FS_FUSE_EXIT();
-      return -ENOMEM;
-    }
-
-    // copy the file portion into the buffer:
-    for(totalSize = 0; totalSize < lBufferSize; totalSize += bytesRead){
-      bytesRead = fread(&buffer[totalSize], 1, (lBufferSize - totalSize), pSourceFile);
-      if(bytesRead != (lBufferSize - totalSize)){
-        int nError;
-        if(0 != (nError = ferror(pSourceFile))){
-          SYSLOGERR("%d ### read file error(%d): bytesRead:%zu does not match (lBufferSize - totalSize): %lu\n",
-                      __LINE__, nError, bytesRead, (lBufferSize - totalSize));
-          if(buffer){
-            free(buffer);
-          }
-          return(-EIO);
-        }
-        if(feof(pSourceFile)){
-          SYSLOGERR("%d ### read end of file: bytesRead:%zu does not match (lBufferSize - totalSize): %lu\n",
-                      __LINE__, bytesRead, (lBufferSize - totalSize));
-          if(buffer){
-            free(buffer);
-          }
-          return(-EIO);
-        }
-      }
-    }
-
-    // create uniq temporary file
-    strncpy(part.path, "/tmp/s3fs.XXXXXX", sizeof part.path);
-    if((partfd = mkstemp(part.path)) == -1) {
-      if(buffer){
-        free(buffer);
+  // make part list
+  partdata.resize((st.st_size + MULTIPART_SIZE - 1) / MULTIPART_SIZE);
+  parts.resize(partdata.size());
+  for(size_t cnt = 0; cnt < partdata.size(); cnt++){
+    off_t start = cnt * static_cast<off_t>(MULTIPART_SIZE);
+    partdata[cnt].part_number = cnt + 1;
+    partdata[cnt].fdpart      = fd_part_data(fd, start, min(static_cast<off_t>(MULTIPART_SIZE), st.st_size - start));
+    partdata[cnt].is_copy     = (pcopyparts && cnt < pcopyparts->size() && (*pcopyparts)[cnt]);
+    if(partdata[cnt].is_copy){
+      copycount++;
+    }
+    waitlist.push_back(&partdata[cnt]);
+    partmap[&(partdata[cnt].request)] = &partdata[cnt];
+  }
+  if(0 < copycount){
+    FGPRINT("   put_local_fd_big_file: copy %zu of %zu parts from the object\n", copycount, partdata.size());
+    copymeta["x-amz-copy-source"] = urlEncode("/" + bucket + get_realpath(path));
+    if(meta.end() != meta.find("ETag")){
+      copymeta["x-amz-copy-source-if-match"] = meta["ETag"];
+    }
+  }
+
+  while(true){
+    // send parts up to parallel_count
+    while(0 == result && 0 < waitlist.size() && running.size() < static_cast<size_t>(parallel_count)){
+      upload_part_data* part = waitlist.front();
+      waitlist.pop_front();
+
+      CURL* curl;
+      if(part->is_copy){
+        stringstream ss;
+        ss << "bytes=" << part->fdpart.start << "-" << (part->fdpart.start + part->fdpart.size - 1);
+        copymeta["x-amz-copy-source-range"] = ss.str();
+        curl          = create_copy_part_handle(path, path, part, uploadId, copymeta);
+        part->request = CurlRequest(curl, &(part->body), &(part->header));
+      }else{
+        curl          = create_upload_part_handle(path, part, uploadId);
+        part->request = CurlRequest(curl, &(part->body), &(part->header));
+        part->request.SetResetCallback(reset_upload_part, &(part->fdpart));
       }
-      YIKES(-errno);
-    }
-
-    // open a temporary file for upload
-    if((pPartFile = fdopen(partfd, "wb")) == NULL) {
-      SYSLOGERR("%d ### Could not open temporary file: errno %i\n", __LINE__, errno);
-      close(partfd);
-      if(buffer){
-        free(buffer);
+      CurlEngine::getCurlEngine()->Submit(&(part->request));
+      running.push_back(&(part->request));
+    }
+
+    // wait for any part(even if error, wait for all running parts)
+    CurlRequest* request;
+    if(NULL == (request = CurlEngine::getCurlEngine()->WaitAny(running))){
+      break;
+    }
+    upload_part_data* part = partmap[request];
+    int partresult         = request->GetResult();
+
+    if(0 == partresult && part->is_copy){
+      // the copy may fail after 200 response, then the body does not have ETag.
+      string etag = get_copy_etag(part->body);
+      if(!etag.empty()){
+        parts[part->part_number - 1].etag     = etag;
+        parts[part->part_number - 1].uploaded = true;
+      }else if(part->retry++ < retries){
+        SYSLOGERR("put_local_fd_big_file: could not copy part[%d], retrying.", part->part_number);
+        waitlist.push_back(part);
+      }else{
+        partresult = -EIO;
       }
-      return(-errno);
-    }
-
-    // copy buffer to temporary file
-    for(totalSize = 0; totalSize < lBufferSize; totalSize += bytesWritten){
-      bytesWritten = fwrite(&buffer[totalSize], 1, (size_t)(lBufferSize - totalSize), pPartFile);
-      if(bytesWritten != (lBufferSize - totalSize)){
-        int nError;
-        if(0 != (nError = ferror(pPartFile))){
-          SYSLOGERR("%d ### write file error(%d): bytesWritten:%zu  does not match (lBufferSize - totalSize): %lu\n", 
-                      __LINE__, nError, bytesWritten, (lBufferSize - totalSize));
-          fclose(pPartFile);
-          if(buffer){
-            free(buffer);
-          }
-          return(-EIO);
-        }
+    }else if(0 == partresult){
+      // if the md5sum of sent data matches the header ETag value, the upload was successful.
+      string md5 = GetFdPartMD5(&(part->fdpart));
+      if(!md5.empty() && strstr(part->header.str(), md5.c_str())){
+        parts[part->part_number - 1].etag     = md5;
+        parts[part->part_number - 1].uploaded = true;
+      }else if(part->retry++ < retries){
+        SYSLOGERR("put_local_fd_big_file: ETag of part[%d] does not match, retrying.", part->part_number);
+        waitlist.push_back(part);
+      }else{
+        partresult = -EIO;
       }
     }
-
-    fclose(pPartFile);
-    if(buffer){
-      free(buffer);  
-    }
-    part.etag = upload_part(path, part.path, parts.size() + 1, uploadId);
-
-    // delete temporary part file
-    if(remove(part.path) != 0){
-      YIKES(-errno);
+    if(0 != partresult && 0 == result){
+      SYSLOGERR("put_local_fd_big_file: failed part[%d] result: %d", part->part_number, partresult);
+      FGPRINT("  put_local_fd_big_file: failed part[%d] result: %d\n", part->part_number, partresult);
+      result = partresult;
     }
+    destroy_curl_handle(request->GetHandle());
+    curl_slist_free_all(part->headers);
+    part->headers = NULL;
+    part->body.Clear();
+    part->header.Clear();
+  }
 
-    parts.push_back(part);
-  } // while(lSize > 0)
-
+  if(0 != result){
+    abort_multipart_upload(path, uploadId);
+    return result;
+  }
   return complete_multipart_upload(path, uploadId, parts);
 }
 
@@ -1122,7 +1713,7 @@ static int put_local_fd_big_file(const char* path, headers_t meta, int fd, bool
  * create or update s3 object
  * @return fuse return code
  */
-static int put_local_fd(const char* path, headers_t meta, int fd, bool ow_sse_flg)
+static int put_local_fd(const char* path, headers_t meta, int fd, bool ow_sse_flg, const vector<bool>* pcopyparts)
 {
   int result;
   struct stat st;
@@ -1164,7 +1755,7 @@ static int put_local_fd(const char* path, headers_t meta, int fd, bool ow_sse_fl
      if(readwrite_timeout < 120){
        readwrite_timeout = 120;
      }
-     result = put_local_fd_big_file(path, meta, fd, ow_sse_flg); 
+     result = put_local_fd_big_file(path, meta, fd, ow_sse_flg, pcopyparts); 
   } else {
      result = put_local_fd_small_file(path, meta, fd, ow_sse_flg); 
   }
@@ -1399,27 +1990,24 @@ static int complete_multipart_upload(const char *path, string upload_id,
   return result;
 }
 
-static string upload_part(const char *path, const char *source, int part_number, string upload_id)
+//
+// Make curl handle for uploading the part of multipart upload.
+// The request headers are set into part, caller must free it.
+//
+static CURL* create_upload_part_handle(const char *path, upload_part_data* part, string upload_id)
 {
-  int fd;
   CURL *curl = NULL;
-  FILE *part_file;
-  int result;
   string url;
   string my_url;
   string auth;
   string resource;
   string date;
   string raw_date;
-  string ETag;
   string s3_realpath;
-  struct stat st;
-  BodyData body;
-  BodyData header;
   struct curl_slist *slist = NULL;
 
   // Now upload the file as the nth part
-  FGPRINT("      multipart upload [path=%s][part=%d]\n", path, part_number);
+  FGPRINT("      multipart upload [path=%s][part=%d]\n", path, part->part_number);
 
   // PUT /ObjectName?partNumber=PartNumber&uploadId=UploadId HTTP/1.1
   // Host: BucketName.s3.amazonaws.com
@@ -1434,36 +2022,29 @@ static string upload_part(const char *path, const char *source, int part_number,
   // Content-MD5: pUNXr/BjKK5G2UKvaRRrOA==
   // Authorization: AWS VGhpcyBtZXNzYWdlIHNpZ25lZGGieSRlbHZpbmc=
 
-  part_file = fopen(source, "rb");
-  if(part_file == NULL) {
-    SYSLOGERR("%d###result=%d", __LINE__, errno); \
-    return "";
-  }
-
-  if(fstat(fileno(part_file), &st) == -1) {
-    fclose(part_file);
-    SYSLOGERR("%d###result=%d", __LINE__, errno); \
-    return "";
-  }
-
   s3_realpath = get_realpath(path);
   resource = urlEncode(service_path + bucket + s3_realpath);
 
   resource.append("?partNumber=");
-  resource.append(IntToStr(part_number));
+  resource.append(IntToStr(part->part_number));
   resource.append("&uploadId=");
   resource.append(upload_id);
   url = host + resource;
   my_url = prepare_url(url.c_str());
 
+  part->fdpart.Reset();
+
   curl = create_curl_handle();
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&body);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&(part->body));
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&header);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&(part->header));
   curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteMemoryCallback);
   curl_easy_setopt(curl, CURLOPT_UPLOAD, true); // HTTP PUT
-  curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(st.st_size)); // Content-Length
-  curl_easy_setopt(curl, CURLOPT_INFILE, part_file);
+  curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(part->fdpart.size)); // Content-Length
+  curl_easy_setopt(curl, CURLOPT_READFUNCTION, ReadFdPartCallback);
+  curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&(part->fdpart));
+  curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, SeekFdPartCallback);
+  curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void *)&(part->fdpart));
 
   date.assign("Date: ");
   raw_date = get_date();
@@ -1482,63 +2063,92 @@ static string upload_part(const char *path, const char *source, int part_number,
   curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
   curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
 
-  result = my_curl_easy_perform(curl, &body, &header, part_file);
-  curl_slist_free_all(slist);
-  destroy_curl_handle(curl);
-  fclose(part_file);
+  part->headers = slist;
+  return curl;
+}
 
-  if(result != 0) {
-    return "";
-  }
+//
+// Abort multipart upload, then the uploaded parts are removed.
+//
+static int abort_multipart_upload(const char *path, string upload_id)
+{
+  CURL *curl = NULL;
+  int result;
+  string url;
+  string my_url;
+  string resource;
+  string date;
+  string raw_date;
+  string auth;
+  BodyData body;
+  struct curl_slist *slist = NULL;
 
-  // calculate local md5sum, if it matches the header
-  // ETag value, the upload was successful.
-  if((fd = open(source, O_RDONLY)) == -1) {
-    SYSLOGERR("%d###result=%d", __LINE__, -fd);
-    return "";
-  }
+  FGPRINT("      abort_multipart_upload [path=%s][upload_id=%s]\n", path, upload_id.c_str());
 
-  string md5 = md5sum(fd);
-  close(fd);
-  if(!md5.empty() && strstr(header.str(), md5.c_str())) {
-    ETag.assign(md5);
-  } else {
-    return "";
+  resource = urlEncode(service_path + bucket + get_realpath(path));
+  resource.append("?uploadId=");
+  resource.append(upload_id);
+  url = host + resource;
+  my_url = prepare_url(url.c_str());
+
+  curl = create_curl_handle();
+  curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&body);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+
+  date.assign("Date: ");
+  raw_date = get_date();
+  date.append(raw_date);
+  slist = curl_slist_append(slist, date.c_str());
+  if(public_bucket.substr(0,1) != "1") {
+    auth.assign("Authorization: AWS ");
+    auth.append(AWSAccessKeyId);
+    auth.append(":");
+    auth.append(calc_signature("DELETE", "", "", raw_date, slist, resource));
+    slist = curl_slist_append(slist, auth.c_str());
   }
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+  curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
 
-  return ETag;
+  result = my_curl_easy_perform(curl, &body);
+
+  curl_slist_free_all(slist);
+  destroy_curl_handle(curl);
+
+  return result;
 }
 
-static string copy_part(const char *from, const char *to, int part_number, string upload_id, headers_t meta)
+//
+// Make curl handle for copying the range of object as the part of
+// multipart upload(UploadPartCopy). The source and range are set in meta
+// by "x-amz-copy-source" and "x-amz-copy-source-range".
+// The request headers are set into part, caller must free it.
+//
+static CURL* create_copy_part_handle(const char *from, const char *to, upload_part_data* part, string upload_id, headers_t meta)
 {
   CURL *curl = NULL;
-  int result;
   string url;
   string my_url;
-  string auth;
   string resource;
-  string raw_date;
-  string ETag;
   string s3_realpath;
-  BodyData body;
-  BodyData header;
+  string date;
+  struct curl_slist *slist = NULL;
 
   // Now copy the file as the nth part
-  FGPRINT("copy_part [from=%s] [to=%s]\n", from, to);
+  FGPRINT("copy_part [from=%s] [to=%s] [part=%d]\n", from, to, part->part_number);
 
   s3_realpath = get_realpath(to);
   resource = urlEncode(service_path + bucket + s3_realpath);
 
   resource.append("?partNumber=");
-  resource.append(IntToStr(part_number));
+  resource.append(IntToStr(part->part_number));
   resource.append("&uploadId=");
   resource.append(upload_id);
   url = host + resource;
   my_url = prepare_url(url.c_str());
 
-  auto_curl_slist headers;
-  string date = get_date();
-  headers.append("Date: " + date);
+  date = get_date();
+  slist = curl_slist_append(slist, ("Date: " + date).c_str());
 
   string ContentType = meta["Content-Type"];
   meta["x-amz-acl"] = default_acl;
@@ -1547,47 +2157,153 @@ static string copy_part(const char *from, const char *to, int part_number, strin
     string key = (*iter).first;
     string value = (*iter).second;
     if(key == "Content-Type"){
-      headers.append(key + ":" + value);
+      slist = curl_slist_append(slist, (key + ":" + value).c_str());
     }else if(key == "x-amz-copy-source"){
-      headers.append(key + ":" + value);
+      slist = curl_slist_append(slist, (key + ":" + value).c_str());
     }else if(key == "x-amz-copy-source-range"){
-      headers.append(key + ":" + value);
+      slist = curl_slist_append(slist, (key + ":" + value).c_str());
+    }else if(key == "x-amz-copy-source-if-match"){
+      slist = curl_slist_append(slist, (key + ":" + value).c_str());
     }
   }
 
   if(use_rrs.substr(0,1) == "1"){
-    headers.append("x-amz-storage-class:REDUCED_REDUNDANCY");
+    slist = curl_slist_append(slist, "x-amz-storage-class:REDUCED_REDUNDANCY");
   }
   if(public_bucket.substr(0,1) != "1"){
-    headers.append("Authorization: AWS " + AWSAccessKeyId + ":" +
-      calc_signature("PUT", "", ContentType, date, headers.get(), resource));
+    slist = curl_slist_append(slist, ("Authorization: AWS " + AWSAccessKeyId + ":" +
+      calc_signature("PUT", "", ContentType, date, slist, resource)).c_str());
   }
 
   curl = create_curl_handle();
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&body);
-  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&header);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&(part->body));
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&(part->header));
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
   curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteMemoryCallback);
   curl_easy_setopt(curl, CURLOPT_UPLOAD, true); // HTTP PUT
   curl_easy_setopt(curl, CURLOPT_INFILESIZE, 0); // Content-Length
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.get());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
   curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
 
-  result = my_curl_easy_perform(curl, &body, &header);
-  destroy_curl_handle(curl);
-  if(result != 0) {
-    return "";
-  }
+  part->headers = slist;
+  return curl;
+}
 
-  char* body_data = (char*)body.str();
-  char* start_etag= strstr(body_data, "ETag");
-  char* end_etag  = strstr(body_data, "/ETag>");
-  start_etag += 11;
-  ETag.assign(start_etag, (size_t)(end_etag - start_etag - 7));
+//
+// Get ETag from the response body of UploadPartCopy or PUT copy, returns
+// empty string if the body does not have it(ex. error response with 200).
+//
+static string get_copy_etag(BodyData& body)
+{
+  string ETag;
+  const char* body_data = body.str();
+  const char* start_etag;
+  const char* end_etag;
 
+  if(!body_data || NULL == (start_etag = strstr(body_data, "<ETag>")) || NULL == (end_etag = strstr(start_etag, "</ETag>"))){
+    return ETag;
+  }
+  start_etag += strlen("<ETag>");
+  ETag.assign(start_etag, (size_t)(end_etag - start_etag));
+
+  // strip quotes("&quot;" or '"')
+  if(0 == ETag.compare(0, 6, "&quot;")){
+    ETag.erase(0, 6);
+  }else if(0 == ETag.compare(0, 1, "\"")){
+    ETag.erase(0, 1);
+  }
+  if(6 <= ETag.length() && 0 == ETag.compare(ETag.length() - 6, 6, "&quot;")){
+    ETag.erase(ETag.length() - 6);
+  }else if(1 <= ETag.length() && '"' == ETag[ETag.length() - 1]){
+    ETag.erase(ETag.length() - 1);
+  }
   return ETag;
 }
 
+//
+// Copy the object(from) as the parts of multipart upload(to) by
+// UploadPartCopy.
+//
+// The object is split into MAX_COPY_SOURCE_SIZE parts, and at most
+// parallel_copy_count parts are sent to CurlEngine at once. A part which
+// fails(or does not have ETag in 200 response) is copied again by itself
+// up to "retries" times. The copy source is set in meta by
+// "x-amz-copy-source", and the ETags are set into parts in order of the
+// part number.
+//
+static int copy_multipart_parts(const char *from, const char *to, off_t size, string upload_id, headers_t meta, vector<file_part>& parts)
+{
+  int       result = 0;
+  vector<upload_part_data>              partdata;
+  list<upload_part_data*>               waitlist;  // parts which are not sent
+  curl_request_list_t                   running;
+  map<CurlRequest*, upload_part_data*>  partmap;
+
+  FGPRINT("   copy_multipart_parts[from=%s][to=%s][size=%zd]\n", from, to, size);
+
+  // make part list
+  partdata.resize((size + MAX_COPY_SOURCE_SIZE - 1) / MAX_COPY_SOURCE_SIZE);
+  parts.clear();
+  parts.resize(partdata.size());
+  for(size_t cnt = 0; cnt < partdata.size(); cnt++){
+    off_t start = cnt * static_cast<off_t>(MAX_COPY_SOURCE_SIZE);
+    partdata[cnt].part_number = cnt + 1;
+    partdata[cnt].is_copy     = true;
+    partdata[cnt].fdpart      = fd_part_data(-1, start, min(static_cast<off_t>(MAX_COPY_SOURCE_SIZE), size - start));
+    waitlist.push_back(&partdata[cnt]);
+    partmap[&(partdata[cnt].request)] = &partdata[cnt];
+  }
+
+  while(true){
+    // send parts up to parallel_copy_count
+    while(0 == result && 0 < waitlist.size() && running.size() < static_cast<size_t>(parallel_copy_count)){
+      upload_part_data* part = waitlist.front();
+      waitlist.pop_front();
+
+      stringstream ss;
+      ss << "bytes=" << part->fdpart.start << "-" << (part->fdpart.start + part->fdpart.size - 1);
+      meta["x-amz-copy-source-range"] = ss.str();
+
+      CURL* curl    = create_copy_part_handle(from, to, part, upload_id, meta);
+      part->request = CurlRequest(curl, &(part->body), &(part->header));
+      CurlEngine::getCurlEngine()->Submit(&(part->request));
+      running.push_back(&(part->request));
+    }
+
+    // wait for any part(even if error, wait for all running parts)
+    CurlRequest* request;
+    if(NULL == (request = CurlEngine::getCurlEngine()->WaitAny(running))){
+      break;
+    }
+    upload_part_data* part = partmap[request];
+    int partresult         = request->GetResult();
+    string etag;
+
+    // the copy may fail after 200 response, then the body does not have ETag.
+    if(0 == partresult && (etag = get_copy_etag(part->body)).empty()){
+      partresult = -EIO;
+    }
+    if(0 == partresult){
+      parts[part->part_number - 1].etag     = etag;
+      parts[part->part_number - 1].uploaded = true;
+    }else if(-EIO == partresult && 0 == result && part->retry++ < retries){
+      // retry only this part, the other parts are not affected.
+      SYSLOGERR("copy_multipart_parts: could not copy part[%d], retrying.", part->part_number);
+      waitlist.push_back(part);
+    }else if(0 == result){
+      SYSLOGERR("copy_multipart_parts: failed part[%d] result: %d", part->part_number, partresult);
+      FGPRINT("  copy_multipart_parts: failed part[%d] result: %d\n", part->part_number, partresult);
+      result = partresult;
+    }
+    destroy_curl_handle(request->GetHandle());
+    curl_slist_free_all(part->headers);
+    part->headers = NULL;
+    part->body.Clear();
+    part->header.Clear();
+  }
+  return result;
+}
+
 //
 // List Multipart Uploads for bucket
 //
@@ -1656,10 +2372,15 @@ static int s3fs_getattr(const char *path, struct stat *stbuf)
   }
   // If has already opened fd, the st_size shuld be instead.
   // (See: Issue 241)
+  // The mtime of modified(or dirty) file is also local file's.
   if(stbuf && FdCache::getFdCacheData()->Get(path, &fd) && -1 != fd){
     struct stat tmpstbuf;
     if(0 == fstat(fd, &tmpstbuf)){
       stbuf->st_size = tmpstbuf.st_size;
+      if(FdCache::getFdCacheData()->IsModified(fd)){
+        stbuf->st_mtime  = tmpstbuf.st_mtime;
+        stbuf->st_blocks = get_blocks(tmpstbuf.st_size);
+      }
     }
   }
   return result;
@@ -1709,53 +2430,44 @@ static int s3fs_readlink(const char *path, char *buf, size_t size) {
 }
 
 // common function for creation of a plain object
-static int create_file_object(const char *path, mode_t mode, uid_t uid, gid_t gid) {
-  int result;
-  string s3_realpath;
-  CURL *curl = NULL;
-
-  FGPRINT("   create_file_object[path=%s][mode=%d]\n", path, mode);
+//
+// Make the local file for new file, the object is not created here. It is
+// made by uploading the file at flush with the headers in meta, and the
+// headers may be changed by chmod/chown/utimens until uploading.
+//
+static int create_shared_fd(const char* path, int flags, headers_t& meta)
+{
+  int fd;
 
-  s3_realpath = get_realpath(path);
-  string resource = urlEncode(service_path + bucket + s3_realpath);
-  string url = host + resource;
+  FGPRINT("   create_shared_fd[path=%s][flags=%d]\n", path, flags);
 
-  string date = get_date();
-  string my_url = prepare_url(url.c_str());
-  auto_curl_slist headers;
-  headers.append("Date: " + date);
-  string contentType(lookupMimeType(path));
-  headers.append("Content-Type: " + contentType);
-  // x-amz headers: (a) alphabetical order and (b) no spaces after colon
-  headers.append("x-amz-acl:" + default_acl);
-  headers.append("x-amz-meta-gid:" + str(gid));
-  headers.append("x-amz-meta-mode:" + str(mode));
-  headers.append("x-amz-meta-mtime:" + str(time(NULL)));
-  headers.append("x-amz-meta-uid:" + str(uid));
-  if(use_rrs.substr(0,1) == "1"){
-    headers.append("x-amz-storage-class:REDUCED_REDUNDANCY");
-  }
-  if(use_sse.substr(0,1) == "1"){
-    headers.append("x-amz-server-side-encryption:AES256");
+  if(use_cache.size() > 0){
+    string resolved_path(use_cache + "/" + bucket);
+    string cache_path(resolved_path + path);
+    mkdirp(resolved_path + mydirname(path), 0777);
+    DiskCache::getDiskCache()->DelIndex(path);
+    if(-1 == unlink(cache_path.c_str()) && ENOENT != errno){
+      YIKES(-errno);
+    }
+    fd = open(cache_path.c_str(), O_CREAT|O_RDWR|O_TRUNC, get_mode(meta));
+  }else{
+    fd = fileno(tmpfile());
   }
-  if(public_bucket.substr(0,1) != "1"){
-    headers.append("Authorization: AWS " + AWSAccessKeyId + ":" +
-      calc_signature("PUT", "", contentType, date, headers.get(), resource));
+  if(fd == -1){
+    YIKES(-errno);
   }
 
-  curl = create_curl_handle();
-  curl_easy_setopt(curl, CURLOPT_UPLOAD, true); // HTTP PUT
-  curl_easy_setopt(curl, CURLOPT_INFILESIZE, 0); // Content-Length: 0
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.get());
-  curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
-
-  result = my_curl_easy_perform(curl);
-  destroy_curl_handle(curl);
-
-  if(result != 0)
-    return result;
+  int newfd = FdCache::getFdCacheData()->Add(path, fd, flags);
+  if(newfd != fd){
+    // other thread has opened it already
+    close(fd);
+    return newfd;
+  }
+  FdCache::getFdCacheData()->SetPageList(fd, 0, get_mtime(meta), true);
+  FdCache::getFdCacheData()->SetModified(fd);
+  FdCache::getFdCacheData()->SetNewObject(path, meta);
 
-  return 0;
+  return fd;
 }
 
 static int s3fs_mknod(const char *path, mode_t mode, dev_t rdev)
@@ -1790,31 +2502,36 @@ static int s3fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
   }else if(0 != result){
     return result;
   }
-  result = create_file_object(path, mode, pcxt->uid, pcxt->gid);
-  StatCache::getStatCacheData()->DelStat(path);
-  if(result != 0){
-    return result;
-  }
+  meta["Content-Type"]     = lookupMimeType(path);
+  meta["Content-Length"]   = "0";
+  meta["x-amz-meta-gid"]   = str(pcxt->gid);
+  meta["x-amz-meta-mode"]  = str(mode);
+  meta["x-amz-meta-mtime"] = str(time(NULL));
+  meta["x-amz-meta-uid"]   = str(pcxt->uid);
 
-  // object created, open it
-  if((fi->fh = get_local_fd(path)) <= 0){
+  // the object is created by uploading at flush.
+  int fd;
+  if(0 >= (fd = create_shared_fd(path, fi->flags, meta))){
     return -EIO;
   }
-  // remember flags and headers...
-  FdCache::getFdCacheData()->Add(path, fi->fh, fi->flags);
+  StatCache::getStatCacheData()->DelStat(path);
+  fi->fh = fd;
 
   return 0;
 }
 
-static int create_directory_object(const char *path, mode_t mode, time_t time, uid_t uid, gid_t gid)
+//
+// Make curl handle for creating the directory object("dir/").
+// The request headers are set into *pheaders, caller must free it.
+//
+static CURL* create_directory_object_handle(const char *path, mode_t mode, time_t time, uid_t uid, gid_t gid, struct curl_slist** pheaders)
 {
   CURL *curl = NULL;
-  int result;
   string s3_realpath;
   string url;
   string resource;
   string date = get_date();
-  auto_curl_slist headers;
+  struct curl_slist *slist = NULL;
 
   FGPRINT(" create_directory_object[path=%s][mode=%d][time=%lu][uid=%d][gid=%d]\n", path, mode, time, uid, gid);
 
@@ -1829,37 +2546,44 @@ static int create_directory_object(const char *path, mode_t mode, time_t time, u
   curl_easy_setopt(curl, CURLOPT_UPLOAD, true); // HTTP PUT
   curl_easy_setopt(curl, CURLOPT_INFILESIZE, 0); // Content-Length: 0
 
-  headers.append("Date: " + date);
-  headers.append("Content-Type: application/x-directory");
+  slist = curl_slist_append(slist, ("Date: " + date).c_str());
+  slist = curl_slist_append(slist, "Content-Type: application/x-directory");
   // x-amz headers: (a) alphabetical order and (b) no spaces after colon
-  headers.append("x-amz-acl:" + default_acl);
-  headers.append("x-amz-meta-gid:" + str(gid));
-  headers.append("x-amz-meta-mode:" + str(mode));
-  headers.append("x-amz-meta-mtime:" + str(time));
-  headers.append("x-amz-meta-uid:" + str(uid));
+  slist = curl_slist_append(slist, ("x-amz-acl:" + default_acl).c_str());
+  slist = curl_slist_append(slist, ("x-amz-meta-gid:" + str(gid)).c_str());
+  slist = curl_slist_append(slist, ("x-amz-meta-mode:" + str(mode)).c_str());
+  slist = curl_slist_append(slist, ("x-amz-meta-mtime:" + str(time)).c_str());
+  slist = curl_slist_append(slist, ("x-amz-meta-uid:" + str(uid)).c_str());
   if(use_rrs.substr(0,1) == "1"){
-    headers.append("x-amz-storage-class:REDUCED_REDUNDANCY");
+    slist = curl_slist_append(slist, "x-amz-storage-class:REDUCED_REDUNDANCY");
   }
   if(use_sse.substr(0,1) == "1"){
-    headers.append("x-amz-server-side-encryption:AES256");
+    slist = curl_slist_append(slist, "x-amz-server-side-encryption:AES256");
   }
   if (public_bucket.substr(0,1) != "1") {
-    headers.append("Authorization: AWS " + AWSAccessKeyId + ":" +
-      calc_signature("PUT", "", "application/x-directory", date, headers.get(), resource));
+    slist = curl_slist_append(slist, ("Authorization: AWS " + AWSAccessKeyId + ":" +
+      calc_signature("PUT", "", "application/x-directory", date, slist, resource)).c_str());
   }
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.get());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
 
   string my_url = prepare_url(url.c_str());
   curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
 
+  *pheaders = slist;
+  return curl;
+}
+
+static int create_directory_object(const char *path, mode_t mode, time_t time, uid_t uid, gid_t gid)
+{
+  int result;
+  struct curl_slist *slist = NULL;
+
+  CURL* curl = create_directory_object_handle(path, mode, time, uid, gid, &slist);
   result = my_curl_easy_perform(curl);
- 
   destroy_curl_handle(curl);
+  curl_slist_free_all(slist);
 
-  if(result != 0)
-    return result;
-
-  return 0;
+  return result;
 }
 
 static int s3fs_mkdir(const char *path, mode_t mode)
@@ -1899,6 +2623,22 @@ static int s3fs_unlink(const char *path) {
     return result;
   }
 
+  // the dirty file is not uploaded
+  WriteBack::getWriteBack()->Remove(path);
+
+  // the new file which is not uploaded yet does not have the object, and
+  // it is not uploaded after this.
+  int fd;
+  unsigned long count = 0;
+  if(FdCache::getFdCacheData()->GetNewObject(path) && FdCache::getFdCacheData()->Get(path, &fd)){
+    FdCache::getFdCacheData()->ClearNewObject(path, 0);
+    if(FdCache::getFdCacheData()->IsModified(fd, &count)){
+      FdCache::getFdCacheData()->ClearModified(fd, count);
+    }
+    StatCache::getStatCacheData()->DelStat(path);
+    return 0;
+  }
+
   s3_realpath = get_realpath(path);
   result = curl_delete(s3_realpath.c_str());
   StatCache::getStatCacheData()->DelStat(path);
@@ -1909,8 +2649,11 @@ static int s3fs_unlink(const char *path) {
 static int directory_empty(const char *path) {
   int result;
   S3ObjList head;
+  string marker;
+  bool truncated;
 
-  if((result = list_bucket(path, head, "/")) != 0){
+  // one page of two keys is enough, since the listing can include "path/" object.
+  if((result = list_bucket_page(path, head, "/", marker, truncated, 2)) != 0){
     FGPRINT(" directory_empty - list_bucket returns error.\n");
     return result;
   }
@@ -2153,26 +2896,9 @@ static int rename_large_object(const char *from, const char *to) {
   if(upload_id.size() == 0)
     return(-EIO);
 
-  off_t chunk = 0;
-  off_t bytes_written = 0;
-  off_t bytes_remaining = buf.st_size;
-  while(bytes_remaining > 0) {
-    file_part part;
-
-    if(bytes_remaining > MAX_COPY_SOURCE_SIZE)
-      chunk = MAX_COPY_SOURCE_SIZE;
-    else
-      chunk = bytes_remaining - 1;
-
-    stringstream ss;
-    ss << "bytes=" << bytes_written << "-" << (bytes_written + chunk);
-    meta["x-amz-copy-source-range"] = ss.str();
-
-    part.etag = copy_part(from, to, parts.size() + 1, upload_id, meta);
-    parts.push_back(part);
-
-    bytes_written += (chunk + 1);
-    bytes_remaining = buf.st_size - bytes_written;
+  if(0 != (result = copy_multipart_parts(from, to, buf.st_size, upload_id, meta, parts))){
+    abort_multipart_upload(to, upload_id);
+    return result;
   }
 
   result = complete_multipart_upload(to, upload_id, parts);
@@ -2184,28 +2910,306 @@ static int rename_large_object(const char *from, const char *to) {
   return s3fs_unlink(from);
 }
 
-static int clone_directory_object(const char *from, const char *to)
+//
+// Make curl handle for copying the object in the server(PUT copy).
+// The metadata of the object is copied as it is(metadata directive is
+// COPY), then the object headers are not needed.
+// The request headers are set into *pheaders, caller must free it.
+//
+static CURL* create_copy_object_handle(const char *from, const char *to, BodyData* body, struct curl_slist** pheaders)
 {
-  int result = -1;
-  struct stat stbuf;
+  CURL *curl = NULL;
+  string url;
+  string resource;
+  string date = get_date();
+  struct curl_slist *slist = NULL;
+
+  FGPRINT("      copying [from=%s][to=%s]\n", from, to);
+
+  resource = urlEncode(service_path + bucket + get_realpath(to));
+  url = host + resource;
+
+  // x-amz headers: (a) alphabetical order and (b) no spaces after colon
+  slist = curl_slist_append(slist, ("Date: " + date).c_str());
+  slist = curl_slist_append(slist, ("x-amz-acl:" + default_acl).c_str());
+  slist = curl_slist_append(slist, ("x-amz-copy-source:" + urlEncode("/" + bucket + get_realpath(from))).c_str());
+  slist = curl_slist_append(slist, "x-amz-metadata-directive:COPY");
+  if(use_sse.substr(0,1) == "1"){
+    slist = curl_slist_append(slist, "x-amz-server-side-encryption:AES256");
+  }
+  if(use_rrs.substr(0,1) == "1"){
+    slist = curl_slist_append(slist, "x-amz-storage-class:REDUCED_REDUNDANCY");
+  }
+  if(public_bucket.substr(0,1) != "1"){
+    slist = curl_slist_append(slist, ("Authorization: AWS " + AWSAccessKeyId + ":" +
+      calc_signature("PUT", "", "", date, slist, resource)).c_str());
+  }
+
+  curl = create_curl_handle();
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)body);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+  curl_easy_setopt(curl, CURLOPT_UPLOAD, true); // HTTP PUT
+  curl_easy_setopt(curl, CURLOPT_INFILESIZE, 0); // Content-Length
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+
+  string my_url = prepare_url(url.c_str());
+  curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
+
+  *pheaders = slist;
+  return curl;
+}
+
+//
+// Send Multi-Object Delete request for paths(at most MAX_DELETE_OBJECTS).
+// The paths which could not be deleted are set into failed.
+//
+static int send_delete_objects(const list<string>& paths, list<string>& failed)
+{
+  CURL *curl = NULL;
+  int result;
+  string url;
+  string resource;
+  string date = get_date();
+  string postContent;
+  string strMD5;
+  BodyData body;
+  struct WriteThis pooh;
+  struct curl_slist *slist = NULL;
+  map<string, string> keymap;   // key -> path
+
+  FGPRINT("      send_delete_objects [count=%zu]\n", paths.size());
+
+  // Quiet mode, the response has only the keys which are not deleted.
+  postContent = "<Delete><Quiet>true</Quiet>";
+  for(list<string>::const_iterator iter = paths.begin(); paths.end() != iter; ++iter){
+    string   key     = get_realpath(iter->c_str()).substr(1);
+    xmlChar* escaped = xmlEncodeSpecialChars(NULL, reinterpret_cast<const xmlChar*>(key.c_str()));
+    postContent.append("<Object><Key>");
+    postContent.append(reinterpret_cast<const char*>(escaped));
+    postContent.append("</Key></Object>");
+    xmlFree(escaped);
+    keymap[key] = *iter;
+  }
+  postContent.append("</Delete>");
+  strMD5 = GetContentMD5(postContent);
+
+  pooh.readptr  = postContent.c_str();
+  pooh.sizeleft = postContent.size();
+
+  resource = urlEncode(service_path + bucket + "/");
+  resource.append("?delete");
+  url = host + resource;
+
+  curl = create_curl_handle();
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&body);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+  curl_easy_setopt(curl, CURLOPT_POST, true);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (curl_off_t)pooh.sizeleft);
+  curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+  curl_easy_setopt(curl, CURLOPT_READDATA, &pooh);
 
-  FGPRINT("clone_directory_object [from=%s] [to=%s]\n", from, to);
-  SYSLOGDBG("clone_directory_object [from=%s] [to=%s]", from, to);
+  slist = curl_slist_append(slist, ("Date: " + date).c_str());
+  slist = curl_slist_append(slist, ("Content-MD5: " + strMD5).c_str());
+  slist = curl_slist_append(slist, "Accept:");
+  slist = curl_slist_append(slist, "Content-Type:");
+  if(public_bucket.substr(0,1) != "1"){
+    slist = curl_slist_append(slist, ("Authorization: AWS " + AWSAccessKeyId + ":" +
+      calc_signature("POST", strMD5, "", date, slist, resource)).c_str());
+  }
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+
+  string my_url = prepare_url(url.c_str());
+  curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
+
+  result = my_curl_easy_perform(curl, &body);
 
-  // get target's attributes
-  if(0 != (result = get_object_attribute(from, &stbuf))){
+  curl_slist_free_all(slist);
+  destroy_curl_handle(curl);
+
+  if(result != 0){
     return result;
   }
-  result = create_directory_object(to, stbuf.st_mode, stbuf.st_mtime, stbuf.st_uid, stbuf.st_gid);
-  StatCache::getStatCacheData()->DelStat(to);
 
+  // Parse XML body for the keys in Error elements
+  xmlDocPtr doc = xmlReadMemory(body.str(), body.size(), "", NULL, 0);
+  if(doc == NULL){
+    return -EIO;
+  }
+  if(doc->children != NULL){
+    for(xmlNodePtr err_node = doc->children->children; err_node != NULL; err_node = err_node->next){
+      if(err_node->type != XML_ELEMENT_NODE || 0 != strcmp(reinterpret_cast<const char*>(err_node->name), "Error")){
+        continue;
+      }
+      for(xmlNodePtr cur_node = err_node->children; cur_node != NULL; cur_node = cur_node->next){
+        if(cur_node->type == XML_ELEMENT_NODE && 0 == strcmp(reinterpret_cast<const char*>(cur_node->name), "Key") &&
+           cur_node->children != NULL && cur_node->children->type == XML_TEXT_NODE){
+          string key = reinterpret_cast<const char *>(cur_node->children->content);
+          failed.push_back(keymap.end() != keymap.find(key) ? keymap[key] : "/" + key);
+        }
+      }
+    }
+  }
+  xmlFreeDoc(doc);
+
+  return 0;
+}
+
+//
+// Delete the objects of paths by Multi-Object Delete requests. The paths
+// which are not deleted by it(or the request fails) are deleted by DELETE
+// request one by one.
+//
+static int delete_objects(const list<string>& paths)
+{
+  int result = 0;
+  list<string>::const_iterator iter = paths.begin();
+
+  while(paths.end() != iter){
+    list<string> keys;
+    list<string> failed;
+    for(; paths.end() != iter && keys.size() < MAX_DELETE_OBJECTS; ++iter){
+      keys.push_back(*iter);
+    }
+    if(0 != send_delete_objects(keys, failed)){
+      SYSLOGERR("delete_objects: Multi-Object Delete failed, deleting %zu objects one by one.", keys.size());
+      failed = keys;
+    }
+    for(list<string>::iterator fiter = failed.begin(); failed.end() != fiter; ++fiter){
+      int delresult = curl_delete(get_realpath(fiter->c_str()).c_str());
+      if(0 != delresult && 0 == result){
+        FGPRINT("  delete_objects: failed to delete %s: %d\n", fiter->c_str(), delresult);
+        SYSLOGERR("delete_objects: failed to delete %s: %d", fiter->c_str(), delresult);
+        result = delresult;
+      }
+    }
+    for(list<string>::iterator kiter = keys.begin(); keys.end() != kiter; ++kiter){
+      StatCache::getStatCacheData()->DelStat(kiter->c_str());
+    }
+  }
+  return result;
+}
+
+//
+// Move the objects in the list(for rename_directory).
+//
+// The directory objects are made and the files are copied in the server
+// by CurlEngine, at most parallel_copy_count requests at once, and a
+// failed request is retried by itself up to "retries" times. The source
+// files which are copied are deleted by Multi-Object Delete every
+// MAX_DELETE_OBJECTS files while copying others, and also when the move
+// fails. Then the moves which are done are not sent again when rename is
+// retried.
+// If nocopy is true, the files are not copied here.
+//
+static int move_objects(MVNODE* head, bool nocopy)
+{
+  int result = 0;
+  vector<move_object_data>               movedata;
+  list<move_object_data*>                waitlist;  // objects which are not sent
+  curl_request_list_t                    running;
+  map<CurlRequest*, move_object_data*>   movemap;
+  list<string>                           deletelist;  // copied source files
+  MVNODE* mn_cur;
+
+  // make object list
+  size_t count = 0;
+  for(mn_cur = head; mn_cur; mn_cur = mn_cur->next){
+    if(mn_cur->is_dir ? (mn_cur->old_path && '\0' != mn_cur->old_path[0]) : !nocopy){
+      count++;
+    }
+  }
+  movedata.resize(count);
+  count = 0;
+  for(mn_cur = head; mn_cur; mn_cur = mn_cur->next){
+    if(mn_cur->is_dir ? (mn_cur->old_path && '\0' != mn_cur->old_path[0]) : !nocopy){
+      movedata[count].node = mn_cur;
+      waitlist.push_back(&movedata[count]);
+      movemap[&(movedata[count].request)] = &movedata[count];
+      count++;
+    }
+  }
+  FGPRINT(" move_objects[count=%zu]\n", count);
+
+  while(true){
+    // send requests up to parallel_copy_count
+    while(0 == result && 0 < waitlist.size() && running.size() < static_cast<size_t>(parallel_copy_count)){
+      move_object_data* pmove = waitlist.front();
+      waitlist.pop_front();
+
+      CURL* curl;
+      if(pmove->node->is_dir){
+        // clone directory object with the attributes of old one.
+        struct stat stbuf;
+        if(0 != (result = get_object_attribute(pmove->node->old_path, &stbuf))){
+          FGPRINT(" move_objects - failed(%d) to get %s object attribute.\n", result, pmove->node->old_path);
+          break;
+        }
+        curl = create_directory_object_handle(pmove->node->new_path, stbuf.st_mode, stbuf.st_mtime, stbuf.st_uid, stbuf.st_gid, &(pmove->headers));
+      }else{
+        curl = create_copy_object_handle(pmove->node->old_path, pmove->node->new_path, &(pmove->body), &(pmove->headers));
+      }
+      pmove->request = CurlRequest(curl, &(pmove->body));
+      CurlEngine::getCurlEngine()->Submit(&(pmove->request));
+      running.push_back(&(pmove->request));
+    }
+
+    // wait for any request(even if error, wait for all running requests)
+    CurlRequest* request;
+    if(NULL == (request = CurlEngine::getCurlEngine()->WaitAny(running))){
+      break;
+    }
+    move_object_data* pmove = movemap[request];
+    int moveresult          = request->GetResult();
+
+    // the copy may fail after 200 response, then the body does not have ETag.
+    if(0 == moveresult && !pmove->node->is_dir && get_copy_etag(pmove->body).empty()){
+      moveresult = -EIO;
+    }
+    if(0 == moveresult){
+      StatCache::getStatCacheData()->DelStat(pmove->node->new_path);
+      if(!pmove->node->is_dir){
+        deletelist.push_back(string(pmove->node->old_path));
+      }
+    }else if(-EIO == moveresult && 0 == result && pmove->retry++ < retries){
+      // retry only this object, the other objects are not affected.
+      SYSLOGERR("move_objects: could not move %s, retrying.", pmove->node->old_path);
+      waitlist.push_back(pmove);
+    }else if(0 == result){
+      FGPRINT(" move_objects - failed(%d) to move %s to %s.\n", moveresult, pmove->node->old_path, pmove->node->new_path);
+      SYSLOGERR("move_objects: failed(%d) to move %s to %s", moveresult, pmove->node->old_path, pmove->node->new_path);
+      result = moveresult;
+    }
+    destroy_curl_handle(request->GetHandle());
+    curl_slist_free_all(pmove->headers);
+    pmove->headers = NULL;
+    pmove->body.Clear();
+
+    // delete copied files while copying others.
+    if(MAX_DELETE_OBJECTS <= deletelist.size()){
+      int delresult = delete_objects(deletelist);
+      if(0 != delresult && 0 == result){
+        result = delresult;
+      }
+      deletelist.clear();
+    }
+  }
+
+  // the copied files are deleted even if others failed.
+  if(0 < deletelist.size()){
+    int delresult = delete_objects(deletelist);
+    if(0 != delresult && 0 == result){
+      result = delresult;
+    }
+  }
   return result;
 }
 
 static int rename_directory(const char *from, const char *to)
 {
   S3ObjList head;
+  S3ObjList checklist;
   s3obj_list_t headlist;
+  s3obj_list_t largelist;               // files which need multipart copy
   string strfrom  = from ? from : "";	// from is without "/".
   string strto    = to ? to : "";	// to is without "/" too.
   string basepath = strfrom + "/";
@@ -2219,6 +3223,7 @@ static int rename_directory(const char *from, const char *to)
   struct stat stbuf;
   int result;
   bool is_dir;
+  bool nocopy = (nocopyapi || norenameapi);
 
   FGPRINT("rename_directory[from=%s][to=%s]\n", from, to);
   SYSLOGDBG("rename_directory [from=%s] [to=%s]", from, to);
@@ -2248,17 +3253,55 @@ static int rename_directory(const char *from, const char *to)
   // (CommonPrefixes is empty, but all object is listed in Key.)
   if(0 != (result = list_bucket(basepath.c_str(), head, NULL))){
     FGPRINT(" rename_directory list_bucket returns error.\n");
+    free_mvnodes(mn_head);
     return result; 
   }
   head.GetNameList(headlist);                       // get name without "/".
   S3ObjList::MakeHierarchizedList(headlist, false); // add hierarchized dir.
 
+  // The file which has data is known from the listing, and the directory
+  // which does not have object is known from its children. Others(the
+  // directory objects and empty files) are checked by HEAD requests in
+  // parallel at first.
   s3obj_list_t::const_iterator liter;
+  for(liter = headlist.begin(); headlist.end() != liter; liter++){
+    string dirname = (*liter) + "/";
+    string orgname;
+    off_t  size;
+    time_t mtime;
+    if(0 < (orgname = head.GetOrgName(dirname.c_str())).length()){
+      checklist.insert(orgname.c_str(), NULL, true);
+    }else if(0 < (orgname = head.GetOrgName((*liter).c_str())).length() && !(head.GetListStat((*liter).c_str(), size, mtime) && 0 < size)){
+      string etag = head.GetETag((*liter).c_str());
+      checklist.insert(orgname.c_str(), (0 < etag.length() ? etag.c_str() : NULL), false);
+    }
+  }
+  readdir_multi_head(basepath.c_str(), checklist);
+
   for(liter = headlist.begin(); headlist.end() != liter; liter++){
     // make "from" and "to" object name.
     string from_name = basepath + (*liter);
     string to_name   = strto + (*liter);
     string etag      = head.GetETag((*liter).c_str());
+    string dirname   = (*liter) + "/";
+    off_t  size;
+    time_t mtime;
+
+    if(0 == head.GetOrgName((*liter).c_str()).length() && 0 == head.GetOrgName(dirname.c_str()).length()){
+      // directory which does not have object, it is not listed again.
+      headers_t meta;
+      string    strpath = from_name + "/";
+      StatCache::getStatCacheData()->AddStat(strpath, meta, true);
+    }else if(0 == head.GetOrgName(dirname.c_str()).length() && head.GetListStat((*liter).c_str(), size, mtime) && 0 < size){
+      // file which has data.
+      if(FIVE_GB <= size){
+        largelist.push_back(*liter);
+      }else if(NULL == add_mvnode(&mn_head, &mn_tail, from_name.c_str(), to_name.c_str(), false, false)){
+        free_mvnodes(mn_head);
+        return -ENOMEM;
+      }
+      continue;
+    }
 
     // Check subdirectory.
     StatCache::getStatCacheData()->HasStat(from_name, etag.c_str()); // Check ETag
@@ -2285,6 +3328,7 @@ static int rename_directory(const char *from, const char *to)
     
     // push this one onto the stack
     if(NULL == add_mvnode(&mn_head, &mn_tail, from_name.c_str(), to_name.c_str(), is_dir, normdir)){
+      free_mvnodes(mn_head);
       return -ENOMEM;
     }
   }
@@ -2292,57 +3336,94 @@ static int rename_directory(const char *from, const char *to)
   //
   // rename
   //
-  // rename directory objects.
-  for(mn_cur = mn_head; mn_cur; mn_cur = mn_cur->next){
-    if(mn_cur->is_dir && mn_cur->old_path && '\0' != mn_cur->old_path[0]){
-      if(0 != (result = clone_directory_object(mn_cur->old_path, mn_cur->new_path))){
-        FGPRINT(" rename_directory - failed(%d) to rename %s directory object to %s.\n", result, mn_cur->old_path, mn_cur->new_path);
-        SYSLOGERR("clone_directory_object returned an error(%d)", result);
-        free_mvnodes(mn_head);
-        return -EIO;
-      }
-    }
+  // make directory objects and copy the files in parallel, the copied
+  // files are deleted while copying.
+  if(0 != (result = move_objects(mn_head, nocopy))){
+    FGPRINT(" rename_directory - failed(%d) to move objects.\n", result);
+    SYSLOGERR("move_objects returned an error(%d)", result);
+    free_mvnodes(mn_head);
+    return -EIO;
   }
 
-  // iterate over the list - copy the files with rename_object
-  // does a safe copy - copies first and then deletes old
-  for(mn_cur = mn_head; mn_cur; mn_cur = mn_cur->next){
+  // the files which can not be copied by PUT copy.
+  for(mn_cur = mn_head; nocopy && mn_cur; mn_cur = mn_cur->next){
     if(!mn_cur->is_dir){
-      if(!nocopyapi && !norenameapi){
-        result = rename_object(mn_cur->old_path, mn_cur->new_path);
-      }else{
-        result = rename_object_nocopy(mn_cur->old_path, mn_cur->new_path);
-      }
-      if(0 != result){
+      if(0 != (result = rename_object_nocopy(mn_cur->old_path, mn_cur->new_path))){
         FGPRINT(" rename_directory - failed(%d) to rename %s object to %s.\n", result, mn_cur->old_path, mn_cur->new_path);
-        SYSLOGERR("rename_object returned an error(%d)", result);
+        SYSLOGERR("rename_object_nocopy returned an error(%d)", result);
         free_mvnodes(mn_head);
         return -EIO;
       }
     }
   }
+  for(liter = largelist.begin(); largelist.end() != liter; liter++){
+    string from_name = basepath + (*liter);
+    string to_name   = strto + (*liter);
+    if(0 != (result = (nocopy ? rename_object_nocopy(from_name.c_str(), to_name.c_str()) : rename_large_object(from_name.c_str(), to_name.c_str())))){
+      FGPRINT(" rename_directory - failed(%d) to rename %s object to %s.\n", result, from_name.c_str(), to_name.c_str());
+      SYSLOGERR("rename_large_object returned an error(%d)", result);
+      free_mvnodes(mn_head);
+      return -EIO;
+    }
+  }
 
-  // Iterate over old the directories, bottoms up and remove
+  // Remove old directory objects at once. All objects under those are
+  // moved, then the directories are not listed again to check empty.
+  list<string> dirlist;
   for(mn_cur = mn_tail; mn_cur; mn_cur = mn_cur->prev){
     if(mn_cur->is_dir && mn_cur->old_path && '\0' != mn_cur->old_path[0]){
       if(!(mn_cur->is_normdir)){
-        if(0 != (result = s3fs_rmdir(mn_cur->old_path))){
-          FGPRINT(" rename_directory - failed(%d) to remove %s directory object.\n", result, mn_cur->old_path);
-          SYSLOGERR("s3fs_rmdir returned an error(%d)", result);
-          free_mvnodes(mn_head);
-          return -EIO;
+        // "dir/", "dir"(old version) and "_$folder$" objects like s3fs_rmdir.
+        string strpath = mn_cur->old_path;
+        string::size_type pos;
+        if(string::npos != (pos = strpath.find("_$folder$", 0))){
+          strpath = strpath.substr(0, pos);
+        }else if(1 < strpath.length() && '/' == strpath[strpath.length() - 1]){
+          strpath = strpath.substr(0, strpath.length() - 1);
         }
-      }else{
-        // cache clear.
-        StatCache::getStatCacheData()->DelStat(mn_cur->old_path);
+        dirlist.push_back(strpath + "/");
+        if(0 == get_object_attribute(strpath.c_str(), &stbuf, NULL, false) && S_ISDIR(stbuf.st_mode)){
+          dirlist.push_back(strpath);
+        }
+        dirlist.push_back(strpath + "_$folder$");
       }
+      // cache clear.
+      StatCache::getStatCacheData()->DelStat(mn_cur->old_path);
     }
   }
   free_mvnodes(mn_head);
 
+  if(0 != (result = delete_objects(dirlist))){
+    FGPRINT(" rename_directory - failed(%d) to remove directory objects.\n", result);
+    SYSLOGERR("delete_objects returned an error(%d)", result);
+    return -EIO;
+  }
   return 0;
 }
 
+//
+// Upload the new files(path or files under path) which are not uploaded
+// yet, then those have the objects.
+//
+static int sync_new_objects(const char* path)
+{
+  int result = 0;
+  list<string> paths;
+
+  if(FdCache::getFdCacheData()->GetNewObject(path)){
+    paths.push_back(string(path));
+  }
+  FdCache::getFdCacheData()->GetNewObjectList(path, paths);
+
+  for(list<string>::iterator iter = paths.begin(); paths.end() != iter; ++iter){
+    int fd;
+    if(FdCache::getFdCacheData()->Get(iter->c_str(), &fd) && 0 != (result = flush_local_fd(iter->c_str(), fd))){
+      break;
+    }
+  }
+  return result;
+}
+
 static int s3fs_rename(const char *from, const char *to) {
   struct stat buf;
   int result;
@@ -2358,6 +3439,16 @@ static int s3fs_rename(const char *from, const char *to) {
     // not permmit removing "from" object parent dir.
     return result;
   }
+  // upload the dirty files which are renamed, and discard overwritten file.
+  if(0 != (result = WriteBack::getWriteBack()->Sync(from)) ||
+     0 != (result = WriteBack::getWriteBack()->SyncDir(from))){
+    return result;
+  }
+  WriteBack::getWriteBack()->Remove(to);
+  if(0 != (result = sync_new_objects(from))){
+    return result;
+  }
+
   if(0 != (result = get_object_attribute(from, &buf, NULL))){
     return result;
   }
@@ -2383,6 +3474,48 @@ static int s3fs_link(const char *from, const char *to)
   return -EPERM;
 }
 
+//
+// Change the headers of the new file which is not uploaded yet, those are
+// uploaded with its content. These return false if path is not new file.
+//
+static bool chmod_new_object(const char *path, mode_t mode)
+{
+  return FdCache::getFdCacheData()->UpdateNewObject(path, "x-amz-meta-mode", str(mode));
+}
+
+static bool chown_new_object(const char *path, uid_t uid, gid_t gid)
+{
+  if(!FdCache::getFdCacheData()->GetNewObject(path)){
+    return false;
+  }
+  if((uid_t)(-1) != uid && !FdCache::getFdCacheData()->UpdateNewObject(path, "x-amz-meta-uid", str(uid))){
+    return false;
+  }
+  if((gid_t)(-1) != gid && !FdCache::getFdCacheData()->UpdateNewObject(path, "x-amz-meta-gid", str(gid))){
+    return false;
+  }
+  return true;
+}
+
+// The mtime of local file is also changed, because it is uploaded as
+// x-amz-meta-mtime.
+static bool utimens_new_object(const char *path, const struct timespec ts[2])
+{
+  int fd;
+  if(!FdCache::getFdCacheData()->UpdateNewObject(path, "x-amz-meta-mtime", str(ts[1].tv_sec))){
+    return false;
+  }
+  if(FdCache::getFdCacheData()->Get(path, &fd)){
+    struct timeval tv[2];
+    tv[0].tv_sec  = ts[1].tv_sec;
+    tv[0].tv_usec = 0L;
+    tv[1].tv_sec  = ts[1].tv_sec;
+    tv[1].tv_usec = 0L;
+    futimes(fd, tv);
+  }
+  return true;
+}
+
 static int s3fs_chmod(const char *path, mode_t mode)
 {
   int result;
@@ -2402,6 +3535,14 @@ static int s3fs_chmod(const char *path, mode_t mode)
   if(0 != (result = check_object_owner(path, &stbuf))){
     return result;
   }
+  // the new file which is not uploaded yet is changed locally.
+  if(chmod_new_object(path, mode)){
+    return 0;
+  }
+  // the dirty file is uploaded before changing the object
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
 
   if(S_ISDIR(stbuf.st_mode)){
     result      = chk_dir_object_type(path, newpath, strpath, nowcache, &meta, &nDirType);
@@ -2465,6 +3606,12 @@ static int s3fs_chmod_nocopy(const char *path, mode_t mode) {
   if(0 != (result = check_object_owner(path, &stbuf))){
     return result;
   }
+  if(chmod_new_object(path, mode)){
+    return 0;
+  }
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
 
   // Get attributes
   if(S_ISDIR(stbuf.st_mode)){
@@ -2555,6 +3702,14 @@ static int s3fs_chown(const char *path, uid_t uid, gid_t gid) {
   if(0 != (result = check_object_owner(path, &stbuf))){
     return result;
   }
+  // the new file which is not uploaded yet is changed locally.
+  if(chown_new_object(path, uid, gid)){
+    return 0;
+  }
+  // the dirty file is uploaded before changing the object
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
 
   if((uid_t)(-1) == uid){
     uid = stbuf.st_uid;
@@ -2633,6 +3788,12 @@ static int s3fs_chown_nocopy(const char *path, uid_t uid, gid_t gid) {
   if(0 != (result = check_object_owner(path, &stbuf))){
     return result;
   }
+  if(chown_new_object(path, uid, gid)){
+    return 0;
+  }
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
 
   // Get attributes
   if(S_ISDIR(stbuf.st_mode)){
@@ -2720,7 +3881,6 @@ static int s3fs_truncate(const char *path, off_t size) {
   int fd = -1;
   int result;
   headers_t meta;
-  int isclose = 1;
 
   FGPRINT("s3fs_truncate[path=%s][size=%zd]\n", path, size);
 
@@ -2730,44 +3890,49 @@ static int s3fs_truncate(const char *path, off_t size) {
   if(0 != (result = check_object_access(path, W_OK, NULL))){
     return result;
   }
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
 
   // Get file information
   if(0 == (result = get_object_attribute(path, NULL, &meta))){
-    // Exists -> Get file
-    if(0 > (fd = get_opened_fd(path))){
-      if(0 > (fd = get_local_fd(path))){
-        FGPRINT("  s3fs_truncate line %d: get_local_fd result: %d\n", __LINE__, fd);
-        SYSLOGERR("s3fs_truncate line %d: get_local_fd result: %d", __LINE__, fd);
-        return -EIO;
+    // Exists -> Truncate the shared local file without loading it, and
+    // upload it. The parts which are not changed are copied from the
+    // object by upload_local_fd(), then only the changed parts(the last
+    // page and the extended area) are sent.
+    if(0 >= (fd = open_shared_fd(path, O_RDWR))){
+      FGPRINT("  s3fs_truncate line %d: open_shared_fd result: %d\n", __LINE__, fd);
+      SYSLOGERR("s3fs_truncate line %d: open_shared_fd result: %d", __LINE__, fd);
+      return -EIO;
+    }
+    if(0 == (result = truncate_shared_fd(path, fd, size))){
+      // the new file is uploaded at flush.
+      if(!FdCache::getFdCacheData()->GetNewObject(path)){
+        result = flush_local_fd(path, fd);
       }
-    }else{
-      isclose = 0;
     }
+    release_shared_fd(path, fd);
   }else{
     // Not found -> Make tmpfile
     if(-1 == (fd = fileno(tmpfile()))){
       SYSLOGERR("error: line %d: %d", __LINE__, -errno);
       return -errno;
     }
-  }
-
-  // Truncate
-  if(0 != ftruncate(fd, size) || 0 != fsync(fd)){
-    FGPRINT("  s3fs_truncate line %d: ftruncate or fsync returned err(%d)\n", __LINE__, errno);
-    SYSLOGERR("s3fs_truncate line %d: ftruncate or fsync returned err(%d)", __LINE__, errno);
-    if(isclose){
+    if(0 != ftruncate(fd, size) || 0 != fsync(fd)){
+      FGPRINT("  s3fs_truncate line %d: ftruncate or fsync returned err(%d)\n", __LINE__, errno);
+      SYSLOGERR("s3fs_truncate line %d: ftruncate or fsync returned err(%d)", __LINE__, errno);
+      result = -errno;
       close(fd);
+      return result;
+    }
+    if(0 != (result = put_local_fd(path, meta, fd, false))){
+      FGPRINT("  s3fs_truncate line %d: put_local_fd result: %d\n", __LINE__, result);
     }
-    return -errno;
-  }
-
-  // Re-uploading
-  if(0 != (result = put_local_fd(path, meta, fd, false))){
-    FGPRINT("  s3fs_truncate line %d: put_local_fd result: %d\n", __LINE__, result);
-  }
-  if(isclose){
     close(fd);
   }
+  if(0 != result){
+    FGPRINT("  s3fs_truncate line %d: result: %d\n", __LINE__, result);
+  }
   StatCache::getStatCacheData()->DelStat(path);
 
   return result;
@@ -2779,6 +3944,7 @@ static int s3fs_open(const char *path, struct fuse_file_info *fi) {
 
   FGPRINT("s3fs_open[path=%s][flags=%d]\n", path, fi->flags);
 
+  bool is_truncate = (0 != ((unsigned int)fi->flags & O_TRUNC));
   int mask = (O_RDONLY != (fi->flags & O_ACCMODE) ? W_OK : R_OK);
   if(0 != (result = check_parent_object_access(path, X_OK))){
     return result;
@@ -2788,22 +3954,67 @@ static int s3fs_open(const char *path, struct fuse_file_info *fi) {
     if(0 != (result = check_parent_object_access(path, W_OK))){
       return result;
     }
+    // Go do the truncation if called for(it makes the object)
+    if(is_truncate){
+      if(0 != (result = s3fs_truncate(path, 0))){
+        return result;
+      }
+      is_truncate = false;
+    }
   }else if(0 != result){
     return result;
   }
 
-  // Go do the truncation if called for
-  if((unsigned int)fi->flags & O_TRUNC) {
-     result = s3fs_truncate(path, 0);
-     if(result != 0)
-        return result;
+  int fd;
+  if(0 >= (fd = open_shared_fd(path, fi->flags))){
+    return -EIO;
   }
 
-  if((fi->fh = get_local_fd(path)) <= 0){
-    return -EIO;
+  // The object exists, then the local file is truncated without loading
+  // it, and the empty file is uploaded at flush.
+  if(is_truncate && 0 != (result = truncate_shared_fd(path, fd, 0))){
+    release_shared_fd(path, fd);
+    return result;
+  }
+  fi->fh = fd;
+
+  return 0;
+}
+
+//
+// Truncate the shared local file without loading it, and mark it as
+// modified. The pages which are loading by other threads are waited for,
+// those must not be written after truncating. The last page is loaded
+// before extending, because it is not loaded after that.
+//
+static int truncate_shared_fd(const char* path, int fd, off_t size)
+{
+  int result;
+  struct stat st;
+
+  FGPRINT("   truncate_shared_fd[path=%s][fd=%d][size=%zd]\n", path, fd, size);
+
+  if(-1 == fstat(fd, &st)){
+    YIKES(-errno);
+  }
+  if(0 < st.st_size && st.st_size < size && 0 != (result = load_local_fd(path, fd, st.st_size - 1, 1))){
+    return result;
+  }
+
+  bool is_reserved = FdCache::getFdCacheData()->ReservePage(fd, 0, -1);
+  if(0 != ftruncate(fd, size)){
+    result = -errno;
+    SYSLOGERR("line %d: ftruncate: %d", __LINE__, result);
+    if(is_reserved){
+      FdCache::getFdCacheData()->ReleasePage(fd, 0, -1, false);
+    }
+    return result;
+  }
+  if(is_reserved){
+    FdCache::getFdCacheData()->ResizePageList(fd, size);
+    FdCache::getFdCacheData()->ReleasePage(fd, 0, -1, false);
   }
-  // remember flags and headers...
-  FdCache::getFdCacheData()->Add(path, fi->fh, fi->flags);
+  FdCache::getFdCacheData()->SetModified(fd);
 
   return 0;
 }
@@ -2814,6 +4025,17 @@ static int s3fs_read(
 
   FGPRINT("s3fs_read[path=%s]\n", path);
 
+  // prefetch following pages by access pattern, before loading this range.
+  struct stat st;
+  if(FdCache::getFdCacheData()->HasPageList(fi->fh) && 0 == fstat(fi->fh, &st)){
+    ReadAhead::getReadAhead()->Read(path, fi->fh, offset, size, st.st_size);
+  }
+
+  // download pages which are not loaded yet.
+  if(0 != (res = load_local_fd(path, fi->fh, offset, size))){
+    return res;
+  }
+
   res = pread(fi->fh, buf, size, offset);
   if(res == -1)
     YIKES(-errno);
@@ -2823,14 +4045,47 @@ static int s3fs_read(
 
 static int s3fs_write(
     const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-  int res = pwrite(fi->fh, buf, size, offset);
+  int res;
+  int fd = fi->fh;
 
   // Commented - This message is output too much
 //FGPRINT("s3fs_write[path=%s]\n", path);
 
-  if(res == -1)
+  // Need to load the pages which are overwritten partially.
+  // (the pages which are covered fully do not need to download)
+  if(0 != (offset % FDPAGE_SIZE)){
+    if(0 != (res = load_local_fd(path, fd, offset, 1))){
+      return res;
+    }
+  }
+  if(0 != ((offset + size) % FDPAGE_SIZE)){
+    if(0 != (res = load_local_fd(path, fd, offset + size - 1, 1))){
+      return res;
+    }
+  }
+
+  // the pages must not be downloaded while writing
+  bool is_reserved = FdCache::getFdCacheData()->ReservePage(fd, offset, size);
+
+  res = pwrite(fd, buf, size, offset);
+  if(res == -1){
+    if(is_reserved){
+      FdCache::getFdCacheData()->ReleasePage(fd, offset, size, false);
+    }
     YIKES(-errno);
+  }
 
+  // update page status
+  if(is_reserved){
+    struct stat st;
+    FdCache::getFdCacheData()->SetModified(fd);
+    FdCache::getFdCacheData()->SetDirtyPage(fd, offset, res);
+    FdCache::getFdCacheData()->SetLoadedPage(fd, offset, res);
+    FdCache::getFdCacheData()->ReleasePage(fd, offset, size, false);
+    if(0 == fstat(fd, &st)){
+      FdCache::getFdCacheData()->ResizePageList(fd, st.st_size);
+    }
+  }
   return res;
 }
 
@@ -2872,51 +4127,293 @@ static int s3fs_flush(const char *path, struct fuse_file_info *fi) {
   }
 
   // NOTE- fi->flags is not available here
+  // (the new file is created even if it is opened with O_RDONLY)
   flags = get_flags(fd);
-  if(O_RDONLY != (flags & O_ACCMODE)) {
-    headers_t meta;
-    if(0 != (result = get_object_attribute(path, NULL, &meta))){
+  if(O_RDONLY != (flags & O_ACCMODE) || FdCache::getFdCacheData()->GetNewObject(path)) {
+    if(WriteBack::getWriteBack()->IsRunning()){
+      // the dirty file keeps one reference of fd until it is uploaded
+      // in background.
+      int dirtyfd;
+      if(FdCache::getFdCacheData()->IsModified(fd) && FdCache::getFdCacheData()->Open(path, flags, &dirtyfd) &&
+         !WriteBack::getWriteBack()->Add(path, dirtyfd)){
+        FdCache::getFdCacheData()->Close(path, dirtyfd, NULL);
+      }
+      // while the uploading fails, the error is returned(the file is kept
+      // dirty and retried).
+      return WriteBack::getWriteBack()->GetError(path);
+    }
+    return flush_local_fd(path, fd);
+  }
+
+  return 0;
+}
+
+//
+// Upload the local file if it is modified.
+//
+// The fd is shared by handles, so the flushes at the same time upload it
+// once. If the file is changed while uploading, it is uploaded again.
+//
+static int flush_local_fd(const char* path, int fd)
+{
+  int result;
+  unsigned long count = 0;
+  inflight_entry* pentry;
+  string key = string("PUT:") + path;
+
+  // if the file is loaded partially and it is not changed, skip uploading
+  while(FdCache::getFdCacheData()->IsModified(fd, &count)){
+    if(InflightRequests::getInflightRequests()->Join(key, &pentry)){
+      result = upload_local_fd(path, fd, count);
+      InflightRequests::getInflightRequests()->Done(pentry, result);
+      return result;
+    }
+    result = InflightRequests::getInflightRequests()->Wait(pentry);
+    InflightRequests::getInflightRequests()->Leave(pentry);
+    if(0 != result){
       return result;
     }
+  }
+  return 0;
+}
 
-    // if the cached file matches the remote file skip uploading
-    struct stat st;
-    if((fstat(fd, &st)) == -1)
-      YIKES(-errno);
+//
+// Upload dirty or modified file, and wait for it.
+//
+static int s3fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+  int result;
+  int fd = fi->fh;
+
+  FGPRINT("s3fs_fsync[path=%s][fd=%d]\n", path, fd);
+
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
+  if(O_RDONLY != (get_flags(fd) & O_ACCMODE)){
+    result = flush_local_fd(path, fd);
+  }
+  return result;
+}
+
+//
+// Upload the local file if it is different from the object.
+// count is the count of changes before uploading.
+//
+static int upload_local_fd(const char* path, int fd, unsigned long count)
+{
+  int result;
+  headers_t meta;
+  unsigned long newcount = 0;
 
-    if(str(st.st_size) == meta["Content-Length"] &&
-      (str(st.st_mtime) == meta["x-amz-meta-mtime"])) {
+  // the new file is created with its headers.
+  bool is_new = FdCache::getFdCacheData()->GetNewObject(path, &meta, &newcount);
+  if(!is_new && 0 != (result = get_object_attribute(path, NULL, &meta))){
+    return result;
+  }
+
+  // The file is modified, then it is uploaded even if the size and mtime
+  // are same as the object(written in same second).
+  struct stat st;
+  if((fstat(fd, &st)) == -1)
+    YIKES(-errno);
+
+  // If both mtime are not same, force to change mtime based on fd.
+  if(str(st.st_mtime) != meta["x-amz-meta-mtime"]){
+    meta["x-amz-meta-mtime"] = str(st.st_mtime);
+  }
+
+  // If the object is not changed after the file was loaded(or uploaded),
+  // the parts which do not have dirty pages are copied from the object
+  // by multipart upload, then only the dirty parts are loaded and uploaded.
+  vector<bool> copyparts;
+  vector<bool> loaded;
+  string       etag;
+  bool is_multipart = (st.st_size >= 20971520 && !nomultipart);  // same as put_local_fd()
+  if(is_multipart && FdCache::getFdCacheData()->GetPageList(fd, loaded, etag) && 0 < etag.length() && etag == meta["ETag"]){
+    off_t objsize = get_size(meta);
+    copyparts.resize((st.st_size + MULTIPART_SIZE - 1) / MULTIPART_SIZE, false);
+    for(size_t cnt = 0; cnt < copyparts.size(); cnt++){
+      off_t start = cnt * static_cast<off_t>(MULTIPART_SIZE);
+      off_t size  = min(static_cast<off_t>(MULTIPART_SIZE), st.st_size - start);
+      copyparts[cnt] = ((start + size) <= objsize && !FdCache::getFdCacheData()->IsDirtyPage(fd, start, size));
+      if(!copyparts[cnt] && 0 != (result = load_local_fd(path, fd, start, size))){
+        return result;
+      }
+    }
+  }else{
+    // need all pages for uploading
+    if(0 != (result = load_local_fd(path, fd, 0, -1))){
       return result;
     }
+  }
 
-    // If both mtime are not same, force to change mtime based on fd.
-    if(str(st.st_mtime) != meta["x-amz-meta-mtime"]){
-      meta["x-amz-meta-mtime"] = str(st.st_mtime);
+  // when updates file, always updates sse mode.
+  result = put_local_fd(path, meta, fd, true, (copyparts.empty() ? NULL : &copyparts));
+  if(0 != result && !copyparts.empty()){
+    // the object may be changed by others, then upload all pages.
+    SYSLOGERR("upload_local_fd: could not upload with copying parts[path=%s]: %d, retrying.", path, result);
+    if(0 != (result = load_local_fd(path, fd, 0, -1))){
+      return result;
     }
+    result = put_local_fd(path, meta, fd, true);
+  }
+  if(0 != result){
+    return result;
+  }
 
-    // when updates file, always updates sse mode.
-    return put_local_fd(path, meta, fd, true);
+  if(is_new){
+    // the object is created, then the headers which are changed while
+    // uploading are set to the object.
+    headers_t newmeta;
+    if(!FdCache::getFdCacheData()->ClearNewObject(path, newcount, &newmeta)){
+      newmeta["x-amz-copy-source"]        = urlEncode("/" + bucket + get_realpath(path));
+      newmeta["x-amz-metadata-directive"] = "REPLACE";
+      result = put_headers(path, newmeta, false);
+    }
+    StatCache::getStatCacheData()->DelStat(path);
   }
 
-  return 0;
+  // the dirty pages after this are the changes from the uploaded object.
+  headers_t newmeta;
+  if(is_multipart){
+    StatCache::getStatCacheData()->DelStat(path);
+    get_object_attribute(path, NULL, &newmeta);
+  }
+  if(newmeta.end() != newmeta.find("ETag")){
+    FdCache::getFdCacheData()->ClearModified(fd, count, newmeta["ETag"].c_str());
+  }else{
+    FdCache::getFdCacheData()->ClearModified(fd, count);
+  }
+  return result;
 }
 
 static int s3fs_release(const char *path, struct fuse_file_info *fi)
 {
   FGPRINT("s3fs_release[path=%s][fd=%ld]\n", path, fi->fh);
 
-  // clear file discriptor mapping.
-  if(!FdCache::getFdCacheData()->Del(path, fi->fh)){
-    FGPRINT("  s3fs_release: failed to release fd[path=%s][fd=%ld]\n", path, fi->fh);
+  int result = release_shared_fd(path, fi->fh);
+  if((fi->flags & O_RDWR) || (fi->flags & O_WRONLY)){
+    StatCache::getStatCacheData()->DelStat(path);
   }
+  return result;
+}
 
-  if(close(fi->fh) == -1){
-    YIKES(-errno);
+// release the reference of dirty file after uploading
+static void release_dirty_fd(const char* path, int fd)
+{
+  release_shared_fd(path, fd);
+  StatCache::getStatCacheData()->DelStat(path);
+}
+
+//
+// Save the dirty file which could not be uploaded at unmount, then the
+// written data is not lost. The file is copied to the same path under
+// ".s3fs-unuploaded/<bucket>" in use_cache directory(or /tmp), and it is
+// left for user.
+//
+static int save_dirty_fd(const char* path, int fd)
+{
+  string save_path = (0 < use_cache.size() ? use_cache : string("/tmp")) + "/.s3fs-unuploaded/" + bucket + path;
+  int    savefd;
+  int    result = 0;
+
+  mkdirp(mydirname(save_path), 0700);
+  if(-1 == (savefd = open(save_path.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0600))){
+    result = -errno;
+  }else{
+    char    buf[64 * 1024];
+    ssize_t bytes;
+    for(off_t pos = 0; 0 < (bytes = pread(fd, buf, sizeof(buf), pos)); pos += bytes){
+      if(bytes != write(savefd, buf, bytes)){
+        bytes = -1;
+        break;
+      }
+    }
+    if(-1 == bytes || -1 == fsync(savefd)){
+      result = -errno;
+    }
+    close(savefd);
   }
-  if((fi->flags & O_RDWR) || (fi->flags & O_WRONLY)){
-    StatCache::getStatCacheData()->DelStat(path);
+  if(0 != result){
+    SYSLOGERR("could not save dirty file[path=%s] to %s: %d, the changes are lost.", path, save_path.c_str(), result);
+  }else{
+    SYSLOGERR("dirty file[path=%s] which could not be uploaded is saved to %s", path, save_path.c_str());
+  }
+  return result;
+}
+
+//
+// Release one reference of the shared fd, and the fd is closed by last
+// reference.
+//
+static int release_shared_fd(const char* path, int fd)
+{
+  // clear file discriptor mapping, the fd is closed by last handle.
+  bool      is_last = true;
+  bool      is_new  = false;
+  headers_t newmeta;
+  if(!FdCache::getFdCacheData()->Close(path, fd, &is_last, &is_new, &newmeta)){
+    FGPRINT("  release_shared_fd: failed to release fd[path=%s][fd=%d]\n", path, fd);
+  }
+
+  if(is_last){
+    // stop prefetching into fd
+    ReadAhead::getReadAhead()->Close(fd);
+
+    // The new file which is not created yet(ex. the flush failed) is
+    // created by last handle with the headers which are released here.
+    if(is_new){
+      int result;
+      struct stat st;
+      if(0 == fstat(fd, &st)){
+        newmeta["x-amz-meta-mtime"] = str(st.st_mtime);
+      }
+      if(0 != (result = put_local_fd(path, newmeta, fd, true))){
+        SYSLOGERR("could not create new file[path=%s]: %d", path, result);
+        FGPRINT("  release_shared_fd: failed to create new file[path=%s]: %d\n", path, result);
+      }
+      StatCache::getStatCacheData()->DelStat(path);
+    }
+
+    // The local cache file which is loaded partially must not be used
+    // as cache after this, so the mtime is set to invalid value.
+    if(use_cache.size() > 0 && FdCache::getFdCacheData()->HasPageList(fd)){
+      time_t mtime = 0;
+      if(!FdCache::getFdCacheData()->IsAllLoaded(fd, &mtime)){
+        mtime = 0;
+      }else if(FdCache::getFdCacheData()->IsModified(fd)){
+        mtime = -1;   // keep mtime of local file
+      }
+      if(-1 != mtime){
+        struct timeval tv[2];
+        tv[0].tv_sec = mtime;
+        tv[0].tv_usec= 0L;
+        tv[1].tv_sec = tv[0].tv_sec;
+        tv[1].tv_usec= 0L;
+        futimes(fd, tv);
+      }
+    }
+    // Keep the loaded pages in cache index, if the file is not changed.
+    if(use_cache.size() > 0){
+      vector<bool>  loaded;
+      string        etag;
+      unsigned long count = 0;
+      struct stat   st;
+      if(FdCache::getFdCacheData()->GetPageList(fd, loaded, etag, &count) && 0 == count && 0 < etag.length() &&
+         0 == fstat(fd, &st) && 0 == fsync(fd)){
+        DiskCache::getDiskCache()->SetIndex(path, etag, st.st_size, loaded);
+      }
+    }
+    FdCache::getFdCacheData()->DelPageList(fd);
+
+    if(close(fd) == -1){
+      YIKES(-errno);
+    }
+    if(use_cache.size() > 0){
+      DiskCache::getDiskCache()->Update(path);
+    }
   }
-
   return 0;
 }
 
@@ -2930,46 +4427,45 @@ static int s3fs_opendir(const char *path, struct fuse_file_info *fi)
   if(0 == (result = check_object_access(path, mask, NULL))){
     result = check_parent_object_access(path, mask);
   }
+  if(0 == result){
+    // cursor of listing for s3fs_readdir
+    fi->fh = reinterpret_cast<uint64_t>(new dir_handle());
+  }
   return result;
 }
 
 static int readdir_multi_head(const char *path, S3ObjList& head)
 {
-  CURLM*       mh;
-  CURLMcode    curlm_code;
-  CURLMsg*     msg;
-  int          still_running;
-  int          remaining_messages;
-  int          cnt;
-  size_t       last_remaining_host;
   s3obj_list_t headlist;
   auto_head    curl_map;   // delete object and curl handle automatically.
   s3obj_list_t::iterator liter;
+  curl_request_list_t    running;
 
   // Make base path list.
   head.GetNameList(headlist, true, false);  // get name with "/".
 
   FGPRINT(" readdir_multi_head[path=%s][list=%ld]\n", path, headlist.size());
 
-  // Make request list.
-  //
-  // Send multi request loop( with retry )
-  // (When many request is sends, sometimes gets "Couldn't connect to server")
-  //
-  for(last_remaining_host = headlist.size() + 1; last_remaining_host > headlist.size() && headlist.size(); ){
-    last_remaining_host = headlist.size();
-
-    // populate the multi interface with an initial set of requests
-    mh = curl_multi_init();
-
-    // Make single head request.
-    for(liter = headlist.begin(), cnt = 0; headlist.end() != liter && cnt < MAX_MULTI_HEADREQ; ){
+  // Send head requests by CurlEngine.
+  // At most MAX_MULTI_HEADREQ requests are queued at once, and each
+  // request is retried by CurlEngine.
+  for(liter = headlist.begin(); true; ){
+    for(; headlist.end() != liter && running.size() < MAX_MULTI_HEADREQ; liter++){
       string fullpath = path + (*liter);
       string fullorg  = path + head.GetOrgName((*liter).c_str());
       string etag     = head.GetETag((*liter).c_str());
 
       if(StatCache::getStatCacheData()->HasStat(fullpath, etag.c_str())){
-        liter = headlist.erase(liter);
+        continue;
+      }
+
+      // make stat from listing without head request.
+      off_t  size;
+      time_t mtime;
+      if(list_stat && head.GetListStat((*liter).c_str(), size, mtime)){
+        if(!StatCache::getStatCacheData()->AddListStat(fullpath, size, mtime, (0 < etag.length() ? etag.c_str() : NULL))){
+          FGPRINT("  readdir_multi_head: failed adding stat cache [path=%s]\n", fullpath.c_str());
+        }
         continue;
       }
 
@@ -2978,166 +4474,241 @@ static int readdir_multi_head(const char *path, S3ObjList& head)
       request_data.base_path      = (*liter);
       request_data.path           = fullorg;
       CURL* curl_handle           = create_head_handle(&request_data);
-      my_set_curl_share(curl_handle);  // set dns cache
       request_data.path           = fullpath;    // Notice: replace org to normalized for cache key.
       curl_map.get()[curl_handle] = request_data;
 
-      // add this handle to the multi handle
-      if(CURLM_OK != (curlm_code = curl_multi_add_handle(mh, curl_handle))){
-        SYSLOGERR("readdir_multi_head: curl_multi_add_handle code: %d msg: %s", curlm_code, curl_multi_strerror(curlm_code));
-        FGPRINT("  readdir_multi_head: curl_multi_add_handle code: %d msg: %s\n", curlm_code, curl_multi_strerror(curlm_code));
-        curl_multi_cleanup(mh);
-        return -EIO;
-      }
-      liter++;
-      cnt++;     // max request count in multi-request is MAX_MULTI_HEADREQ.
+      CurlRequest* request = new CurlRequest(curl_handle);
+      CurlEngine::getCurlEngine()->Submit(request);
+      running.push_back(request);
     }
 
-    // Send multi request.
-    do{
-      // Start making requests and check running.
-      still_running = 0;
-      do {
-        curlm_code = curl_multi_perform(mh, &still_running);
-      } while(curlm_code == CURLM_CALL_MULTI_PERFORM);
-
-      if(curlm_code != CURLM_OK) {
-        SYSLOGERR("readdir_multi_head: curl_multi_perform code: %d msg: %s", curlm_code, curl_multi_strerror(curlm_code));
-        FGPRINT("  readdir_multi_head: curl_multi_perform code: %d msg: %s\n", curlm_code, curl_multi_strerror(curlm_code));
-      }
-
-      // Set timer when still running
-      if(still_running) {
-        long milliseconds;
-        fd_set r_fd;
-        fd_set w_fd;
-        fd_set e_fd;
-        FD_ZERO(&r_fd);
-        FD_ZERO(&w_fd);
-        FD_ZERO(&e_fd);
-
-        if(CURLM_OK != (curlm_code = curl_multi_timeout(mh, &milliseconds))){
-          SYSLOGERR("readdir_multi_head: curl_multi_timeout code: %d msg: %s", curlm_code, curl_multi_strerror(curlm_code));
-          FGPRINT("  readdir_multi_head: curl_multi_timeout code: %d msg: %s\n", curlm_code, curl_multi_strerror(curlm_code));
-        }
-        if(milliseconds < 0){
-          milliseconds = 50;
-        }
-        if(milliseconds > 0) {
-          int max_fd;
-          struct timeval timeout;
-          timeout.tv_sec  = 1000 * milliseconds / 1000000;
-          timeout.tv_usec = 1000 * milliseconds % 1000000;
-
-          if(CURLM_OK != (curlm_code = curl_multi_fdset(mh, &r_fd, &w_fd, &e_fd, &max_fd))){
-            SYSLOGERR("readdir_multi_head: curl_multi_fdset code: %d msg: %s", curlm_code, curl_multi_strerror(curlm_code));
-            FGPRINT("  readdir_multi_head: curl_multi_fdset code: %d msg: %s\n", curlm_code, curl_multi_strerror(curlm_code));
-            curl_multi_cleanup(mh);
-            return -EIO;
-          }
-          if(-1 == select(max_fd + 1, &r_fd, &w_fd, &e_fd, &timeout)){
-            curl_multi_cleanup(mh);
-            YIKES(-errno);
-          }
-        }
-      }
-    }while(still_running);
-
     // Read the result
-    while((msg = curl_multi_info_read(mh, &remaining_messages))) {
-      if(CURLMSG_DONE != msg->msg){
-        SYSLOGERR("readdir_multi_head: curl_multi_info_read code: %d", msg->msg);
-        FGPRINT("  readdir_multi_head: curl_multi_info_read code: %d\n", msg->msg);
-        curl_multi_cleanup(mh);
-        return -EIO;
+    CurlRequest* request;
+    if(NULL == (request = CurlEngine::getCurlEngine()->WaitAny(running))){
+      break;
+    }
+    head_data response = curl_map.get()[request->GetHandle()];
+    if(0 == request->GetResult()){
+      // add into stat cache
+      if(!StatCache::getStatCacheData()->AddStat(response.path, (*response.responseHeaders))){
+        FGPRINT("  readdir_multi_head: failed adding stat cache [path=%s]\n", response.path.c_str());
       }
+    }else{
+      // This case is directory object("dir", "non dir object", "_$folder$", etc)
+      //FGPRINT("  readdir_multi_head: failed a request(%s)\n", response.base_path.c_str());
+    }
 
-      if(CURLE_OK == msg->data.result){
-        head_data response= curl_map.get()[msg->easy_handle];
-        long responseCode = -1;
+    // Cleanup this curl handle and headers
+    curl_map.remove(request->GetHandle());  // with destroy curl handle.
+    delete request;
+  }
+  return 0;
+}
 
-        if(CURLE_OK == curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &responseCode) && 400 > responseCode){
-          // add into stat cache
-          if(!StatCache::getStatCacheData()->AddStat(response.path, (*response.responseHeaders))){
-            FGPRINT("  readdir_multi_head: failed adding stat cache [path=%s]\n", response.path.c_str());
-          }
-        }else{
-          // This case is directory object("dir", "non dir object", "_$folder$", etc)
-          //FGPRINT("  readdir_multi_head: failed a request(%s)\n", response.base_path.c_str());
-        }
-        // remove request path.
-        headlist.remove(response.base_path);
 
-      }else{
-        SYSLOGDBGERR("readdir_multi_head: failed to read - remaining_msgs: %i code: %d  msg: %s", 
-            remaining_messages, msg->data.result, curl_easy_strerror(msg->data.result));
-        FGPRINT("  readdir_multi_head: failed to read - remaining_msgs: %i code: %d  msg: %s\n",
-            remaining_messages, msg->data.result, curl_easy_strerror(msg->data.result));
-      }
+//
+// Remove the names from the page which are already listed in previous
+// pages. The objects "dir", "dir/" and "dir_$folder$" are listed as same
+// name, and those may be in different pages. The keys are sorted, then
+// the name is kept in straddle until the marker passes "dir_$folder$".
+// The new files in the page are kept in listed_new, then those are not
+// listed again as new files which are not uploaded.
+//
+static void readdir_skip_listed(const string& strpath, dir_handle* dh)
+{
+  for(s3obj_list_t::iterator iter = dh->page.begin(); dh->page.end() != iter; ){
+    if(dh->straddle.end() != dh->straddle.find(*iter)){
+      iter = dh->page.erase(iter);
+      continue;
+    }
+    dh->straddle.insert(*iter);
+    if(FdCache::getFdCacheData()->GetNewObject((strpath + (*iter)).c_str())){
+      dh->listed_new.insert(*iter);
+    }
+    ++iter;
+  }
 
-      // Cleanup this curl handle and headers
-      curl_multi_remove_handle(mh, msg->easy_handle);
-      curl_map.remove(msg->easy_handle);  // with destroy curl handle.
+  if(!dh->truncated){
+    dh->straddle.clear();
+    return;
+  }
+  // the marker is the key in bucket(without "/" at top)
+  string prefix = get_realpath(strpath.c_str()).substr(1);
+  if(0 != dh->marker.compare(0, prefix.length(), prefix)){
+    return;
+  }
+  string relmarker = dh->marker.substr(prefix.length());
+  for(set<string>::iterator iter = dh->straddle.begin(); dh->straddle.end() != iter; ){
+    if((*iter + "_$folder$") <= relmarker){
+      dh->straddle.erase(iter++);
+    }else{
+      ++iter;
     }
-    curl_multi_cleanup(mh);
-    curl_map.removeAll();  // with destroy curl handle.
   }
-  return 0;
 }
 
 static int s3fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
 {
-  S3ObjList head;
-  s3obj_list_t headlist;
+  dir_handle  tmphandle;
+  dir_handle* dh = (fi && fi->fh) ? reinterpret_cast<dir_handle*>(fi->fh) : &tmphandle;
   int result;
 
-  FGPRINT("s3fs_readdir[path=%s]\n", path);
+  FGPRINT("s3fs_readdir[path=%s][offset=%zd]\n", path, offset);
 
   if(0 != (result = check_object_access(path, X_OK, NULL))){
     return result;
   }
 
-  // get a list of all the objects
-  if((result = list_bucket(path, head, "/")) != 0){
-    FGPRINT(" s3fs_readdir list_bucket returns error(%d).\n", result);
-    return result;
+  string strpath = path;
+  if(strcmp(path, "/") != 0){
+    strpath += "/";
+  }
+
+  // If offset is before current page(ex. rewinddir), list from the first page.
+  if(offset < DIR_HANDLE_FIRST_OFFSET || offset < dh->page_offset){
+    dh->Clear();
   }
 
   // force to add "." and ".." name.
-  filler(buf, ".", 0, 0);
-  filler(buf, "..", 0, 0);
-  if(head.IsEmpty()){
-    return 0;
+  // Each entry is filled with the offset of next entry, and fuse calls
+  // readdir with it when the buffer is full.
+  off_t next = offset;
+  if(0 == next){
+    if(filler(buf, ".", 0, ++next)){
+      return 0;
+    }
+  }
+  if(1 == next){
+    if(filler(buf, "..", 0, ++next)){
+      return 0;
+    }
   }
 
-  // populate fuse buffer
-  head.GetNameList(headlist);
-  s3obj_list_t::const_iterator liter;
-  for(liter = headlist.begin(); headlist.end() != liter; liter++){
-    filler(buf, (*liter).c_str(), 0, 0);
+  while(true){
+    // populate fuse buffer from current page.
+    if(next < dh->page_offset + dh->page_count){
+      s3obj_list_t::const_iterator liter = dh->page.begin();
+      for(off_t pos = dh->page_offset; pos < next; pos++){
+        liter++;
+      }
+      for(; dh->page.end() != liter; liter++){
+        if(filler(buf, (*liter).c_str(), 0, ++next)){
+          return 0;
+        }
+      }
+      continue;
+    }
+    if(!dh->truncated){
+      if(dh->is_listed_new){
+        break;
+      }
+      // the new files which are not uploaded yet are not in the bucket,
+      // those are listed as last page.
+      list<string> paths;
+      FdCache::getFdCacheData()->GetNewObjectList(strpath.c_str(), paths);
+      dh->page_offset  += dh->page_count;
+      dh->page.clear();
+      for(list<string>::iterator iter = paths.begin(); paths.end() != iter; ++iter){
+        string name = iter->substr(strpath.length());
+        if(string::npos == name.find('/') && dh->listed_new.end() == dh->listed_new.find(name)){
+          dh->page.push_back(name);
+        }
+      }
+      dh->page_count    = dh->page.size();
+      dh->is_listed_new = true;
+      continue;
+    }
+
+    // get next page of the objects
+    S3ObjList head;
+    if(0 != (result = list_bucket_page(path, head, "/", dh->marker, dh->truncated, MAX_LIST_KEYS))){
+      FGPRINT(" s3fs_readdir list_bucket_page returns error(%d).\n", result);
+      dh->Clear();
+      return result;
+    }
+    dh->page_offset += dh->page_count;
+    dh->page.clear();
+    head.GetNameList(dh->page);
+    readdir_skip_listed(strpath, dh);
+    dh->page_count = dh->page.size();
+
+    // Send multi head request for stats caching.
+    if(0 != (result = readdir_multi_head(strpath.c_str(), head))){
+      FGPRINT(" s3fs_readdir readdir_multi_head returns error(%d).\n", result);
+      return result;
+    }
   }
+  return 0;
+}
 
-  // Send multi head request for stats caching.
-  string strpath = path;
-  if(strcmp(path, "/") != 0){
-    strpath += "/";
+static int s3fs_releasedir(const char *path, struct fuse_file_info *fi)
+{
+  FGPRINT("s3fs_releasedir [path=%s]\n", path);
+
+  if(fi->fh){
+    delete reinterpret_cast<dir_handle*>(fi->fh);
+    fi->fh = 0;
+  }
+  return 0;
+}
+
+static int list_bucket(const char *path, S3ObjList& head, const char* delimiter)
+{
+  int result;
+  bool truncated = true;
+  string next_marker = "";
+
+  FGPRINT("list_bucket [path=%s]\n", path);
+
+  while(truncated){
+    if(0 != (result = list_bucket_page(path, head, delimiter, next_marker, truncated, MAX_LIST_KEYS))){
+      return result;
+    }
+  }
+  return 0;
+}
+
+//
+// Get one page of objects after marker, and the marker is updated for
+// next page. If truncated is false, there is no more page.
+// Same page which is listing by other thread is not requested again.
+//
+static int list_bucket_page(const char *path, S3ObjList& head, const char* delimiter, string& marker, bool& truncated, int max_keys)
+{
+  int result;
+  inflight_entry* pentry;
+  string key = string("LIST:") + path + ":" + (delimiter ? delimiter : "") + ":" + str(max_keys) + ":" + marker;
+
+  if(!InflightRequests::getInflightRequests()->Join(key, &pentry)){
+    if(0 == (result = InflightRequests::getInflightRequests()->Wait(pentry))){
+      list_page_result* ppage = static_cast<list_page_result*>(pentry->data);
+      head.insert(ppage->head);
+      marker    = ppage->marker;
+      truncated = ppage->truncated;
+    }
+    InflightRequests::getInflightRequests()->Leave(pentry);
+    return result;
   }
-  if(0 != (result = readdir_multi_head(strpath.c_str(), head))){
-    FGPRINT(" s3fs_readdir readdir_multi_head returns error(%d).\n", result);
+
+  list_page_result page;
+  page.marker = marker;
+  if(0 == (result = send_list_bucket_page(path, page.head, delimiter, page.marker, page.truncated, max_keys))){
+    head.insert(page.head);
+    marker    = page.marker;
+    truncated = page.truncated;
   }
+  InflightRequests::getInflightRequests()->Done(pentry, result, &page);
   return result;
 }
 
-static int list_bucket(const char *path, S3ObjList& head, const char* delimiter)
+static int send_list_bucket_page(const char *path, S3ObjList& head, const char* delimiter, string& marker, bool& truncated, int max_keys)
 {
   CURL *curl;
   int result; 
   string s3_realpath;
   BodyData body;
-  bool truncated = true;
-  string next_marker = "";
 
-  FGPRINT("list_bucket [path=%s]\n", path);
+  FGPRINT("send_list_bucket_page [path=%s][marker=%s]\n", path, marker.c_str());
 
   s3_realpath = get_realpath(path);
   string resource = urlEncode(service_path + bucket); // this is what gets signed
@@ -3155,264 +4726,266 @@ static int list_bucket(const char *path, S3ObjList& head, const char* delimiter)
   }else{
     query += urlEncode(s3_realpath.substr(1));
   }
-  query += "&max-keys=1000";
+  query += "&max-keys=" + str(max_keys);
 
-  while(truncated) {
-    string url = host + resource + "?" + query;
+  string url = host + resource + "?" + query;
+  if(marker != ""){
+    url += "&marker=" + urlEncode(marker);
+  }
 
-    if(next_marker != ""){
-      url += "&marker=" + urlEncode(next_marker);
-      next_marker = "";
-    }
+  string my_url = prepare_url(url.c_str());
 
-    string my_url = prepare_url(url.c_str());
+  auto_curl_slist headers;
+  string date = get_date();
+  headers.append("Date: " + date);
+  headers.append("ContentType: ");
+  if(public_bucket.substr(0,1) != "1") {
+    headers.append("Authorization: AWS " + AWSAccessKeyId + ":" +
+      calc_signature("GET", "", "", date, headers.get(), resource + "/"));
+  }
 
-    auto_curl_slist headers;
-    string date = get_date();
-    headers.append("Date: " + date);
-    headers.append("ContentType: ");
-    if(public_bucket.substr(0,1) != "1") {
-      headers.append("Authorization: AWS " + AWSAccessKeyId + ":" +
-        calc_signature("GET", "", "", date, headers.get(), resource + "/"));
-    }
+  // the response is parsed while receiving it.
+  list_bucket_parser parser(path, &head, &body);
+  if(!init_list_parser(&parser)){
+    return -EIO;
+  }
 
-    curl = create_curl_handle();
-    curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &body);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.get());
+  curl = create_curl_handle();
+  parser.curl = curl;
+  curl_easy_setopt(curl, CURLOPT_URL, my_url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &parser);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteListBucketCallback);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers.get());
 
-    result = my_curl_easy_perform(curl, &body);
-    destroy_curl_handle(curl);
+  CurlRequest request(curl, &body);
+  request.SetResetCallback(reset_list_parser, &parser);
+  result = CurlEngine::getCurlEngine()->Perform(&request);
+  destroy_curl_handle(curl);
 
-    if(result != 0) {
-      FGPRINT("  list_bucket my_curl_easy_perform returns with error.\n");
-      return result;
-    }
-    if((append_objects_from_xml(path, body.str(), head)) != 0) {
-      FGPRINT("  list_bucket append_objects_from_xml returns with error.\n");
-      return -1;
-    }
+  if(result != 0) {
+    FGPRINT("  send_list_bucket_page my_curl_easy_perform returns with error.\n");
+    free_list_parser(&parser);
+    return result;
+  }
+  if(0 == parser.result && 0 != xmlParseChunk(parser.ctxt, NULL, 0, 1)){
+    parser.result = -1;
+  }
+  free_list_parser(&parser);
+  if(0 != parser.result) {
+    FGPRINT("  send_list_bucket_page parsing ListBucket result returns with error.\n");
+    return -1;
+  }
 
-    truncated = is_truncated(body.str());
-    if(truncated){
-      xmlChar*	tmpch = get_next_marker(body.str());
-      if(tmpch){
-        next_marker = (char*)tmpch;
-        xmlFree(tmpch);
-      }
+  truncated = parser.truncated;
+  if(truncated){
+    // NextMarker is returned only when delimiter is specified.
+    marker = (0 < parser.next_marker.length() ? parser.next_marker : parser.last_key);
+    if(0 == marker.length()){
+      truncated = false;
     }
-    body.Clear();
   }
-
   return 0;
 }
 
 const char* c_strErrorObjectName = "FILE or SUBDIR in DIR";
 
-static int append_objects_from_xml_ex(const char* path, xmlDocPtr doc, xmlXPathContextPtr ctx, 
-       const char* ex_contents, const char* ex_key, const char* ex_etag, int isCPrefix, S3ObjList& head)
+//
+// ListBucket result is parsed by libxml2 SAX(push) parser which is fed
+// from curl write callback directly, and each object is added to
+// S3ObjList when its element is closed. The element is looked up by
+// local name, then any xml name space can be parsed.
+//
+static void list_parser_add_object(list_bucket_parser* parser, const char* fullpath, bool is_dir)
 {
-  xmlXPathObjectPtr contents_xp;
-  xmlNodeSetPtr content_nodes;
-
-  contents_xp = xmlXPathEvalExpression((xmlChar*)ex_contents, ctx);
-  content_nodes = contents_xp->nodesetval;
-
-  int i;
-  for(i = 0; i < content_nodes->nodeNr; i++) {
-    ctx->node = content_nodes->nodeTab[i];
-
-    // object name
-    xmlXPathObjectPtr key = xmlXPathEvalExpression((xmlChar*)ex_key, ctx);
-    xmlNodeSetPtr key_nodes = key->nodesetval;
-    char *name = get_object_name(doc, key_nodes->nodeTab[0]->xmlChildrenNode, path);
-
-    if(!name){
-      FGPRINT("  append_objects_from_xml_ex name is something wrong. but continue.\n");
-
-    }else if((const char*)name != c_strErrorObjectName){
-      bool is_dir = isCPrefix ? true : false;
-      string stretag = "";
-
-      if(!isCPrefix && ex_etag){
-        // Get ETag
-        xmlXPathObjectPtr ETag = xmlXPathEvalExpression((xmlChar*)ex_etag, ctx);
-        if(ETag){
-          xmlNodeSetPtr etag_nodes = ETag->nodesetval;
-          if(etag_nodes){
-            xmlChar* petag = xmlNodeListGetString(doc, etag_nodes->nodeTab[0]->xmlChildrenNode, 1);
-            if(petag){
-              stretag = (char*)petag;
-              xmlFree(petag);
-            }
-          }
-          xmlXPathFreeObject(ETag);
-        }
-      }
-      if(!head.insert(name, (0 < stretag.length() ? stretag.c_str() : NULL), is_dir)){
-        FGPRINT("  append_objects_from_xml_ex insert_object returns with error.\n");
-        xmlXPathFreeObject(key);
-        xmlXPathFreeObject(contents_xp);
-        free(name);
-        return -1;
-      }
-      free(name);
-    }else{
-      //FGPRINT("append_objects_from_xml_ex name is file or subdir in dir. but continue.\n");
-    }
-    xmlXPathFreeObject(key);
+  // If there is not <Prefix>, use path instead of it.
+  const char* basepath = (0 < parser->prefix.length() ? parser->prefix.c_str() : parser->path);
+
+  char* name = get_object_name(fullpath, basepath);
+  if(!name){
+    FGPRINT("  list_parser_add_object name is something wrong. but continue.\n");
+    return;
+  }
+  if((const char*)name == c_strErrorObjectName){
+    //FGPRINT("list_parser_add_object name is file or subdir in dir. but continue.\n");
+    return;
   }
-  xmlXPathFreeObject(contents_xp);
 
-  return 0;
+  off_t  size  = -1;
+  time_t mtime = 0;
+  if(!is_dir && list_stat && 0 < parser->size.length() && 0 < parser->lastmod.length()){
+    size  = get_size(parser->size.c_str());
+    mtime = get_iso8601_time(parser->lastmod.c_str());
+  }
+  if(!parser->head->insert(name, (!is_dir && 0 < parser->etag.length() ? parser->etag.c_str() : NULL), is_dir, size, mtime)){
+    FGPRINT("  list_parser_add_object insert_object returns with error.\n");
+    parser->result = -1;
+  }
+  free(name);
 }
 
-static bool GetXmlNsUrl(xmlDocPtr doc, string& nsurl)
+static void list_parser_start_element(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI,
+                   int nb_namespaces, const xmlChar** namespaces, int nb_attributes, int nb_defaulted, const xmlChar** attributes)
 {
-  bool result = false;
-
-  if(!doc){
-    return result;
+  list_bucket_parser* parser = reinterpret_cast<list_bucket_parser*>(ctx);
+  const char*         name   = reinterpret_cast<const char*>(localname);
+
+  parser->depth++;
+  parser->text.erase();
+  if(2 == parser->depth){
+    if(0 == strcmp(name, "Contents")){
+      parser->in_contents = true;
+      parser->key.erase();
+      parser->etag.erase();
+      parser->size.erase();
+      parser->lastmod.erase();
+    }else if(0 == strcmp(name, "CommonPrefixes")){
+      parser->in_cprefix = true;
+      parser->key.erase();
+    }
   }
-  xmlNodePtr pRootNode = xmlDocGetRootElement(doc);
-  if(pRootNode){
-    xmlNsPtr* nslist = xmlGetNsList(doc, pRootNode);
-    if(nslist && nslist[0]){
-      if(nslist[0]->href){
-        nsurl  = (const char*)(nslist[0]->href);
-        result = true;
+}
+
+static void list_parser_end_element(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI)
+{
+  list_bucket_parser* parser = reinterpret_cast<list_bucket_parser*>(ctx);
+  const char*         name   = reinterpret_cast<const char*>(localname);
+
+  if(2 == parser->depth){
+    if(parser->in_contents){
+      if(0 < parser->key.length()){
+        list_parser_add_object(parser, parser->key.c_str(), false);
+        parser->last_key = parser->key;
+      }
+      parser->in_contents = false;
+    }else if(parser->in_cprefix){
+      if(0 < parser->key.length()){
+        list_parser_add_object(parser, parser->key.c_str(), true);
+        parser->last_key = parser->key;
+      }
+      parser->in_cprefix = false;
+    }else if(0 == strcmp(name, "Prefix")){
+      parser->prefix = parser->text;
+    }else if(0 == strcmp(name, "IsTruncated")){
+      parser->truncated = (0 == strcmp(parser->text.c_str(), "true"));
+    }else if(0 == strcmp(name, "NextMarker")){
+      parser->next_marker = parser->text;
+    }
+  }else if(3 == parser->depth){
+    if(parser->in_contents){
+      if(0 == strcmp(name, "Key")){
+        parser->key = parser->text;
+      }else if(0 == strcmp(name, "ETag")){
+        parser->etag = parser->text;
+      }else if(0 == strcmp(name, "Size")){
+        parser->size = parser->text;
+      }else if(0 == strcmp(name, "LastModified")){
+        parser->lastmod = parser->text;
+      }
+    }else if(parser->in_cprefix){
+      if(0 == strcmp(name, "Prefix")){
+        parser->key = parser->text;
       }
-      xmlFree(nslist);
     }
   }
-  return result;
+  parser->text.erase();
+  parser->depth--;
 }
 
-static int append_objects_from_xml(const char* path, const char *xml, S3ObjList& head)
+static void list_parser_characters(void* ctx, const xmlChar* ch, int len)
 {
-  xmlDocPtr doc;
-  xmlXPathContextPtr ctx;
-  string xmlnsurl;
-  string ex_contents = "//";
-  string ex_key      = "";
-  string ex_cprefix  = "//";
-  string ex_prefix   = "";
-  string ex_etag     = "";
+  list_bucket_parser* parser = reinterpret_cast<list_bucket_parser*>(ctx);
 
-  // If there is not <Prefix>, use path instead of it.
-  xmlChar* pprefix = get_prefix(xml);
-  string prefix = (pprefix ? (char*)pprefix : path ? path : "");
-  xmlFree(pprefix);
-
-  doc = xmlReadMemory(xml, strlen(xml), "", NULL, 0);
-  if(doc == NULL){
-    FGPRINT("  append_objects_from_xml xmlReadMemory returns with error.\n");
-    return -1;
+  // only leaf elements in ListBucketResult have the text.
+  if(2 <= parser->depth){
+    parser->text.append(reinterpret_cast<const char*>(ch), len);
   }
-  ctx = xmlXPathNewContext(doc);
-
-  if(!noxmlns && GetXmlNsUrl(doc, xmlnsurl)){
-    xmlXPathRegisterNs(ctx, (xmlChar*)"s3", (xmlChar*)xmlnsurl.c_str());
-    ex_contents+= "s3:";
-    ex_key     += "s3:";
-    ex_cprefix += "s3:";
-    ex_prefix  += "s3:";
-    ex_etag    += "s3:";
-  }
-  ex_contents+= "Contents";
-  ex_key     += "Key";
-  ex_cprefix += "CommonPrefixes";
-  ex_prefix  += "Prefix";
-  ex_etag    += "ETag";
-
-  if(-1 == append_objects_from_xml_ex(prefix.c_str(), doc, ctx, ex_contents.c_str(), ex_key.c_str(), ex_etag.c_str(), 0, head) ||
-     -1 == append_objects_from_xml_ex(prefix.c_str(), doc, ctx, ex_cprefix.c_str(), ex_prefix.c_str(), NULL, 1, head) )
-  {
-    FGPRINT("  append_objects_from_xml append_objects_from_xml_ex returns with error.\n");
-    xmlXPathFreeContext(ctx);
-    xmlFreeDoc(doc);
-    return -1;
-  }
-  xmlXPathFreeContext(ctx);
-  xmlFreeDoc(doc);
-
-  return 0;
 }
 
-static xmlChar* get_base_exp(const char* xml, const char* exp) {
-  xmlDocPtr doc;
-  xmlXPathContextPtr ctx;
-  xmlXPathObjectPtr marker_xp;
-  xmlNodeSetPtr nodes;
-  xmlChar* result;
-  string xmlnsurl;
-  string exp_string = "//";
-
-  doc = xmlReadMemory(xml, strlen(xml), "", NULL, 0);
-  ctx = xmlXPathNewContext(doc);
+static xmlSAXHandler list_parser_handler;
 
-  if(!noxmlns && GetXmlNsUrl(doc, xmlnsurl)){
-    xmlXPathRegisterNs(ctx, (xmlChar*)"s3", (xmlChar*)xmlnsurl.c_str());
-    exp_string += "s3:";
+static bool init_list_parser(list_bucket_parser* parser)
+{
+  if(parser->ctxt){
+    xmlFreeParserCtxt(parser->ctxt);
+  }
+  if(XML_SAX2_MAGIC != list_parser_handler.initialized){
+    memset(&list_parser_handler, 0, sizeof(xmlSAXHandler));
+    list_parser_handler.initialized    = XML_SAX2_MAGIC;
+    list_parser_handler.startElementNs = list_parser_start_element;
+    list_parser_handler.endElementNs   = list_parser_end_element;
+    list_parser_handler.characters     = list_parser_characters;
+  }
+  parser->depth       = 0;
+  parser->in_contents = false;
+  parser->in_cprefix  = false;
+  parser->truncated   = false;
+  parser->result      = 0;
+  parser->text.erase();
+  parser->prefix.erase();
+  parser->next_marker.erase();
+  parser->last_key.erase();
+  parser->body->Clear();
+
+  if(NULL == (parser->ctxt = xmlCreatePushParserCtxt(&list_parser_handler, parser, NULL, 0, NULL))){
+    FGPRINT("  init_list_parser xmlCreatePushParserCtxt returns with error.\n");
+    return false;
   }
-  exp_string += exp;
-
-  marker_xp = xmlXPathEvalExpression((xmlChar *)exp_string.c_str(), ctx);
-  nodes = marker_xp->nodesetval;
-
-  if(nodes->nodeNr < 1)
-    return NULL;
-
-  result = xmlNodeListGetString(doc, nodes->nodeTab[0]->xmlChildrenNode, 1);
-
-  xmlXPathFreeObject(marker_xp);
-  xmlXPathFreeContext(ctx);
-  xmlFreeDoc(doc);
-
-  return result;
+  return true;
 }
 
-static xmlChar* get_prefix(const char *xml) {
-  return get_base_exp(xml, "Prefix");
+static void reset_list_parser(void* data)
+{
+  // the response is received again from the beginning.
+  init_list_parser(reinterpret_cast<list_bucket_parser*>(data));
 }
 
-static xmlChar* get_next_marker(const char *xml) {
-  return get_base_exp(xml, "NextMarker");
+static void free_list_parser(list_bucket_parser* parser)
+{
+  if(parser->ctxt){
+    xmlFreeParserCtxt(parser->ctxt);
+    parser->ctxt = NULL;
+  }
 }
 
-static bool is_truncated(const char *xml) {
-  if(strstr(xml, "<IsTruncated>true</IsTruncated>"))
-    return true;
+static size_t WriteListBucketCallback(void* ptr, size_t blockSize, size_t numBlocks, void* userp)
+{
+  list_bucket_parser* parser = reinterpret_cast<list_bucket_parser*>(userp);
+  size_t              length = blockSize * numBlocks;
+  long                responseCode;
 
-  return false;
+  // error response is kept in body for check_curl_result().
+  if(CURLE_OK != curl_easy_getinfo(parser->curl, CURLINFO_RESPONSE_CODE, &responseCode) || 200 != responseCode){
+    return WriteMemoryCallback(ptr, blockSize, numBlocks, parser->body);
+  }
+  if(parser->ctxt && 0 == parser->result){
+    if(0 != xmlParseChunk(parser->ctxt, reinterpret_cast<const char*>(ptr), static_cast<int>(length), 0)){
+      FGPRINT("  WriteListBucketCallback xmlParseChunk returns with error.\n");
+      parser->result = -1;
+    }
+  }
+  return length;
 }
 
 // return: the pointer to object name on allocated memory.
 //         the pointer to "c_strErrorObjectName".(not allocated)
 //         NULL(a case of something error occured)
-static char *get_object_name(xmlDocPtr doc, xmlNodePtr node, const char* path)
+static char *get_object_name(const char* fullpath, const char* path)
 {
-  // Get full path
-  xmlChar*    fullpath= xmlNodeListGetString(doc, node, 1);
-  if(!fullpath){
+  if(!fullpath || '\0' == fullpath[0]){
     FGPRINT("  get_object_name could not get object full path name..\n");
     return NULL;
   }
   // basepath(path) is as same as fullpath.
-  if(0 == strcmp((char*)fullpath, path)){
-    xmlFree(fullpath);
+  if(0 == strcmp(fullpath, path)){
     return (char*)c_strErrorObjectName;
   }
 
   // Make dir path and filename
-  string   strfullpath= (char*)fullpath;
-  string   strdirpath = mydirname((char*)fullpath);
-  string   strmybpath = mybasename((char*)fullpath);
+  string   strdirpath = mydirname(fullpath);
+  string   strmybpath = mybasename(fullpath);
   const char* dirpath = strdirpath.c_str();
   const char* mybname = strmybpath.c_str();
   const char* basepath= (!path || '\0' == path[0] || '/' != path[0] ? path : &path[1]);
-  xmlFree(fullpath);
 
   if(!mybname || '\0' == mybname[0]){
     return NULL;
@@ -3508,7 +5081,39 @@ static void* s3fs_init(struct fuse_conn_info *conn)
   curl_global_init(CURL_GLOBAL_ALL);
   init_curl_handles_mutex();
   InitMimeType("/etc/mime.types");
-  init_curl_share(dns_cache);
+  init_curl_share(dns_cache, sslsession_cache);
+
+  // start the thread which sends all requests
+  if(!CurlEngine::getCurlEngine()->Start()){
+    SYSLOGERR("could not start CurlEngine, requests are sent in each thread.");
+  }
+
+  // make index of local cache files
+  if(0 < use_cache.size()){
+    mkdirp(use_cache, 0777);
+    if(!DiskCache::getDiskCache()->Init((use_cache + "/" + bucket).c_str(), (use_cache + "/." + bucket + ".index").c_str())){
+      SYSLOGERR("could not read cache directory %s.", use_cache.c_str());
+    }
+  }
+
+  // start revalidating stale stat cache entries
+  if(0 != StatCache::getStatCacheData()->GetStaleTime()){
+    if(!StatCache::getStatCacheData()->StartRevalidator(revalidate_stat_cache)){
+      SYSLOGERR("could not start revalidating stat cache, stale entries are not used.");
+    }
+  }
+
+  // start uploading dirty files in background
+  if(WriteBack::getWriteBack()->IsEnable()){
+    if(!WriteBack::getWriteBack()->Start(flush_local_fd, release_dirty_fd, save_dirty_fd)){
+      SYSLOGERR("could not start write-back threads, files are uploaded at flush.");
+    }
+  }
+
+  // start prefetching for sequential and strided reads
+  if(!ReadAhead::getReadAhead()->Start(load_local_fd)){
+    SYSLOGERR("could not start prefetch threads, read-ahead is disabled.");
+  }
 
   // Investigate system capabilities
   if((unsigned int)conn->capable & FUSE_CAP_ATOMIC_O_TRUNC){
@@ -3522,6 +5127,18 @@ static void s3fs_destroy(void*)
   SYSLOGDBG("destroy");
   FGPRINT("s3fs_destroy\n");
 
+  if(0 < use_cache.size()){
+    unsigned long hit, miss, evict;
+    DiskCache::getDiskCache()->GetCounts(&hit, &miss, &evict);
+    SYSLOGINFO("cache files: hit(%lu), miss(%lu), evict(%lu)", hit, miss, evict);
+  }
+
+  // upload dirty files, and stop prefetching, revalidating and sending requests
+  WriteBack::getWriteBack()->Stop();
+  ReadAhead::getReadAhead()->Stop();
+  StatCache::getStatCacheData()->StopRevalidator();
+  CurlEngine::getCurlEngine()->Stop();
+
   // openssl
   CRYPTO_set_id_callback(NULL);
   CRYPTO_set_locking_callback(NULL);
@@ -3530,9 +5147,10 @@ static void s3fs_destroy(void*)
   }
   free(mutex_buf);
   mutex_buf = NULL;
-  destroy_curl_share(dns_cache);
-  curl_global_cleanup();
+  // handles in pool must be cleaned up before the share handle.
   destroy_curl_handles_mutex();
+  destroy_curl_share();
+  curl_global_cleanup();
 }
 
 static int s3fs_access(const char *path, int mask)
@@ -3564,6 +5182,14 @@ static int s3fs_utimens(const char *path, const struct timespec ts[2]) {
   if(0 != (result = check_object_owner(path, &stbuf))){
     return result;
   }
+  // the new file which is not uploaded yet is changed locally.
+  if(utimens_new_object(path, ts)){
+    return 0;
+  }
+  // the dirty file is uploaded before changing the object
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
 
   if(S_ISDIR(stbuf.st_mode)){
     result      = chk_dir_object_type(path, newpath, strpath, nowcache, &meta, &nDirType);
@@ -3626,6 +5252,12 @@ static int s3fs_utimens_nocopy(const char *path, const struct timespec ts[2]) {
   if(0 != (result = check_object_owner(path, &stbuf))){
     return result;
   }
+  if(utimens_new_object(path, ts)){
+    return 0;
+  }
+  if(0 != (result = WriteBack::getWriteBack()->Sync(path))){
+    return result;
+  }
 
   // Get attributes
   if(S_ISDIR(stbuf.st_mode)){
@@ -4200,6 +5832,21 @@ static int my_fuse_opt_proc(void *data, const char *arg, int key, struct fuse_ar
       retries = atoi(strchr(arg, '=') + 1);
       return 0;
     }
+    if (strstr(arg, "max_cache_size=") != 0) {
+      off_t size = static_cast<off_t>(strtoull(strchr(arg, '=') + 1, 0, 10)) * 1024 * 1024;
+      DiskCache::getDiskCache()->SetMaxSize(size);
+      return 0;
+    }
+    if (strstr(arg, "cache_watermark=") != 0) {
+      int low  = atoi(strchr(arg, '=') + 1);
+      int high = (strchr(arg, ':') ? atoi(strchr(arg, ':') + 1) : DISK_CACHE_HIGH_WATERMARK);
+      if(!DiskCache::getDiskCache()->SetWatermark(low, high)){
+        fprintf(stderr, "%s: poorly formed argument to option: cache_watermark\n",
+                program_name.c_str());
+        return -1;
+      }
+      return 0;
+    }
     if (strstr(arg, "use_cache=") != 0) {
       use_cache = strchr(arg, '=') + 1;
       return 0;
@@ -4298,14 +5945,69 @@ static int my_fuse_opt_proc(void *data, const char *arg, int key, struct fuse_ar
       StatCache::getStatCacheData()->SetExpireTime(expr_time);
       return 0;
     }
+    if (strstr(arg, "stat_cache_stale=") != 0) {
+      time_t stale_time = strtoul(strchr(arg, '=') + 1, 0, 10);
+      StatCache::getStatCacheData()->SetStaleTime(stale_time);
+      return 0;
+    }
     if(strstr(arg, "enable_noobj_cache") != 0) {
       StatCache::getStatCacheData()->EnableCacheNoObject();
       return 0;
     }
+    if(strstr(arg, "enable_list_stat") != 0) {
+      list_stat = true;
+      return 0;
+    }
+    if (strstr(arg, "parallel_count=") != 0) {
+      parallel_count = atoi(strchr(arg, '=') + 1);
+      if(0 >= parallel_count){
+        fprintf(stderr, "%s: argument should be over 1: parallel_count\n", 
+                program_name.c_str());
+        return -1;
+      }
+      return 0;
+    }
+    if (strstr(arg, "parallel_copy_count=") != 0) {
+      parallel_copy_count = atoi(strchr(arg, '=') + 1);
+      if(0 >= parallel_copy_count){
+        fprintf(stderr, "%s: argument should be over 1: parallel_copy_count\n", 
+                program_name.c_str());
+        return -1;
+      }
+      return 0;
+    }
+    if (strstr(arg, "download_chunk_size=") != 0) {
+      off_t chunk_mb = strtol(strchr(arg, '=') + 1, 0, 10);
+      if(0 >= chunk_mb){
+        fprintf(stderr, "%s: argument should be over 1(MB): download_chunk_size\n", 
+                program_name.c_str());
+        return -1;
+      }
+      download_chunk_size = chunk_mb * 1024 * 1024;
+      return 0;
+    }
+    if (strstr(arg, "writeback_delay=") != 0) {
+      time_t delay = static_cast<time_t>(strtoul(strchr(arg, '=') + 1, 0, 10));
+      WriteBack::getWriteBack()->SetDelay(delay);
+      return 0;
+    }
+    if (0 == strcmp(arg, "writeback")) {
+      WriteBack::getWriteBack()->SetEnable(true);
+      return 0;
+    }
+    if (strstr(arg, "readahead_size=") != 0) {
+      off_t size = static_cast<off_t>(strtoull(strchr(arg, '=') + 1, 0, 10)) * 1024 * 1024;
+      ReadAhead::getReadAhead()->SetMaxWindow(size);
+      return 0;
+    }
     if(strstr(arg, "nodnscache") != 0) {
       dns_cache = false;
       return 0;
     }
+    if(strstr(arg, "nosscache") != 0) {
+      sslsession_cache = false;
+      return 0;
+    }
     if(strstr(arg, "noxmlns") != 0) {
       noxmlns = true;
       return 0;
@@ -4576,9 +6278,11 @@ int main(int argc, char *argv[]) {
   s3fs_oper.write = s3fs_write;
   s3fs_oper.statfs = s3fs_statfs;
   s3fs_oper.flush = s3fs_flush;
+  s3fs_oper.fsync = s3fs_fsync;
   s3fs_oper.release = s3fs_release;
   s3fs_oper.opendir = s3fs_opendir;
   s3fs_oper.readdir = s3fs_readdir;
+  s3fs_oper.releasedir = s3fs_releasedir;
   s3fs_oper.init = s3fs_init;
   s3fs_oper.destroy = s3fs_destroy;
   s3fs_oper.access = s3fs_access;
@@ -5,6 +5,7 @@
 #define MULTIPART_SIZE        10485760     // 10MB
 #define MAX_REQUESTS          100          // max number of concurrent HTTP requests
 #define MAX_COPY_SOURCE_SIZE  524288000    // 500MB
+#define MAX_DELETE_OBJECTS    1000         // max number of keys in Multi-Object Delete request
 #define FIVE_GB               5368709120LL
 
 #include <fuse.h>
@@ -65,7 +65,7 @@ string get_realpath(const char *path) {
 // If name is terminated by "_$folder$", it is forced dir type.
 // If is_dir is true and name is not terminated by "/", the name is added "/".
 //
-bool S3ObjList::insert(const char* name, const char* etag, bool is_dir)
+bool S3ObjList::insert(const char* name, const char* etag, bool is_dir, off_t size, time_t mtime)
 {
   if(!name || '\0' == name[0]){
     return false;
@@ -118,6 +118,10 @@ bool S3ObjList::insert(const char* name, const char* etag, bool is_dir)
     if(etag){
       (*iter).second.etag = string(etag);  // over write
     }
+    if(!is_dir && 0 <= size){
+      (*iter).second.size  = size;
+      (*iter).second.mtime = mtime;
+    }
   }else{
     // add new object
     s3obj_entry newobject;
@@ -126,6 +130,10 @@ bool S3ObjList::insert(const char* name, const char* etag, bool is_dir)
     if(etag){
       newobject.etag = etag;
     }
+    if(!is_dir && 0 <= size){
+      newobject.size  = size;
+      newobject.mtime = mtime;
+    }
     objects[newname] = newobject;
   }
 
@@ -133,6 +141,23 @@ bool S3ObjList::insert(const char* name, const char* etag, bool is_dir)
   return insert_nomalized(orgname.c_str(), newname.c_str(), is_dir);
 }
 
+//
+// Add all objects in list, the normalized names are made again.
+//
+bool S3ObjList::insert(const S3ObjList& list)
+{
+  for(s3obj_t::const_iterator iter = list.begin(); iter != list.end(); ++iter){
+    if(0 < (*iter).second.normalname.length()){
+      continue;
+    }
+    const string& name = (0 < (*iter).second.orgname.length() ? (*iter).second.orgname : (*iter).first);
+    if(!insert(name.c_str(), (*iter).second.etag.c_str(), (*iter).second.is_dir, (*iter).second.size, (*iter).second.mtime)){
+      return false;
+    }
+  }
+  return true;
+}
+
 bool S3ObjList::insert_nomalized(const char* name, const char* normalized, bool is_dir)
 {
   if(!name || '\0' == name[0] || !normalized || '\0' == normalized[0]){
@@ -224,6 +249,21 @@ bool S3ObjList::IsDir(const char* name) const
   return ps3obj->is_dir;
 }
 
+bool S3ObjList::GetListStat(const char* name, off_t& size, time_t& mtime) const
+{
+  const s3obj_entry* ps3obj;
+
+  if(NULL == (ps3obj = GetS3Obj(name))){
+    return false;
+  }
+  if(ps3obj->is_dir || 0 > ps3obj->size){
+    return false;
+  }
+  size  = ps3obj->size;
+  mtime = ps3obj->mtime;
+  return true;
+}
+
 bool S3ObjList::GetNameList(s3obj_list_t& list, bool OnlyNormalized, bool CutSlash) const
 {
   s3obj_t::const_iterator iter;
@@ -636,6 +676,20 @@ time_t get_lastmodified(headers_t& meta)
   return get_lastmodified((*iter).second.c_str());
 }
 
+// Convert LastModified in ListBucket result(ex. "2013-06-05T12:00:00.000Z")
+time_t get_iso8601_time(const char* s)
+{
+  struct tm tm;
+  if(!s){
+    return 0L;
+  }
+  memset(&tm, 0, sizeof(struct tm));
+  if(NULL == strptime(s, "%Y-%m-%dT%H:%M:%S", &tm)){
+    return 0L;
+  }
+  return timegm(&tm);      // GMT
+}
+
 //-------------------------------------------------------------------
 // Help
 //-------------------------------------------------------------------
@@ -673,6 +727,16 @@ void show_help (void)
     "   use_cache (default=\"\" which means disabled)\n"
     "      - local folder to use for local file cache\n"
     "\n"
+    "   max_cache_size (default=\"0\" which means no limit)\n"
+    "      - maximum size(MB) of local file cache. If the cache files are\n"
+    "      over it, least recently used files which are not opened are\n"
+    "      removed.\n"
+    "\n"
+    "   cache_watermark (default=\"70:90\")\n"
+    "      - low and high watermark(percent of max_cache_size) for\n"
+    "      removing cache files. Removing starts when the cache is over\n"
+    "      the high watermark, and stops under the low watermark.\n"
+    "\n"
     "   use_rrs (default=\"\" which means diabled)\n"
     "      - use Amazon's Reduced Redundancy Storage when set to 1\n"
     "\n"
@@ -697,6 +761,13 @@ void show_help (void)
     "   stat_cache_expire (default is no expire)\n"
     "      - specify expire time(seconds) for entries in the stat cache.\n"
     "\n"
+    "   stat_cache_stale (default is disable)\n"
+    "      - specify time(seconds) to use the expired entries in the stat\n"
+    "      cache. The expired entry is returned and revalidated in the\n"
+    "      background by HEAD request with If-None-Match. Frequently used\n"
+    "      entries are also refreshed before they expire.\n"
+    "      This option needs stat_cache_expire.\n"
+    "\n"
     "   enable_noobj_cache (default is disable)\n"
     "      - enable cache entries for the object which does not exist.\n"
     "      s3fs always has to check whether file(or sub directory) exists \n"
@@ -707,8 +778,58 @@ void show_help (void)
     "      You can specify this option for performance, s3fs memorizes \n"
     "      in stat cache that the object(file or directory) does not exist.\n"
     "\n"
+    "   enable_list_stat (default is disable)\n"
+    "      - make stat cache entries of files from the size, last modified \n"
+    "      time and ETag in ListBucket result when listing a directory.\n"
+    "      s3fs does not send HEAD request for each file in the directory, \n"
+    "      but the mode, uid, gid and mtime in x-amz-meta-* headers(ex. \n"
+    "      set by chmod, chown, and symbolic link) are not reflected, and \n"
+    "      the file has default attributes like the object which is not \n"
+    "      made by s3fs. When s3fs needs the headers of the file(ex. chmod, \n"
+    "      rename, open), s3fs sends HEAD request.\n"
+    "\n"
+    "   parallel_count (default=\"5\")\n"
+    "      - number of parallel requests for downloading and uploading\n"
+    "        a large object. s3fs downloads the object by ranged GET\n"
+    "        requests and uploads the parts of multipart upload in parallel.\n"
+    "        If this is 1, those requests are sent one by one.\n"
+    "\n"
+    "   parallel_copy_count (default=\"10\")\n"
+    "      - number of parallel UploadPartCopy requests for copying a large\n"
+    "        object in the server(ex. rename, chmod), and number of objects\n"
+    "        copied in parallel for renaming a directory. A failed part or\n"
+    "        object is retried by itself.\n"
+    "\n"
+    "   download_chunk_size (default=\"10\" MB)\n"
+    "      - size of a part which is downloaded by a ranged GET request\n"
+    "        in parallel downloading. The reads load the object by 4MB\n"
+    "        pages, then those are split into parts only when this is\n"
+    "        smaller than 4MB. Otherwise the parts are used only when all\n"
+    "        of the object is downloaded(ex. uploading a modified file,\n"
+    "        chmod with nocopyapi).\n"
+    "\n"
+    "   writeback (default is disabled)\n"
+    "      - upload the written files in background after close. The files\n"
+    "        are uploaded after writeback_delay seconds from last close, and\n"
+    "        fsync uploads the file immediately. A failed upload is retried\n"
+    "        with doubled delay(up to 64 times of writeback_delay), and the\n"
+    "        file which could not be uploaded at unmount is saved under\n"
+    "        .s3fs-unuploaded directory in use_cache directory(or /tmp).\n"
+    "\n"
+    "   writeback_delay (default=\"5\" seconds)\n"
+    "      - delay of uploading after last close in writeback mode. The file\n"
+    "        is uploaded at 4 times of this after first close at latest.\n"
+    "\n"
+    "   readahead_size (default=\"64\" MB)\n"
+    "      - maximum size of prefetching for sequential reads. The following\n"
+    "        pages are prefetched when the reads are sequential or strided,\n"
+    "        \"0\" disables prefetching.\n"
+    "\n"
     "   nodnscache - disable dns cache\n"
     "      - s3fs is always using dns cache, this option make dns cache disable.\n"
+    "\n"    "   nosscache - disable ssl session cache\n"
+    "      - s3fs is always using ssl session cache, this option make ssl\n"
+    "        session cache disable.\n"
     "\n"
     "   url (default=\"http://s3.amazonaws.com\")\n"
     "      - sets the url to use to access amazon s3\n"
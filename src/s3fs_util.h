@@ -12,8 +12,10 @@ struct s3obj_entry{
   std::string orgname;    // original name: if empty, object is original name.
   std::string etag;
   bool        is_dir;
+  off_t       size;       // size in listing: if -1, object does not have it.
+  time_t      mtime;      // last modified in listing
 
-  s3obj_entry() : is_dir(false) {}
+  s3obj_entry() : is_dir(false), size(-1), mtime(0) {}
 };
 
 typedef std::map<std::string, struct s3obj_entry> s3obj_t;
@@ -45,11 +47,13 @@ class S3ObjList
     bool IsEmpty(void) const {
       return objects.empty();
     }
-    bool insert(const char* name, const char* etag = NULL, bool is_dir = false);
+    bool insert(const char* name, const char* etag = NULL, bool is_dir = false, off_t size = -1, time_t mtime = 0);
+    bool insert(const S3ObjList& list);
     std::string GetOrgName(const char* name) const;
     std::string GetNormalizedName(const char* name) const;
     std::string GetETag(const char* name) const;
     bool IsDir(const char* name) const;
+    bool GetListStat(const char* name, off_t& size, time_t& mtime) const;
     bool GetNameList(s3obj_list_t& list, bool OnlyNormalized = true, bool CutSlash = true) const;
 
     static bool MakeHierarchizedList(s3obj_list_t& list, bool haveSlash);
@@ -93,6 +97,7 @@ gid_t get_gid(headers_t& meta);
 blkcnt_t get_blocks(off_t size);
 time_t get_lastmodified(const char* s);
 time_t get_lastmodified(headers_t& meta);
+time_t get_iso8601_time(const char* s);
 
 void show_usage(void);
 void show_help(void);
@@ -0,0 +1,371 @@
+/*
+ * s3fs - FUSE-based file system backed by Amazon S3
+ *
+ * Copyright 2007-2008 Randy Rizun <rrizun@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <assert.h>
+#include <string>
+#include <map>
+#include <list>
+#include <algorithm>
+
+#include "common.h"
+#include "writeback.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------
+// Static
+//-------------------------------------------------------------------
+WriteBack WriteBack::singleton;
+pthread_mutex_t WriteBack::writeback_lock;
+pthread_cond_t  WriteBack::writeback_cond;
+
+//-------------------------------------------------------------------
+// Class WriteBack
+//-------------------------------------------------------------------
+WriteBack::WriteBack() : is_enable(false), is_running(false), is_stop(false), upload_func(NULL), release_func(NULL), save_func(NULL)
+{
+  if(this == WriteBack::getWriteBack()){
+    pthread_mutex_init(&(WriteBack::writeback_lock), NULL);
+    pthread_cond_init(&(WriteBack::writeback_cond), NULL);
+  }else{
+    assert(false);
+  }
+  Delay = WRITEBACK_DEFAULT_DELAY;
+}
+
+WriteBack::~WriteBack()
+{
+  if(this == WriteBack::getWriteBack()){
+    pthread_mutex_destroy(&(WriteBack::writeback_lock));
+    pthread_cond_destroy(&(WriteBack::writeback_cond));
+  }else{
+    assert(false);
+  }
+}
+
+bool WriteBack::SetEnable(bool flag)
+{
+  bool old  = is_enable;
+  is_enable = flag;
+  return old;
+}
+
+time_t WriteBack::SetDelay(time_t delay)
+{
+  time_t old = Delay;
+  Delay      = delay;
+  return old;
+}
+
+bool WriteBack::Start(writeback_upload_t upload, writeback_release_t release, writeback_save_t save)
+{
+  if(!is_enable || is_running || !upload || !release || !save){
+    return false;
+  }
+  upload_func  = upload;
+  release_func = release;
+  save_func    = save;
+  is_stop      = false;
+  for(int cnt = 0; cnt < WRITEBACK_THREADS; cnt++){
+    if(0 != pthread_create(&threads[cnt], NULL, WriteBack::Worker, this)){
+      SYSLOGERR("could not create upload thread for write-back.");
+      // stop threads which are already created.
+      pthread_mutex_lock(&WriteBack::writeback_lock);
+      is_stop = true;
+      pthread_cond_broadcast(&WriteBack::writeback_cond);
+      pthread_mutex_unlock(&WriteBack::writeback_lock);
+      for(int cnt2 = 0; cnt2 < cnt; cnt2++){
+        pthread_join(threads[cnt2], NULL);
+      }
+      return false;
+    }
+  }
+  is_running = true;
+  return true;
+}
+
+//
+// Stop threads, and upload all dirty files in caller thread.
+// The file which could not be uploaded is saved by save_func before its
+// reference of fd is released.
+//
+bool WriteBack::Stop(void)
+{
+  if(!is_running){
+    return true;
+  }
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  is_stop = true;
+  pthread_cond_broadcast(&WriteBack::writeback_cond);
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  for(int cnt = 0; cnt < WRITEBACK_THREADS; cnt++){
+    pthread_join(threads[cnt], NULL);
+  }
+
+  bool result = true;
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  while(!entries.empty()){
+    writeback_map_t::iterator iter = entries.begin();
+    string path = iter->first;
+    int    fd   = iter->second.fd;
+    if(0 != Upload(iter)){
+      SYSLOGERR("could not upload dirty file[path=%s] at stopping.", path.c_str());
+      result = false;
+      if(entries.end() != (iter = entries.find(path))){
+        entries.erase(iter);
+        pthread_mutex_unlock(&WriteBack::writeback_lock);
+        (*save_func)(path.c_str(), fd);
+        (*release_func)(path.c_str(), fd);
+        pthread_mutex_lock(&WriteBack::writeback_lock);
+      }
+    }
+  }
+  is_running = false;
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  return result;
+}
+
+time_t WriteBack::GetDueTime(const writeback_entry& ent) const
+{
+  if(0 < ent.retry){
+    // back off after failed uploads(first_time is the time of last failure)
+    return ent.first_time + (Delay << min(ent.retry - 1, WRITEBACK_MAX_BACKOFF));
+  }
+  return min(ent.last_time + Delay, ent.first_time + Delay * WRITEBACK_MAX_DELAY_RATE);
+}
+
+//
+// Upload the entry(need to lock), the lock is released while uploading.
+// If the file is not flushed again while uploading, the entry is removed
+// and the reference of fd is released. If uploading is failed, the entry
+// is retried after Delay, and the delay is doubled by each failure up to
+// Delay << WRITEBACK_MAX_BACKOFF. The entry is kept until it is uploaded
+// even if the error is permanent(ex. EACCES), and the error is returned
+// by GetError() for flush.
+//
+int WriteBack::Upload(writeback_map_t::iterator iter)
+{
+  string path = iter->first;
+  int    fd   = iter->second.fd;
+
+  iter->second.is_running = true;
+  iter->second.is_redirty = false;
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  FGPRINT("    WriteBack: uploading[path=%s][fd=%d]\n", path.c_str(), fd);
+  int result = (*upload_func)(path.c_str(), fd);
+
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  // the entry is not removed while uploading.
+  iter = entries.find(path);
+  iter->second.is_running = false;
+  if(0 != result){
+    SYSLOGERR("write-back upload failed[path=%s]: %d", path.c_str(), result);
+    FGPRINT("    WriteBack: failed to upload[path=%s]: %d\n", path.c_str(), result);
+    iter->second.retry++;
+    iter->second.error      = result;
+    iter->second.first_time = iter->second.last_time = time(NULL);
+  }else if(iter->second.is_redirty){
+    iter->second.retry      = 0;
+    iter->second.error      = 0;
+    iter->second.first_time = iter->second.last_time;
+  }else{
+    entries.erase(iter);
+    pthread_mutex_unlock(&WriteBack::writeback_lock);
+    (*release_func)(path.c_str(), fd);
+    pthread_mutex_lock(&WriteBack::writeback_lock);
+  }
+  pthread_cond_broadcast(&WriteBack::writeback_cond);
+
+  return result;
+}
+
+void* WriteBack::Worker(void* arg)
+{
+  WriteBack* pwb = reinterpret_cast<WriteBack*>(arg);
+
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  while(!pwb->is_stop){
+    // find the entry which should be uploaded, and the next due time.
+    time_t now  = time(NULL);
+    time_t next = now + pwb->Delay;
+    writeback_map_t::iterator iter;
+    for(iter = pwb->entries.begin(); pwb->entries.end() != iter; ++iter){
+      if(iter->second.is_running){
+        continue;
+      }
+      time_t due = pwb->GetDueTime(iter->second);
+      if(due <= now){
+        break;
+      }
+      next = min(next, due);
+    }
+    if(pwb->entries.end() != iter){
+      pwb->Upload(iter);
+      continue;
+    }
+    struct timespec ts;
+    ts.tv_sec  = max(next, now + 1);
+    ts.tv_nsec = 0;
+    pthread_cond_timedwait(&WriteBack::writeback_cond, &WriteBack::writeback_lock, &ts);
+  }
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  return NULL;
+}
+
+bool WriteBack::Add(const char* path, int fd)
+{
+  if(!is_running || !path){
+    return false;
+  }
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  writeback_map_t::iterator iter = entries.find(string(path));
+  if(entries.end() != iter){
+    iter->second.last_time = now;
+    if(iter->second.is_running){
+      iter->second.is_redirty = true;
+    }
+    pthread_mutex_unlock(&WriteBack::writeback_lock);
+    return false;
+  }
+  entries[string(path)] = writeback_entry(fd, now);
+  pthread_cond_broadcast(&WriteBack::writeback_cond);
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  FGPRINT("    WriteBack: dirty[path=%s][fd=%d]\n", path, fd);
+  return true;
+}
+
+bool WriteBack::IsDirty(const char* path)
+{
+  if(!is_running || !path){
+    return false;
+  }
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  bool result = (entries.end() != entries.find(string(path)));
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  return result;
+}
+
+int WriteBack::GetError(const char* path)
+{
+  if(!is_running || !path){
+    return 0;
+  }
+  int result = 0;
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  writeback_map_t::iterator iter = entries.find(string(path));
+  if(entries.end() != iter){
+    result = iter->second.error;
+  }
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  return result;
+}
+
+//
+// Upload the dirty file in caller thread. If it is uploading by other
+// thread, wait for it and upload again for the changes after that.
+//
+int WriteBack::Sync(const char* path)
+{
+  if(!is_running || !path){
+    return 0;
+  }
+  int result = 0;
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  writeback_map_t::iterator iter;
+  while(entries.end() != (iter = entries.find(string(path)))){
+    if(iter->second.is_running){
+      pthread_cond_wait(&WriteBack::writeback_cond, &WriteBack::writeback_lock);
+      continue;
+    }
+    result = Upload(iter);
+    break;
+  }
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  return result;
+}
+
+int WriteBack::SyncDir(const char* path)
+{
+  if(!is_running || !path){
+    return 0;
+  }
+  string dir = path;
+  if(0 == dir.length() || '/' != dir[dir.length() - 1]){
+    dir += "/";
+  }
+  list<string> paths;
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  for(writeback_map_t::iterator iter = entries.begin(); entries.end() != iter; ++iter){
+    if(0 == iter->first.compare(0, dir.length(), dir)){
+      paths.push_back(iter->first);
+    }
+  }
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  int result = 0;
+  for(list<string>::iterator iter = paths.begin(); paths.end() != iter; ++iter){
+    if(0 != (result = Sync(iter->c_str()))){
+      break;
+    }
+  }
+  return result;
+}
+
+bool WriteBack::Remove(const char* path)
+{
+  if(!is_running || !path){
+    return false;
+  }
+  pthread_mutex_lock(&WriteBack::writeback_lock);
+  writeback_map_t::iterator iter;
+  while(entries.end() != (iter = entries.find(string(path))) && iter->second.is_running){
+    pthread_cond_wait(&WriteBack::writeback_cond, &WriteBack::writeback_lock);
+  }
+  if(entries.end() == iter){
+    pthread_mutex_unlock(&WriteBack::writeback_lock);
+    return false;
+  }
+  int fd = iter->second.fd;
+  entries.erase(iter);
+  pthread_cond_broadcast(&WriteBack::writeback_cond);
+  pthread_mutex_unlock(&WriteBack::writeback_lock);
+
+  FGPRINT("    WriteBack: discard[path=%s][fd=%d]\n", path, fd);
+  (*release_func)(path, fd);
+  return true;
+}
@@ -0,0 +1,112 @@
+#ifndef S3FS_WRITEBACK_H_
+#define S3FS_WRITEBACK_H_
+
+//
+// Define
+//
+#define WRITEBACK_THREADS         4     // count of upload threads
+#define WRITEBACK_DEFAULT_DELAY   5     // default delay(sec) after last flush
+#define WRITEBACK_MAX_DELAY_RATE  4     // upload at Delay * rate after first flush at latest
+#define WRITEBACK_MAX_BACKOFF     6     // retry delay after failed uploads is doubled up to Delay << this
+
+//
+// Typedef
+//
+// upload fd of path if it is modified, called in upload thread.
+typedef int (*writeback_upload_t)(const char* path, int fd);
+// release the reference of fd which is kept while the file is dirty.
+typedef void (*writeback_release_t)(const char* path, int fd);
+// save the dirty file which could not be uploaded at stopping.
+typedef int (*writeback_save_t)(const char* path, int fd);
+
+//
+// Struct
+//
+struct writeback_entry {
+  int    fd;
+  time_t first_time;  // time of first flush after last uploading
+  time_t last_time;   // time of last flush
+  bool   is_running;  // uploading now
+  bool   is_redirty;  // flushed again while uploading
+  int    retry;       // count of continuous failed uploads
+  int    error;       // result of last failed upload
+
+  writeback_entry(int nfd = -1, time_t now = 0)
+    : fd(nfd), first_time(now), last_time(now), is_running(false), is_redirty(false), retry(0), error(0) {}
+};
+
+typedef std::map<std::string, writeback_entry> writeback_map_t;   // key=path
+
+//
+// Class WriteBack
+//
+// Keeps the files which are flushed but not uploaded yet(dirty), and
+// uploads them by threads after Delay seconds from last flush. The flushes
+// in Delay are coalesced into one upload, and the file is uploaded at
+// Delay * WRITEBACK_MAX_DELAY_RATE after first flush at latest.
+// The dirty file keeps one reference of its shared fd, then following
+// opens use the local file. The reference is released after uploading.
+// A failed upload is retried with doubled delay(up to WRITEBACK_MAX_BACKOFF),
+// and the file is kept until it is uploaded. The file which could not be
+// uploaded at stopping is saved by save_func, it is not discarded.
+//
+class WriteBack
+{
+  private:
+    static WriteBack singleton;
+    static pthread_mutex_t writeback_lock;
+    static pthread_cond_t  writeback_cond;   // signaled when entry is added or uploaded
+    pthread_t           threads[WRITEBACK_THREADS];
+    bool                is_enable;
+    bool                is_running;
+    bool                is_stop;
+    time_t              Delay;
+    writeback_upload_t  upload_func;
+    writeback_release_t release_func;
+    writeback_save_t    save_func;
+    writeback_map_t     entries;
+
+  private:
+    static void* Worker(void* arg);
+    time_t GetDueTime(const writeback_entry& ent) const;
+    int Upload(writeback_map_t::iterator iter);
+
+  public:
+    WriteBack();
+    ~WriteBack();
+
+    // Reference singleton
+    static WriteBack* getWriteBack(void) {
+      return &singleton;
+    }
+
+    bool SetEnable(bool flag);
+    bool IsEnable(void) const {
+      return is_enable;
+    }
+    time_t SetDelay(time_t delay);
+    time_t GetDelay(void) const {
+      return Delay;
+    }
+
+    bool Start(writeback_upload_t upload, writeback_release_t release, writeback_save_t save);
+    bool Stop(void);
+    bool IsRunning(void) const {
+      return is_running;
+    }
+
+    // Add dirty file, returns false if it is already dirty(then the caller
+    // releases own reference of fd).
+    bool Add(const char* path, int fd);
+    bool IsDirty(const char* path);
+    // Result of last upload of dirty file(0 if it is not failed)
+    int GetError(const char* path);
+    // Upload dirty file now, and wait for it
+    int Sync(const char* path);
+    // Upload dirty files under the directory
+    int SyncDir(const char* path);
+    // Discard dirty file(ex. the file is removed)
+    bool Remove(const char* path);
+};
+
+#endif // S3FS_WRITEBACK_H_
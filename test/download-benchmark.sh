@@ -0,0 +1,109 @@
+#!/bin/bash -e
+#
+# Benchmark for downloading a large object with parallel ranged GET.
+#
+# This script starts mock-s3-server.py on local machine, puts a large
+# object, and measures the time of downloading all of it through s3fs for
+# each parallel_count. The throughput of each connection on the mock
+# server is limited by MOCK_RATE(KB/s) like as a single TCP stream to S3.
+#
+# The reads are loaded by 4MB pages, and a page is not split because the
+# default download_chunk_size(10MB) is larger than it. So this script
+# measures the full download path with default options instead: chmod
+# with nocopyapi opens the object not lazily, then all of the object is
+# downloaded by download_chunk_size parts in parallel, and uploaded again.
+# The download time is taken from the ranged GET requests on the mock
+# server, and the script checks that those were sent in parallel and that
+# the uploaded object is same as the original.
+#
+# Usage: download-benchmark.sh [object size(MB)] [parallel counts...]
+#   ex)  download-benchmark.sh 100 1 2 4
+#
+
+# Require root
+REQUIRE_ROOT=require-root.sh
+source $REQUIRE_ROOT
+
+S3FS=../src/s3fs
+MOCK_SERVER=./mock-s3-server.py
+MOCK_PORT=${MOCK_PORT:-8080}
+MOCK_RATE=${MOCK_RATE:-10240}
+MOCK_LATENCY=${MOCK_LATENCY:-20}
+
+BENCH_BUCKET=s3fs-benchmark
+BENCH_FILE=bench-object
+BENCH_SIZE=${1:-100}
+shift || true
+PARALLEL_COUNTS=${@:-1 2 4}
+
+# s3fs sends requests to "bucket.localhost"
+if ! getent hosts $BENCH_BUCKET.localhost > /dev/null; then
+	echo "error: $BENCH_BUCKET.localhost is not resolved, add it to /etc/hosts as 127.0.0.1"
+	exit 1
+fi
+
+WORK_DIR=`mktemp -d /tmp/s3fs-benchmark.XXXXXX`
+MOUNT_POINT=$WORK_DIR/mnt
+PASSWD_FILE=$WORK_DIR/passwd
+MOCK_PID=
+
+cleanup() {
+	if mount | grep -q " $MOUNT_POINT "; then
+		fusermount -u $MOUNT_POINT || umount $MOUNT_POINT
+	fi
+	if [ -n "$MOCK_PID" ]; then
+		kill $MOCK_PID
+	fi
+	rm -rf $WORK_DIR
+}
+trap cleanup EXIT
+
+mkdir -p $MOUNT_POINT
+echo "dummyaccesskey:dummysecretkey" > $PASSWD_FILE
+chmod 600 $PASSWD_FILE
+
+# Start mock server
+python $MOCK_SERVER --port $MOCK_PORT --rate $MOCK_RATE --latency $MOCK_LATENCY &
+MOCK_PID=$!
+sleep 1
+
+# Put the object
+echo "Putting ${BENCH_SIZE}MB object ..."
+dd if=/dev/urandom of=$WORK_DIR/$BENCH_FILE bs=1M count=$BENCH_SIZE 2>/dev/null
+curl -s -X PUT --data-binary @$WORK_DIR/$BENCH_FILE \
+	-H "x-amz-meta-mode: 33188" -H "x-amz-meta-mtime: `date +%s`" \
+	http://127.0.0.1:$MOCK_PORT/$BENCH_BUCKET/$BENCH_FILE
+EXPECT_MD5=`md5sum $WORK_DIR/$BENCH_FILE | awk '{print $1}'`
+
+echo "per connection rate: ${MOCK_RATE}KB/s, latency: ${MOCK_LATENCY}ms"
+for COUNT in $PARALLEL_COUNTS
+do
+	$S3FS $BENCH_BUCKET $MOUNT_POINT -o passwd_file=$PASSWD_FILE \
+		-o url=http://localhost:$MOCK_PORT \
+		-o parallel_count=$COUNT -o nocopyapi
+	sleep 1
+
+	curl -s "http://127.0.0.1:$MOCK_PORT/mock-stats?reset" > /dev/null
+	START=`date +%s.%N`
+	chmod 644 $MOUNT_POINT/$BENCH_FILE
+	END=`date +%s.%N`
+	STATS=`curl -s http://127.0.0.1:$MOCK_PORT/mock-stats`
+
+	fusermount -u $MOUNT_POINT || umount $MOUNT_POINT
+	sleep 1
+
+	RESULT_MD5=`curl -s http://127.0.0.1:$MOCK_PORT/$BENCH_BUCKET/$BENCH_FILE | md5sum | awk '{print $1}'`
+	if [ "$RESULT_MD5" != "$EXPECT_MD5" ]; then
+		echo "error: parallel_count=$COUNT, uploaded object is not same"
+		exit 1
+	fi
+	# the whole object must be downloaded in parallel(up to parallel_count)
+	MAX_RUNNING=`echo "$STATS" | sed -n 's/.*max_concurrent_ranged_gets=\([0-9]*\).*/\1/p'`
+	if [ $COUNT -gt 1 -a 0$MAX_RUNNING -lt 2 ]; then
+		echo "error: parallel_count=$COUNT, ranged GET requests were not sent in parallel($STATS)"
+		exit 1
+	fi
+	DOWNLOAD_SEC=`echo "$STATS" | sed -n 's/.*ranged_get_seconds=\([0-9.]*\).*/\1/p'`
+	echo "parallel_count=$COUNT $STATS" | awk -v start=$START -v end=$END -v dl=$DOWNLOAD_SEC -v size=$BENCH_SIZE \
+		'{ printf("%-20s total %8.2f sec  download %8.2f sec %8.2f MB/s  %s %s\n", $1, end - start, dl, (0 < dl ? size / dl : 0), $2, $3) }'
+done
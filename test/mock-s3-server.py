@@ -0,0 +1,378 @@
+#!/usr/bin/env python
+#
+# Minimal S3 compatible server for benchmarking s3fs on local machine.
+#
+# This server keeps objects in memory, and does not check signatures.
+# It supports the requests which s3fs uses:
+#   GET(with Range)/HEAD/PUT/DELETE object, PUT copy(x-amz-copy-source),
+#   ListBucket(prefix, delimiter, marker, max-keys), multipart upload,
+#   upload part copy and Multi-Object Delete.
+#
+# The throughput of each connection can be limited by --rate(KB/s) and
+# the latency of each request can be added by --latency(ms), then the
+# effect of parallel requests can be measured like as real S3.
+#
+# "GET /mock-stats" returns the count of ranged GET requests, the max
+# count of them which were sent at the same time and the seconds from the
+# first ranged GET to the end of last one("?reset" clears them), then the
+# benchmark can check that the ranges are downloaded in parallel.
+#
+# s3fs sends the request to "bucket.domain", then the bucket name is taken
+# from Host header when it ends with --domain. The host name must be
+# resolved to 127.0.0.1 (ex. add it to /etc/hosts).
+#
+# Usage: mock-s3-server.py [--port 8080] [--rate 0] [--latency 0] [--domain localhost]
+#
+import hashlib
+import optparse
+import re
+import sys
+import threading
+import time
+import uuid
+
+try:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+    from urllib.parse import urlparse, parse_qs, unquote
+except ImportError:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+    from urlparse import urlparse, parse_qs
+    from urllib import unquote
+
+XMLNS = "http://s3.amazonaws.com/doc/2006-03-01/"
+
+lock = threading.Lock()
+buckets = {}    # bucket -> {key -> object}
+uploads = {}    # upload id -> {"bucket", "key", "meta", "parts"}
+options = None
+stats = {"ranged_gets": 0, "running_ranged_gets": 0, "max_ranged_gets": 0, "first_ranged_get": 0, "last_ranged_get": 0}
+
+
+class S3Object(object):
+    def __init__(self, data, meta):
+        self.data = data
+        self.meta = meta
+        self.etag = hashlib.md5(data).hexdigest()
+        self.mtime = time.time()
+
+
+def http_date(t):
+    return time.strftime("%a, %d %b %Y %H:%M:%S GMT", time.gmtime(t))
+
+
+def iso_date(t):
+    return time.strftime("%Y-%m-%dT%H:%M:%S.000Z", time.gmtime(t))
+
+
+def xml_escape(s):
+    return s.replace("&", "&amp;").replace("<", "&lt;").replace(">", "&gt;")
+
+
+class ThreadingServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+    request_queue_size = 128
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        if options.verbose:
+            BaseHTTPRequestHandler.log_message(self, format, *args)
+
+    # -- utilities --
+    def parse(self):
+        # the latency is added before the lock is taken, then the requests
+        # which are sent in parallel are delayed in parallel.
+        if options.latency:
+            time.sleep(options.latency / 1000.0)
+        url = urlparse(self.path)
+        host = self.headers.get("Host", "").split(":")[0]
+        if options.domain and host.endswith("." + options.domain):
+            # virtual hosted style(bucket.domain/key) which s3fs uses
+            bucket = host[:-len(options.domain) - 1]
+            key = unquote(url.path[1:])
+        else:
+            parts = url.path.lstrip("/").split("/", 1)
+            bucket = unquote(parts[0])
+            key = unquote(parts[1]) if 1 < len(parts) else ""
+        query = dict((k, v[0]) for k, v in parse_qs(url.query, keep_blank_values=True).items())
+        return bucket, key, query
+
+    def body(self):
+        length = int(self.headers.get("Content-Length", 0))
+        data = b""
+        while len(data) < length:
+            chunk = self.rfile.read(length - len(data))
+            if not chunk:
+                break
+            data += chunk
+        return data
+
+    def meta(self):
+        meta = {}
+        for k in self.headers.keys():
+            lk = k.lower()
+            if lk.startswith("x-amz-meta-") or lk in ("content-type", "cache-control", "content-encoding"):
+                meta[lk] = self.headers[k]
+        return meta
+
+    def send(self, code, data=b"", headers=None, head_only=False):
+        self.send_response(code)
+        for k, v in (headers or {}).items():
+            self.send_header(k, v)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        if head_only or not data:
+            return
+        if not options.rate:
+            self.wfile.write(data)
+            return
+        # limit the throughput of this connection
+        step = max(1, options.rate * 1024 // 10)
+        for pos in range(0, len(data), step):
+            start = time.time()
+            self.wfile.write(data[pos:pos + step])
+            wait = 0.1 - (time.time() - start)
+            if 0 < wait:
+                time.sleep(wait)
+
+    def send_xml(self, code, xml):
+        data = ('<?xml version="1.0" encoding="UTF-8"?>\n' + xml).encode("utf-8")
+        self.send(code, data, {"Content-Type": "application/xml"})
+
+    def send_error_xml(self, code, name):
+        self.send_xml(code, "<Error><Code>%s</Code></Error>" % name)
+
+    def object_headers(self, obj):
+        headers = {"ETag": '"%s"' % obj.etag, "Last-Modified": http_date(obj.mtime)}
+        for k, v in obj.meta.items():
+            # standard headers are sent in canonical case like S3(ex. Content-Type)
+            if not k.startswith("x-amz-"):
+                k = "-".join(p.capitalize() for p in k.split("-"))
+            headers[k] = v
+        headers.setdefault("Content-Type", "application/octet-stream")
+        return headers
+
+    def get_object(self, bucket, key):
+        return buckets.get(bucket, {}).get(key)
+
+    # -- verbs --
+    def do_HEAD(self):
+        bucket, key, query = self.parse()
+        with lock:
+            if bucket not in buckets:
+                buckets[bucket] = {}
+            obj = self.get_object(bucket, key)
+        if not key:
+            self.send(200, head_only=True)
+        elif obj is None:
+            self.send(404, head_only=True)
+        else:
+            inm = self.headers.get("If-None-Match")
+            self.send_response(304 if inm and inm.strip('"') == obj.etag else 200)
+            for k, v in self.object_headers(obj).items():
+                self.send_header(k, v)
+            self.send_header("Content-Length", str(len(obj.data)))
+            self.end_headers()
+
+    def mock_stats(self):
+        with lock:
+            last = time.time() if stats["running_ranged_gets"] else stats["last_ranged_get"]
+            seconds = last - stats["first_ranged_get"] if stats["ranged_gets"] else 0
+            text = "ranged_gets=%d max_concurrent_ranged_gets=%d ranged_get_seconds=%.2f\n" % (stats["ranged_gets"], stats["max_ranged_gets"], seconds)
+            if self.path.endswith("?reset"):
+                stats["ranged_gets"] = stats["max_ranged_gets"] = 0
+        self.send(200, text.encode("utf-8"), {"Content-Type": "text/plain"})
+
+    def do_GET(self):
+        if self.path.split("?")[0] == "/mock-stats":
+            return self.mock_stats()
+        bucket, key, query = self.parse()
+        if not key:
+            return self.list_bucket(bucket, query)
+        with lock:
+            obj = self.get_object(bucket, key)
+        if obj is None:
+            return self.send_error_xml(404, "NoSuchKey")
+
+        headers = self.object_headers(obj)
+        inm = self.headers.get("If-None-Match")
+        if inm and inm.strip('"') == obj.etag:
+            return self.send(304, headers=headers)
+
+        rng = self.headers.get("Range")
+        m = re.match(r"bytes=(\d+)-(\d*)", rng or "")
+        if not m:
+            return self.send(200, obj.data, headers)
+        start = int(m.group(1))
+        end = int(m.group(2)) if m.group(2) else len(obj.data) - 1
+        end = min(end, len(obj.data) - 1)
+        if start > end:
+            return self.send_error_xml(416, "InvalidRange")
+        headers["Content-Range"] = "bytes %d-%d/%d" % (start, end, len(obj.data))
+        with lock:
+            if not stats["ranged_gets"]:
+                stats["first_ranged_get"] = time.time()
+            stats["ranged_gets"] += 1
+            stats["running_ranged_gets"] += 1
+            stats["max_ranged_gets"] = max(stats["max_ranged_gets"], stats["running_ranged_gets"])
+        try:
+            self.send(206, obj.data[start:end + 1], headers)
+        finally:
+            with lock:
+                stats["running_ranged_gets"] -= 1
+                stats["last_ranged_get"] = time.time()
+
+    def do_PUT(self):
+        bucket, key, query = self.parse()
+        data = self.body()
+        source = self.headers.get("x-amz-copy-source")
+        with lock:
+            bucket_objs = buckets.setdefault(bucket, {})
+            src = None
+            if source:
+                sbucket, skey = unquote(source).lstrip("/").split("/", 1)
+                src = self.get_object(sbucket, skey)
+                if src is None:
+                    return self.send_error_xml(404, "NoSuchKey")
+
+            # upload part / upload part copy
+            if "uploadId" in query:
+                upload = uploads.get(query["uploadId"])
+                if upload is None:
+                    return self.send_error_xml(404, "NoSuchUpload")
+                if src is not None:
+                    data = src.data
+                    m = re.match(r"bytes=(\d+)-(\d+)", self.headers.get("x-amz-copy-source-range", ""))
+                    if m:
+                        data = data[int(m.group(1)):int(m.group(2)) + 1]
+                part = S3Object(data, {})
+                upload["parts"][int(query["partNumber"])] = part
+                if src is not None:
+                    return self.send_xml(200, "<CopyPartResult><LastModified>%s</LastModified><ETag>\"%s\"</ETag></CopyPartResult>"
+                                         % (iso_date(part.mtime), part.etag))
+                return self.send(200, headers={"ETag": '"%s"' % part.etag})
+
+            if src is not None:
+                meta = src.meta
+                if self.headers.get("x-amz-metadata-directive", "").upper() == "REPLACE":
+                    meta = self.meta()
+                obj = S3Object(src.data, meta)
+                bucket_objs[key] = obj
+                return self.send_xml(200, "<CopyObjectResult><LastModified>%s</LastModified><ETag>\"%s\"</ETag></CopyObjectResult>"
+                                     % (iso_date(obj.mtime), obj.etag))
+
+            obj = S3Object(data, self.meta())
+            bucket_objs[key] = obj
+        self.send(200, headers={"ETag": '"%s"' % obj.etag})
+
+    def do_POST(self):
+        bucket, key, query = self.parse()
+        data = self.body()
+        with lock:
+            if "uploads" in query:
+                upload_id = uuid.uuid4().hex
+                uploads[upload_id] = {"bucket": bucket, "key": key, "meta": self.meta(), "parts": {}}
+                return self.send_xml(200, "<InitiateMultipartUploadResult xmlns=\"%s\"><Bucket>%s</Bucket><Key>%s</Key><UploadId>%s</UploadId></InitiateMultipartUploadResult>"
+                                     % (XMLNS, xml_escape(bucket), xml_escape(key), upload_id))
+            if "uploadId" in query:
+                upload = uploads.pop(query["uploadId"], None)
+                if upload is None:
+                    return self.send_error_xml(404, "NoSuchUpload")
+                numbers = [int(n) for n in re.findall(r"<PartNumber>(\d+)</PartNumber>", data.decode("utf-8"))]
+                content = b"".join(upload["parts"][n].data for n in numbers)
+                obj = S3Object(content, upload["meta"])
+                buckets.setdefault(bucket, {})[key] = obj
+                return self.send_xml(200, "<CompleteMultipartUploadResult xmlns=\"%s\"><Key>%s</Key><ETag>\"%s\"</ETag></CompleteMultipartUploadResult>"
+                                     % (XMLNS, xml_escape(key), obj.etag))
+            if "delete" in query:
+                result = ""
+                for name in re.findall(r"<Key>(.*?)</Key>", data.decode("utf-8")):
+                    name = name.replace("&lt;", "<").replace("&gt;", ">").replace("&amp;", "&")
+                    buckets.get(bucket, {}).pop(name, None)
+                    result += "<Deleted><Key>%s</Key></Deleted>" % xml_escape(name)
+                return self.send_xml(200, "<DeleteResult xmlns=\"%s\">%s</DeleteResult>" % (XMLNS, result))
+        self.send_error_xml(400, "InvalidRequest")
+
+    def do_DELETE(self):
+        bucket, key, query = self.parse()
+        with lock:
+            if "uploadId" in query:
+                uploads.pop(query["uploadId"], None)
+            else:
+                buckets.get(bucket, {}).pop(key, None)
+        self.send(204)
+
+    def list_bucket(self, bucket, query):
+        prefix = query.get("prefix", "")
+        delimiter = query.get("delimiter", "")
+        marker = query.get("marker", "")
+        max_keys = int(query.get("max-keys", 1000))
+        with lock:
+            keys = sorted(k for k in buckets.get(bucket, {}).keys() if k.startswith(prefix) and k > marker)
+            objs = dict((k, buckets[bucket][k]) for k in keys)
+
+        contents = ""
+        prefixes = []
+        count = 0
+        truncated = False
+        last = ""
+        for k in keys:
+            if delimiter:
+                pos = k.find(delimiter, len(prefix))
+                if 0 <= pos:
+                    common = k[:pos + len(delimiter)]
+                    if common not in prefixes:
+                        if count >= max_keys:
+                            truncated = True
+                            break
+                        prefixes.append(common)
+                        count += 1
+                        last = common
+                    continue
+            if count >= max_keys:
+                truncated = True
+                break
+            obj = objs[k]
+            contents += ("<Contents><Key>%s</Key><LastModified>%s</LastModified><ETag>\"%s\"</ETag>"
+                         "<Size>%d</Size><StorageClass>STANDARD</StorageClass></Contents>"
+                         % (xml_escape(k), iso_date(obj.mtime), obj.etag, len(obj.data)))
+            count += 1
+            last = k
+
+        xml = "<ListBucketResult xmlns=\"%s\"><Name>%s</Name><Prefix>%s</Prefix><Marker>%s</Marker>" \
+              "<MaxKeys>%d</MaxKeys><IsTruncated>%s</IsTruncated>" \
+              % (XMLNS, xml_escape(bucket), xml_escape(prefix), xml_escape(marker), max_keys, "true" if truncated else "false")
+        if truncated:
+            xml += "<NextMarker>%s</NextMarker>" % xml_escape(last)
+        xml += contents
+        for p in prefixes:
+            xml += "<CommonPrefixes><Prefix>%s</Prefix></CommonPrefixes>" % xml_escape(p)
+        xml += "</ListBucketResult>"
+        self.send_xml(200, xml)
+
+
+def main():
+    global options
+    parser = optparse.OptionParser()
+    parser.add_option("--port", type="int", default=8080, help="listen port")
+    parser.add_option("--rate", type="int", default=0, help="max throughput of each connection(KB/s), 0 is no limit")
+    parser.add_option("--latency", type="int", default=0, help="latency of each request(ms)")
+    parser.add_option("--domain", default="localhost", help="domain for virtual hosted style(bucket.domain)")
+    parser.add_option("--verbose", action="store_true", default=False, help="print each request")
+    options, args = parser.parse_args()
+
+    server = ThreadingServer(("127.0.0.1", options.port), Handler)
+    sys.stdout.write("mock s3 server listening on 127.0.0.1:%d\n" % options.port)
+    sys.stdout.flush()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
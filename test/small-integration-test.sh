@@ -273,6 +273,37 @@ then
    exit 1
 fi
 
+##########################################################
+# Open as non-root user after listing(enable_list_stat)
+##########################################################
+echo "Testing open as non-root user after listing ..."
+
+# remount with the stat cache which is made from listing
+cd $CUR_DIR
+umount $TEST_BUCKET_MOUNT_POINT_1
+$S3FS $TEST_BUCKET_1 $TEST_BUCKET_MOUNT_POINT_1 -o passwd_file=$S3FS_CREDENTIALS_FILE -o enable_list_stat -o allow_other
+cd $TEST_BUCKET_MOUNT_POINT_1
+
+echo $TEST_TEXT > $TEST_TEXT_FILE
+chmod 644 $TEST_TEXT_FILE
+
+# the listed entry does not have mode and owner, it must not deny the access.
+ls -l > /dev/null
+CONTENT=`su -s /bin/sh nobody -c "cat $TEST_BUCKET_MOUNT_POINT_1/$TEST_TEXT_FILE"`
+if [ "${CONTENT}" != "${TEST_TEXT}" ]; then
+   echo "Could not read ${TEST_TEXT_FILE} as non-root user after listing, got ${CONTENT}"
+   exit 1
+fi
+
+# clean up
+rm $TEST_TEXT_FILE
+
+if [ -e $TEST_TEXT_FILE ]
+then
+   echo "Could not cleanup file ${TEST_TEXT_FILE}"
+   exit 1
+fi
+
 #####################################################################
 # Tests are finished
 #####################################################################